@@ -0,0 +1,6 @@
+#version 400 core
+
+// depth only
+void main()
+{
+}
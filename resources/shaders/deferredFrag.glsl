@@ -0,0 +1,46 @@
+#version 400 core
+
+// Lighting pass of the deferred path, a fullscreen quad over the G-buffer
+
+#include "lighting.glsl"
+
+struct GBuffer
+{
+    sampler2D albedo;
+    sampler2D normal;
+    sampler2D depth;
+};
+uniform GBuffer gBuffer;
+uniform mat4 inverseViewProjection;
+
+in vec2 textureCoords;
+
+out vec4 fragColor;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gBuffer.depth, texel, 0).r;
+    // nothing there, the skybox fills it later
+    if(depth == 1.0)
+        discard;
+
+    vec4 albedo = texelFetch(gBuffer.albedo, texel, 0);
+    vec3 normalShininess = texelFetch(gBuffer.normal, texel, 0).rgb;
+    vec4 pos = inverseViewProjection * vec4(vec3(textureCoords, depth) * 2.0 - 1.0, 1.0);
+
+    Surface surface;
+    surface.pos = pos.xyz / pos.w;
+    surface.normal = DecodeNormal(normalShininess.rg);
+    surface.diffuse = albedo.rgb;
+    surface.specular = vec3(albedo.a);
+    surface.shininess = normalShininess.b * 256.0;
+
+    vec3 color = CalcLighting(surface);
+
+    float gamma = 2.2;
+    color = pow(color, vec3(1/gamma));
+    fragColor = vec4(color, 1.0f);
+    // later forward draws depth test against the scene
+    gl_FragDepth = depth;
+}
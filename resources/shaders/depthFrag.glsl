@@ -0,0 +1,12 @@
+#version 400 core
+
+// Depth prepass of the material. Keeps the rasterized depth, only discarding where the shading pass will,
+// so the parallax ray is still marched but no light is evaluated
+
+#include "material.glsl"
+
+void main()
+{
+    if(!InsideTexture(GetParallaxCoords()))
+        discard;
+}
@@ -0,0 +1,21 @@
+#version 400 core
+
+// Geometry pass of the deferred path, the material goes into the G-buffer to be lit later, once per pixel:
+//  albedo: rgb diffuse, a specular
+//  normal: rg octahedral world normal, b shininess / 256
+// Position isn't stored, it comes back from depth
+
+#include "material.glsl"
+
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec4 normalShininess;
+
+void main()
+{
+    Surface surface;
+    if(!SampleSurface(surface))
+        discard;
+
+    albedo = vec4(surface.diffuse, dot(surface.specular, vec3(0.2126, 0.7152, 0.0722)));
+    normalShininess = vec4(EncodeNormal(surface.normal), surface.shininess / 256.0, 0.0);
+}
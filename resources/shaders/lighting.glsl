@@ -0,0 +1,345 @@
+// Lighting shared by the forward and deferred paths. Everything is in world space
+
+// Light
+struct Light
+{
+    vec3 diffuse;
+    vec3 specular;
+};
+
+#include "surface.glsl"
+
+vec3 CalcLighting(Surface surface);
+
+vec3 CalcDiffuse(Light light, vec3 lightDir, Surface surface);
+vec3 CalcSpecular(Light light, vec3 lightDir, Surface surface);
+Light CalcColor(Light light, vec3 lightDir, Surface surface);
+
+// Attenuation
+struct Attenuation
+{
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+float CalcAttenuation(Attenuation attenuation, vec3 lightRay);
+
+// DirLight
+struct DirLight
+{
+    vec3 dir;
+    Light light;
+};
+
+vec3 CalcDirLight(DirLight dirLight, Surface surface);
+
+// Sun shadows, cascades over slices of the view frustum
+struct SunShadows
+{
+    sampler2DArrayShadow map;
+    mat4 matrices[4];
+    vec4 splits; // view depth where each cascade ends
+    vec4 texelSizes; // world size of a shadow texel
+};
+uniform SunShadows sunShadows;
+
+float CalcSunShadow(Surface surface);
+
+// PointLight
+struct PointLight
+{
+    vec3 pos;
+    float radius;
+    Attenuation attenuation;
+    Light light;
+    int shadow; // slot in pointShadows.tiles, -1 for none
+};
+
+vec3 CalcPointLight(PointLight pointLight, Surface surface);
+
+// Point light shadows, distance to the light over its radius. Every cube face is a tile of one atlas
+struct PointShadowAtlas
+{
+    sampler2D atlas;
+    samplerBuffer tiles; // 7 texels per slot: static and dynamic face sizes, then per face the static and dynamic corners
+};
+uniform PointShadowAtlas pointShadows;
+
+float CalcPointShadow(PointLight pointLight, Surface surface);
+
+// Clustered point lights, assigned to view frustum clusters on the CPU
+struct Clusters
+{
+    samplerBuffer lights; // 4 texels per light: pos and radius, diffuse, specular, attenuation
+    usamplerBuffer grid; // per cluster: offset into indices and light count
+    usamplerBuffer indices;
+    uvec3 size;
+    vec2 tileScale; // clusters per pixel
+    vec2 sliceScaleBias; // slice from log of view depth
+};
+uniform Clusters clusters;
+
+int ClusterIndex(vec3 pos);
+PointLight FetchPointLight(int index);
+
+// SpotLight
+struct SpotLight
+{
+    vec3 pos;
+    vec3 dir;
+
+    float iCutOff;
+    float oCutOff;
+
+    Attenuation attenuation;
+    Light light;
+};
+
+float CalcIntensity(SpotLight spotLight, Surface surface);
+vec3 CalcSpotLight(SpotLight spotLight, Surface surface);
+
+// Environment, the ambient light, baked from the skybox
+struct Environment
+{
+    vec3 irradiance[9]; // SH9 of the diffuse irradiance, divided by pi
+    samplerCube specular; // GGX prefiltered, roughness grows along the mips
+    sampler2D brdf; // split-sum scale and bias to F0, by N dot V and roughness
+    float specularLevels;
+    float strength;
+};
+uniform Environment environment;
+
+vec3 CalcAmbient(Surface surface);
+vec3 CalcIrradiance(vec3 normal);
+
+// Lights
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+
+// Flags
+uniform bool blinn;
+uniform bool sunOn;
+uniform bool flashlightOn;
+
+// View angle
+uniform vec3 viewPos;
+uniform mat4 view;
+
+vec3 CalcLighting(Surface surface)
+{
+    vec3 color = CalcAmbient(surface);
+
+    if(sunOn)
+        color += CalcDirLight(dirLight, surface);
+
+    // only the lights touching this pixel cluster
+    uvec2 cluster = texelFetch(clusters.grid, ClusterIndex(surface.pos)).rg;
+    for(uint i = 0u; i < cluster.y; i++)
+    {
+        int light = int(texelFetch(clusters.indices, int(cluster.x + i)).r);
+        color += CalcPointLight(FetchPointLight(light), surface);
+    }
+    
+    if(flashlightOn)
+        color += CalcSpotLight(spotLight, surface);
+
+    return color;
+}
+
+int ClusterIndex(vec3 pos)
+{
+    float depth = -(view * vec4(pos, 1.0)).z;
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * clusters.tileScale), clusters.size.xy - 1u);
+    uint slice = uint(clamp(log(depth) * clusters.sliceScaleBias.x + clusters.sliceScaleBias.y, 0.0, float(clusters.size.z - 1u)));
+    return int((slice * clusters.size.y + tile.y) * clusters.size.x + tile.x);
+}
+
+PointLight FetchPointLight(int index)
+{
+    vec4 posRadius = texelFetch(clusters.lights, index * 4);
+    PointLight pointLight;
+    pointLight.pos = posRadius.xyz;
+    pointLight.radius = posRadius.w;
+    pointLight.light.diffuse = texelFetch(clusters.lights, index * 4 + 1).rgb;
+    pointLight.light.specular = texelFetch(clusters.lights, index * 4 + 2).rgb;
+    vec4 attenuation = texelFetch(clusters.lights, index * 4 + 3);
+    pointLight.attenuation = Attenuation(attenuation.x, attenuation.y, attenuation.z);
+    pointLight.shadow = int(attenuation.w);
+    return pointLight;
+}
+
+vec3 CalcDirLight(DirLight dirLight, Surface surface)
+{
+    Light color = CalcColor(dirLight.light, dirLight.dir, surface);
+    return (color.diffuse + color.specular) * CalcSunShadow(surface);
+}
+
+// 1 lit, 0 in shadow. Past the last cascade everything is lit
+float CalcSunShadow(Surface surface)
+{
+    float depth = -(view * vec4(surface.pos, 1.0)).z;
+    int cascade = 0;
+    while(cascade < 4 && depth > sunShadows.splits[cascade])
+        cascade++;
+    if(cascade == 4)
+        return 1.0;
+
+    // pushed along the normal by a texel, against acne on surfaces facing away from the sun
+    vec3 pos = surface.pos + surface.normal * sunShadows.texelSizes[cascade] * 1.5;
+    vec4 lightSpace = sunShadows.matrices[cascade] * vec4(pos, 1.0);
+    vec3 coords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+
+    // 4 bilinear comparisons, a 3x3 texel footprint
+    vec2 texel = 1.0 / vec2(textureSize(sunShadows.map, 0).xy);
+    float lit = 0.0;
+    lit += texture(sunShadows.map, vec4(coords.xy + vec2(-0.5, -0.5) * texel, cascade, coords.z));
+    lit += texture(sunShadows.map, vec4(coords.xy + vec2( 0.5, -0.5) * texel, cascade, coords.z));
+    lit += texture(sunShadows.map, vec4(coords.xy + vec2(-0.5,  0.5) * texel, cascade, coords.z));
+    lit += texture(sunShadows.map, vec4(coords.xy + vec2( 0.5,  0.5) * texel, cascade, coords.z));
+    return lit * 0.25;
+}
+
+vec3 CalcPointLight(PointLight pointLight, Surface surface)
+{
+    vec3 lightRay = surface.pos - pointLight.pos;
+    // fades to nothing at the radius, so cutting the light at its cluster bounds doesn't show
+    float window = clamp(1.0 - pow(length(lightRay) / pointLight.radius, 4.0), 0.0, 1.0);
+    float attenuation = CalcAttenuation(pointLight.attenuation, lightRay) * window * window;
+    if(attenuation > 0.0 && pointLight.shadow >= 0)
+        attenuation *= CalcPointShadow(pointLight, surface);
+    Light color = CalcColor(pointLight.light, lightRay, surface);
+
+    return (color.diffuse + color.specular) * attenuation;
+}
+
+// the same faces as PointShadows
+const vec3 shadowFaceDirs[6] = vec3[](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+const vec3 shadowFaceUps[6] = vec3[](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+
+// distance over radius stored in the tile, for a ray in its face. corner and size are in atlas units
+float SampleShadowTile(vec3 lightRay, int face, vec2 corner, float size)
+{
+    // the projection of the face lookAt view
+    vec3 dir = shadowFaceDirs[face];
+    vec3 side = cross(dir, shadowFaceUps[face]);
+    vec3 up = cross(side, dir);
+    vec2 coords = vec2(dot(side, lightRay), dot(up, lightRay)) / dot(dir, lightRay) * 0.5 + 0.5;
+    // kept half a texel inside, so nothing is read from the neighbor tiles
+    float halfTexel = 0.5 / float(textureSize(pointShadows.atlas, 0).x);
+    vec2 uv = clamp(corner + coords * size, corner + halfTexel, corner + size - halfTexel);
+    return textureLod(pointShadows.atlas, uv, 0.0).r;
+}
+
+// 1 lit, 0 in shadow
+float CalcPointShadow(PointLight pointLight, Surface surface)
+{
+    vec3 lightRay = surface.pos - pointLight.pos;
+    vec3 axis = abs(lightRay);
+    int face = axis.x >= axis.y && axis.x >= axis.z ? (lightRay.x > 0.0 ? 0 : 1) : axis.y >= axis.z ? (lightRay.y > 0.0 ? 2 : 3) : (lightRay.z > 0.0 ? 4 : 5);
+    int base = pointLight.shadow * 7;
+    vec2 sizes = texelFetch(pointShadows.tiles, base).xy;
+    vec4 corners = texelFetch(pointShadows.tiles, base + 1 + face);
+
+    // the nearer of the static and dynamic casters
+    float closest = SampleShadowTile(lightRay, face, corners.xy, sizes.x);
+    if(sizes.y > 0.0)
+        closest = min(closest, SampleShadowTile(lightRay, face, corners.zw, sizes.y));
+    closest *= pointLight.radius;
+    // grows at grazing angles, where a texel spans more distance
+    float bias = mix(0.05, 0.01, abs(dot(normalize(lightRay), surface.normal)));
+    return length(lightRay) - bias > closest ? 0.0 : 1.0;
+}
+
+vec3 CalcSpotLight(SpotLight spotLight, Surface surface)
+{
+    vec3 lightRay = surface.pos - spotLight.pos;
+    float attenuation = CalcAttenuation(spotLight.attenuation, lightRay);
+    float intensity = CalcIntensity(spotLight, surface);
+    Light color = CalcColor(spotLight.light, lightRay, surface);
+
+    return (color.diffuse + color.specular) * intensity * attenuation;
+}
+
+float CalcIntensity(SpotLight spotLight, Surface surface)
+{
+    vec3 lightRay = surface.pos - spotLight.pos;
+    vec3 lightDir = normalize(lightRay);
+    float theta = dot(lightDir, normalize(spotLight.dir));
+    float epsilon = spotLight.iCutOff - spotLight.oCutOff;
+    float intensity = clamp((theta - spotLight.oCutOff) / epsilon, 0.0, 1.0);
+
+    return intensity;
+}
+
+float CalcAttenuation(Attenuation attenuation, vec3 lightRay)
+{
+    float dist = length(lightRay);
+    float att = 1.0 / (attenuation.constant + attenuation.linear * dist + attenuation.quadratic * pow(dist, 2));
+    return att;
+}
+
+Light CalcColor(Light light, vec3 lightDir, Surface surface)
+{   
+    lightDir = normalize(lightDir);
+
+    Light color;
+    color.diffuse = CalcDiffuse(light, lightDir, surface);
+    color.specular = CalcSpecular(light, lightDir, surface);
+    return color;
+}
+
+// Evaluated once per fragment, whatever the number of lights
+vec3 CalcAmbient(Surface surface)
+{
+    vec3 n = surface.normal;
+    vec3 v = normalize(viewPos - surface.pos);
+    float nDotV = max(dot(n, v), 0.0);
+
+    // Blinn-Phong exponent to GGX roughness
+    float roughness = sqrt(2.0 / (surface.shininess * 2.0 + 2.0));
+    vec2 brdf = texture(environment.brdf, vec2(nDotV, roughness)).rg;
+    vec3 prefiltered = textureLod(environment.specular, reflect(-v, n), roughness * (environment.specularLevels - 1.0)).rgb;
+
+    vec3 diffuse = CalcIrradiance(n) * surface.diffuse;
+    vec3 specular = prefiltered * (0.04 * brdf.x + brdf.y) * surface.specular;
+    return (diffuse + specular) * environment.strength;
+}
+
+vec3 CalcIrradiance(vec3 n)
+{
+    vec3 irradiance = environment.irradiance[0] * 0.282095;
+    irradiance += environment.irradiance[1] * 0.488603 * n.y;
+    irradiance += environment.irradiance[2] * 0.488603 * n.z;
+    irradiance += environment.irradiance[3] * 0.488603 * n.x;
+    irradiance += environment.irradiance[4] * 1.092548 * n.x * n.y;
+    irradiance += environment.irradiance[5] * 1.092548 * n.y * n.z;
+    irradiance += environment.irradiance[6] * 0.315392 * (3.0 * n.z * n.z - 1.0);
+    irradiance += environment.irradiance[7] * 1.092548 * n.x * n.z;
+    irradiance += environment.irradiance[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(irradiance, vec3(0.0));
+}
+
+vec3 CalcDiffuse(Light light, vec3 lightDir, Surface surface)
+{
+    float diff = max(dot(-lightDir, surface.normal), 0.0);
+    return light.diffuse * diff * surface.diffuse;
+}
+
+vec3 CalcSpecular(Light light, vec3 lightDir, Surface surface)
+{   
+    vec3 viewDir = normalize(viewPos - surface.pos);
+    float spec = 0;
+    if(blinn)
+    {
+        vec3 halfway = normalize(viewDir - lightDir);
+        spec = pow(max(dot(surface.normal, halfway), 0.0), surface.shininess * 2);
+    }
+    else
+    {
+        vec3 reflected = reflect(lightDir, surface.normal);
+        spec = pow(max(dot(reflected, viewDir), 0.0), surface.shininess);
+    }
+
+    return light.specular * spec * surface.specular;
+}
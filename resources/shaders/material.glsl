@@ -0,0 +1,101 @@
+// Parallax and normal mapped material, sampled into a Surface
+
+#include "surface.glsl"
+
+// Material
+struct Material
+{
+    sampler2D diffuse;
+    sampler2D specular;
+    sampler2D normalDepth; // rg: normal xy, b: depth, a: sqrt of the relaxed cone ratio
+    float shininess;
+};
+uniform Material material;
+
+// Normal mapping
+vec3 UnpackNormal(vec4 normalDepth);
+
+// Parallax
+vec2 CalculateParallaxCoords(vec2 texCoords, vec3 viewDir);
+vec2 GetParallaxCoords();
+
+// Inputs
+in vec3 normal;
+in vec3 fragPos;
+in vec2 textureCoords;
+
+// Normal mapping
+in mat3 tbn;
+in vec3 tangentViewPos;
+in vec3 tangentFragPos;
+
+// False where the parallax ray left the texture
+bool InsideTexture(vec2 texCoords)
+{
+    return texCoords.x <= 1.0 && texCoords.y <= 1.0 && texCoords.x >= 0.0 && texCoords.y >= 0.0;
+}
+
+// Samples the material at the parallax corrected coords. False where the ray left the texture, which should be discarded
+bool SampleSurface(out Surface surface)
+{
+    vec2 texCoords = GetParallaxCoords();
+    if(!InsideTexture(texCoords))
+        return false;
+
+    surface.pos = fragPos;
+    surface.normal = normalize(tbn * UnpackNormal(texture(material.normalDepth, texCoords)));
+    surface.diffuse = texture(material.diffuse, texCoords).rgb;
+    surface.specular = texture(material.specular, texCoords).rgb;
+    surface.shininess = material.shininess;
+    return true;
+}
+
+vec3 UnpackNormal(vec4 normalDepth)
+{
+    vec2 xy = normalDepth.rg * 2.0 - 1.0;
+    return normalize(vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0))));
+}
+
+vec2 GetParallaxCoords()
+{
+    vec3 viewDir = normalize(tangentViewPos - tangentFragPos);
+    return CalculateParallaxCoords(textureCoords, viewDir);
+}
+
+// Relaxed cone stepping. Each step moves the ray to the boundary of the cone stored at its current texel,
+// which may overshoot into the surface once at most. A binary search between the last two positions then finds the hit.
+vec2 CalculateParallaxCoords(vec2 texCoords, vec3 viewDir)
+{
+    const int coneSteps = 8;
+    const int binarySteps = 6;
+    const float height_scale = 0.1f;
+
+    // Ray in texture space, advancing one unit of depth per unit of length along z
+    vec3 rayDir = vec3(-viewDir.xy / max(viewDir.z, 0.05) * height_scale, 1.0);
+    float rayRatio = length(rayDir.xy);
+
+    vec3 pos = vec3(texCoords, 0.0);
+    float stepSize = 0.0;
+    for(int i = 0; i < coneSteps; i++)
+    {
+        vec4 normalDepth = texture(material.normalDepth, pos.xy);
+        float coneRatio = normalDepth.a * normalDepth.a;
+        float height = max(normalDepth.b - pos.z, 0.0);
+        stepSize = coneRatio * height / (rayRatio + coneRatio);
+        pos += rayDir * stepSize;
+    }
+
+    // the hit is somewhere along the last step
+    vec3 range = 0.5 * rayDir * stepSize;
+    pos -= range;
+    for(int i = 0; i < binarySteps; i++)
+    {
+        range *= 0.5;
+        if(pos.z < texture(material.normalDepth, pos.xy).b)
+            pos += range;
+        else
+            pos -= range;
+    }
+
+    return pos.xy;
+}
@@ -1,4 +1,4 @@
-#version 420 core
+#version 400 core
 
 uniform vec3 lightPos;
 uniform float far_plane;
@@ -0,0 +1,19 @@
+#version 400 core
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 shadowMatrices[6];
+// faces the caster touches, one per instance. Viewport i is the atlas tile of face i
+uniform int faces[6];
+
+out vec4 fragPos;
+
+void main()
+{
+    int face = faces[gl_InstanceID];
+    fragPos = model * vec4(aPos, 1.0);
+    gl_Position = shadowMatrices[face] * fragPos;
+    gl_ViewportIndex = face;
+}
@@ -1,9 +1,13 @@
-#version 420 core
+#version 400 core
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
+uniform mat4 shadowMatrix;
+
+out vec4 fragPos;
 
 void main()
 {
-    gl_Position = model * vec4(aPos, 1.0);
-}  
\ No newline at end of file
+    fragPos = model * vec4(aPos, 1.0);
+    gl_Position = shadowMatrix * fragPos;
+}
@@ -0,0 +1,13 @@
+#version 400 core
+out vec4 fragColor;
+
+in vec3 textureDir;
+
+uniform samplerCube skybox;
+
+void main()
+{
+    vec3 color = texture(skybox, textureDir).rgb;
+    float gamma = 2.2;
+    fragColor = vec4(pow(color, vec3(1/gamma)), 1.0);
+}
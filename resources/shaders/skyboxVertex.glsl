@@ -0,0 +1,15 @@
+#version 400 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 textureDir;
+
+void main()
+{
+    textureDir = aPos;
+    // Drop the translation so the sky stays at infinity, and force depth to 1 so it only fills what the scene didn't
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
+    gl_Position = pos.xyww;
+}
@@ -5,39 +5,15 @@ layout (location = 2) in vec2 aTextureCoords;
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in vec3 aBitangent;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per draw matrices from the RenderQueue object buffer
+layout (location = 5) in mat4 objectTransform; // projection * view * model
+layout (location = 9) in mat4 model;
+layout (location = 13) in mat3 normalMatrix;
+
 uniform bool reverseNormals;
 
 // Normal Mapping
 
-// Light
-struct Light
-{
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-// Attenuation
-struct Attenuation
-{
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-// PointLight
-struct PointLight
-{
-    vec3 pos;
-    Attenuation attenuation;
-    Light light;
-};
-
-#define POINT_LIGHTS_COUNT 4
-uniform PointLight pointLights[POINT_LIGHTS_COUNT];
 uniform vec3 viewPos;
 
 out vec3 normal;
@@ -45,23 +21,21 @@ out vec3 fragPos;
 out vec2 textureCoords;
 
 out mat3 tbn;
-out vec3 tangentLightPos;
 out vec3 tangentViewPos;
 out vec3 tangentFragPos;
 
+// the depth prepass and the shading pass must rasterize the same depth for GL_EQUAL
+invariant gl_Position;
+
 void main()
 {
-    mat4 transform = projection * view * model;
+    gl_Position = objectTransform * vec4(aPos, 1.0f);
 
-    gl_Position = transform * vec4(aPos, 1.0f);
-    
-    mat3 normalMatrix = mat3(transpose(inverse(model)));
     normal = normalMatrix * (reverseNormals ? -aNormal : aNormal);
     fragPos = vec3(model * vec4(aPos, 1.0));
     textureCoords = aTextureCoords;
     tbn = mat3(normalMatrix * aTangent, normalMatrix * aBitangent, normal);
 
-    tangentLightPos = tbn * pointLights[0].pos;
     tangentViewPos = tbn * viewPos;
     tangentFragPos = tbn * fragPos;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include <iostream>
+#include <filesystem>
+#include <string>
+
+#include <TextureFile.h>
+#include <NormalDepthMap.h>
+#include <Cubemap.h>
+#include <ImageBasedLighting.h>
+
+// Offline baker for the assets the app would otherwise bake on its first launch
+void PrintUsage()
+{
+    std::cout << "Usage:\n";
+    std::cout << "  Bake normal-depth <normal map> <depth map> <output.tex>\n";
+    std::cout << "  Bake cubemap <faces dir> <output.tex>\n";
+    std::cout << "  Bake ibl <skybox.tex> <output dir>\n";
+    std::cout << "  Bake all [output dir]\n";
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::filesystem::path texturesDir{TEXTURES_DIR};
+    if(command == "normal-depth" && argc == 5)
+    {
+        return LearnOpenGL::BakeNormalDepth(argv[2], argv[3], argv[4]) ? 0 : 1;
+    }
+    else if(command == "cubemap" && argc == 4)
+    {
+        return LearnOpenGL::Cubemap::Bake(LearnOpenGL::Cubemap::FacesAt(argv[2]), argv[3]) ? 0 : 1;
+    }
+    else if(command == "ibl" && argc == 4)
+    {
+        return LearnOpenGL::ImageBasedLighting::Bake(argv[2], argv[3]) ? 0 : 1;
+    }
+    else if(command == "all")
+    {
+        std::filesystem::path outDir = argc > 2 ? std::filesystem::path{argv[2]} : std::filesystem::path{CACHE_DIR};
+        bool ok = LearnOpenGL::BakeNormalDepth(texturesDir / "bricks2_normal.jpg", texturesDir / "bricks2_disp.jpg", outDir / "bricks2_normal_depth.tex");
+        ok = LearnOpenGL::Cubemap::Bake(LearnOpenGL::Cubemap::FacesAt(texturesDir), outDir / "skybox.tex") && ok;
+        ok = ok && LearnOpenGL::ImageBasedLighting::Bake(outDir / "skybox.tex", outDir);
+        return ok ? 0 : 1;
+    }
+
+    PrintUsage();
+    return 1;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+
+// Headless benchmarks and checks, so the numbers quoted for the engine parts can be reproduced
+void PrintUsage()
+{
+    std::cout << "Usage:\n";
+    std::cout << "  Bench jobs [workers...]\n";
+    std::cout << "  Bench occlusion\n";
+    std::cout << "  Bench raycast [model.obj] [copies]\n";
+    std::cout << "  Bench commands\n";
+    std::cout << "  Bench residency\n";
+    std::cout << "  Bench bvh [objects...]\n";
+    std::cout << "  Bench all\n";
+    std::cout << "Timings are only meaningful in a Release build\n";
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::vector<std::string> args(argv + 2, argv + argc);
+    if(command == "jobs")
+    {
+        return JobsBench(args);
+    }
+    else if(command == "occlusion")
+    {
+        return OcclusionBench(args);
+    }
+    else if(command == "raycast")
+    {
+        return RaycastBench(args);
+    }
+    else if(command == "commands")
+    {
+        return CommandsBench(args);
+    }
+    else if(command == "residency")
+    {
+        return ResidencyBench(args);
+    }
+    else if(command == "bvh")
+    {
+        return BvhBench(args);
+    }
+    else if(command == "all")
+    {
+        bool ok = JobsBench({}) == 0;
+        ok = OcclusionBench({}) == 0 && ok;
+        ok = RaycastBench({}) == 0 && ok;
+        ok = CommandsBench({}) == 0 && ok;
+        ok = ResidencyBench({}) == 0 && ok;
+        ok = BvhBench({}) == 0 && ok;
+        return ok ? 0 : 1;
+    }
+
+    PrintUsage();
+    return 1;
+}
@@ -0,0 +1,26 @@
+
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Benchmarks and checks of the engine parts that run without a window. Each is given the arguments after its name and
+// returns 0 when all of its checks passed
+int JobsBench(const std::vector<std::string>& args);
+int OcclusionBench(const std::vector<std::string>& args);
+int RaycastBench(const std::vector<std::string>& args);
+int CommandsBench(const std::vector<std::string>& args);
+int ResidencyBench(const std::vector<std::string>& args);
+int BvhBench(const std::vector<std::string>& args);
+
+using Clock = std::chrono::steady_clock;
+
+inline double MsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+#endif
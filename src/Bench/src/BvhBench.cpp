@@ -0,0 +1,192 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Bvh.h>
+#include <Culling.h>
+#include <Frustum.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::BoxBounds;
+using LearnOpenGL::Bvh;
+
+namespace
+{
+    const int CHECKED_RAYS = 200;
+    const int RAYS = 100000;
+    const int REPEATS = 10;
+
+    struct View
+    {
+        const char* name;
+        glm::vec3 eye;
+        glm::vec3 target;
+    };
+
+    const View VIEWS[] = {
+        {"down the grid", {0.0f, 0.0f, 5.0f}, {0.0f, 0.0f, -10.0f}},
+        {"across it", {-30.0f, 4.0f, -8.0f}, {0.0f, 0.0f, -10.0f}},
+        {"from far away", {40.0f, 40.0f, 60.0f}, {0.0f, 0.0f, -20.0f}},
+    };
+
+    // laid out like the stress draws: 64x64 slabs half a unit apart, one behind the other. Every third one bobs
+    void Fill(BoxBounds& bounds, size_t count, float time)
+    {
+        const int side = 64;
+        bounds.Clear();
+        for(size_t i = 0; i < count; i++)
+        {
+            glm::vec3 pos{(float)(i % side) - side / 2, (float)((i / side) % side) - side / 2, -10.0f - (float)(i / (side * side))};
+            pos *= 0.5f;
+            if(i % 3 == 0)
+                pos.y += 0.2f * std::sin(time + i);
+            bounds.Push(pos - 0.1f, pos + 0.1f);
+        }
+    }
+
+    // the same slab test as the tree, over every box
+    Bvh::Hit BruteForce(const BoxBounds& bounds, glm::vec3 origin, glm::vec3 dir, float maxDistance)
+    {
+        Bvh::Hit hit;
+        auto inverseDir = 1.0f / dir;
+        for(uint32_t i = 0; i < bounds.Size(); i++)
+        {
+            glm::vec3 center{bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]};
+            glm::vec3 extent{bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]};
+            auto t0 = (center - extent - origin) * inverseDir;
+            auto t1 = (center + extent - origin) * inverseDir;
+            auto near = glm::min(t0, t1);
+            auto far = glm::max(t0, t1);
+            float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+            float exit = std::min(std::min(far.x, far.y), far.z);
+            if(enter <= exit && enter < maxDistance && enter < hit.distance)
+                hit = {i, enter};
+        }
+        return hit;
+    }
+
+    bool Same(float a, float b)
+    {
+        return std::isinf(a) ? std::isinf(b) : std::abs(a - b) <= 1e-4f;
+    }
+
+    // tree frustum queries against the linear pass from every view, in any order
+    size_t Mismatches(const Bvh& tree, const BoxBounds& bounds, const glm::mat4& projection)
+    {
+        LearnOpenGL::FrustumCuller culler;
+        std::vector<uint32_t> expected, found;
+        size_t mismatches = 0;
+        for(auto& view : VIEWS)
+        {
+            LearnOpenGL::Frustum frustum(projection * glm::lookAt(view.eye, view.target, glm::vec3(0.0f, 1.0f, 0.0f)));
+            culler.Cull(frustum, bounds, expected);
+            tree.Query(frustum, found);
+            std::sort(found.begin(), found.end());
+            std::vector<uint32_t> difference;
+            std::set_symmetric_difference(expected.begin(), expected.end(), found.begin(), found.end(), std::back_inserter(difference));
+            mismatches += difference.size();
+        }
+        return mismatches;
+    }
+
+    bool Run(size_t count)
+    {
+        auto projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+        BoxBounds bounds;
+        Fill(bounds, count, 0.0f);
+        Bvh tree;
+        auto start = Clock::now();
+        tree.Build(bounds);
+        double buildMs = MsSince(start);
+        std::cout << count << " objects: " << tree.GetStats().nodes << " nodes, build " << buildMs << " ms\n";
+
+        bool ok = true;
+        size_t mismatches = Mismatches(tree, bounds, projection);
+
+        // refitted to the bobbing boxes, the tree still has to find the same ones
+        Fill(bounds, count, 1.0f);
+        start = Clock::now();
+        tree.Refit(bounds);
+        double refitMs = MsSince(start);
+        mismatches += Mismatches(tree, bounds, projection);
+        std::cout << "  refit " << refitMs << " ms, cost " << tree.GetStats().cost << "/" << tree.GetStats().builtCost << ", "
+            << mismatches << " frustum mismatches\n";
+        if(mismatches)
+        {
+            std::cout << "  FAIL: frustum queries differ from the linear pass\n";
+            ok = false;
+        }
+
+        LearnOpenGL::FrustumCuller culler;
+        std::vector<uint32_t> visible;
+        for(auto& view : VIEWS)
+        {
+            LearnOpenGL::Frustum frustum(projection * glm::lookAt(view.eye, view.target, glm::vec3(0.0f, 1.0f, 0.0f)));
+            start = Clock::now();
+            for(int repeat = 0; repeat < REPEATS; repeat++)
+                tree.Query(frustum, visible);
+            double queryMs = MsSince(start) / REPEATS;
+            start = Clock::now();
+            for(int repeat = 0; repeat < REPEATS; repeat++)
+                culler.Cull(frustum, bounds, visible);
+            double linearMs = MsSince(start) / REPEATS;
+            std::cout << "  " << view.name << ": " << visible.size() << " in view, query " << queryMs << " ms, linear pass " << linearMs << " ms\n";
+        }
+
+        // rays from the first view into the grid
+        std::mt19937 random(2);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::vector<glm::vec3> dirs(RAYS);
+        for(auto& dir : dirs)
+            dir = glm::normalize(glm::vec3(unit(random) * 0.5f, unit(random) * 0.5f, -1.0f));
+        glm::vec3 origin = VIEWS[0].eye;
+        const float maxDistance = 100.0f;
+
+        int rayMismatches = 0;
+        int hits = 0;
+        for(int i = 0; i < CHECKED_RAYS; i++)
+        {
+            auto expected = BruteForce(bounds, origin, dirs[i], maxDistance);
+            hits += expected.object != Bvh::NONE;
+            rayMismatches += !Same(expected.distance, tree.Raycast(origin, dirs[i], maxDistance).distance);
+        }
+
+        volatile float sink = 0.0f;
+        start = Clock::now();
+        for(auto& dir : dirs)
+            sink = sink + tree.Raycast(origin, dir, maxDistance).distance;
+        double rayUs = MsSince(start) * 1000.0 / RAYS;
+        std::cout << "  rays " << rayUs << " us, " << hits << "/" << CHECKED_RAYS << " checked ones hit, " << rayMismatches << " mismatches\n";
+        if(rayMismatches)
+        {
+            std::cout << "  FAIL: ray hits differ from brute force\n";
+            ok = false;
+        }
+        return ok;
+    }
+}
+
+// Bvh frustum queries and rays against the linear culling pass and brute force, on grids like the stress draws of
+// 10k, 100k and 1M objects by default, before and after a refit. Then how long each takes
+int BvhBench(const std::vector<std::string>& args)
+{
+    std::vector<size_t> counts;
+    for(auto& arg : args)
+        counts.push_back(std::stoul(arg));
+    if(counts.empty())
+        counts = {10000, 100000, 1000000};
+
+    bool ok = true;
+    for(auto count : counts)
+        ok = Run(count) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <CommandBuffer.h>
+#include <TextureResidency.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::CommandBuffer;
+
+namespace
+{
+    const int PACKETS = 1000000;
+
+    // GL calls made while logging, each as its name followed by its arguments
+    std::vector<uint64_t> calls;
+    bool logging = false;
+
+    template<typename... Args>
+    void Log(const char* name, Args... args)
+    {
+        if(!logging)
+            return;
+        calls.push_back((uint64_t)(uintptr_t)name);
+        (calls.push_back((uint64_t)args), ...);
+    }
+
+    // Stand ins for every GL function replay calls, so it runs without a context
+    void APIENTRY UseProgram(GLuint program) { Log("UseProgram", program); }
+    void APIENTRY BindVertexArray(GLuint vao) { Log("BindVertexArray", vao); }
+    void APIENTRY ActiveTexture(GLenum unit) { Log("ActiveTexture", unit); }
+    void APIENTRY BindTexture(GLenum target, GLuint texture) { Log("BindTexture", target, texture); }
+    void APIENTRY BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) { Log("BindBufferRange", target, index, buffer, offset, size); }
+    void APIENTRY Enable(GLenum cap) { Log("Enable", cap); }
+    void APIENTRY Disable(GLenum cap) { Log("Disable", cap); }
+    void APIENTRY BlendFunc(GLenum source, GLenum destination) { Log("BlendFunc", source, destination); }
+    void APIENTRY DepthFunc(GLenum func) { Log("DepthFunc", func); }
+    void APIENTRY DepthMask(GLboolean write) { Log("DepthMask", write); }
+    void APIENTRY ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) { Log("ColorMask", r, g, b, a); }
+    void APIENTRY VertexAttrib4fv(GLuint index, const GLfloat* values) { Log("VertexAttrib4fv", index, (uintptr_t)values); }
+    void APIENTRY DrawArrays(GLenum mode, GLint first, GLsizei count) { Log("DrawArrays", mode, first, count); }
+    void APIENTRY DrawArraysInstancedBaseInstance(GLenum mode, GLint first, GLsizei count, GLsizei instances, GLuint baseInstance)
+    {
+        Log("DrawArraysInstancedBaseInstance", mode, first, count, instances, baseInstance);
+    }
+    void APIENTRY DrawElements(GLenum mode, GLsizei count, GLenum type, const void* offset) { Log("DrawElements", mode, count, type, (uintptr_t)offset); }
+    void APIENTRY DrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* offset, GLint baseVertex)
+    {
+        Log("DrawElementsBaseVertex", mode, count, type, (uintptr_t)offset, baseVertex);
+    }
+    void APIENTRY DrawElementsInstancedBaseVertexBaseInstance(GLenum mode, GLsizei count, GLenum type, const void* offset, GLsizei instances, GLint baseVertex, GLuint baseInstance)
+    {
+        Log("DrawElementsInstancedBaseVertexBaseInstance", mode, count, type, (uintptr_t)offset, instances, baseVertex, baseInstance);
+    }
+
+    void StubGL()
+    {
+        glad_glUseProgram = UseProgram;
+        glad_glBindVertexArray = BindVertexArray;
+        glad_glActiveTexture = ActiveTexture;
+        glad_glBindTexture = BindTexture;
+        glad_glBindBufferRange = BindBufferRange;
+        glad_glEnable = Enable;
+        glad_glDisable = Disable;
+        glad_glBlendFunc = BlendFunc;
+        glad_glDepthFunc = DepthFunc;
+        glad_glDepthMask = DepthMask;
+        glad_glColorMask = ColorMask;
+        glad_glVertexAttrib4fv = VertexAttrib4fv;
+        glad_glDrawArrays = DrawArrays;
+        glad_glDrawArraysInstancedBaseInstance = DrawArraysInstancedBaseInstance;
+        glad_glDrawElements = DrawElements;
+        glad_glDrawElementsBaseVertex = DrawElementsBaseVertex;
+        glad_glDrawElementsInstancedBaseVertexBaseInstance = DrawElementsInstancedBaseVertexBaseInstance;
+    }
+
+    // every command once, replayed, against the calls it stands for made directly
+    bool Replays()
+    {
+        const float attribs[8] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f};
+        CommandBuffer commands;
+        commands.UseProgram(3);
+        commands.BindVertexArray(5);
+        commands.BindTexture(2, GL_TEXTURE_2D, 7);
+        commands.BindTexture(4, GL_TEXTURE_CUBE_MAP, 8);
+        commands.BindBufferRange(GL_UNIFORM_BUFFER, 1, 9, 256, 1024);
+        commands.Enable(GL_BLEND);
+        commands.Disable(GL_DEPTH_TEST);
+        commands.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        commands.DepthFunc(GL_LEQUAL);
+        commands.DepthMask(false);
+        commands.ColorMask(true);
+        commands.VertexAttribs(4, 2, attribs);
+        commands.DrawArrays(GL_TRIANGLES, 6, 36);
+        commands.DrawArraysInstanced(GL_TRIANGLES, 0, 36, 10, 100);
+        commands.DrawElements(GL_TRIANGLES, 12, 300);
+        commands.DrawElements(GL_TRIANGLES, 12, 300, 40);
+        commands.DrawElementsInstanced(GL_TRIANGLES, 24, 600, 5, 80, 200);
+
+        logging = true;
+        calls.clear();
+        commands.Replay();
+        auto replayed = calls;
+
+        calls.clear();
+        glUseProgram(3);
+        glBindVertexArray(5);
+        glActiveTexture(GL_TEXTURE0 + 2);
+        glBindTexture(GL_TEXTURE_2D, 7);
+        glActiveTexture(GL_TEXTURE0 + 4);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 8);
+        glBindBufferRange(GL_UNIFORM_BUFFER, 1, 9, 256, 1024);
+        glEnable(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glVertexAttrib4fv(4, attribs);
+        glVertexAttrib4fv(5, attribs + 4);
+        glDrawArrays(GL_TRIANGLES, 6, 36);
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 36, 10, 100);
+        glDrawElements(GL_TRIANGLES, 300, GL_UNSIGNED_INT, (void*)(12 * sizeof(unsigned int)));
+        glDrawElementsBaseVertex(GL_TRIANGLES, 300, GL_UNSIGNED_INT, (void*)(12 * sizeof(unsigned int)), 40);
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, 600, GL_UNSIGNED_INT, (void*)(24 * sizeof(unsigned int)), 5, 80, 200);
+        logging = false;
+
+        bool same = replayed == calls;
+        std::cout << "  " << commands.Commands() << " commands replayed: " << (same ? "ok" : "FAIL: the calls differ from the recorded ones") << '\n';
+        return same;
+    }
+
+    // the render queue pattern: a draw per packet, with state changes every so often
+    void Record(CommandBuffer& commands)
+    {
+        for(int i = 0; i < PACKETS; i++)
+        {
+            if(i % 500 == 0)
+                commands.UseProgram(1 + i % 3);
+            if(i % 100 == 0)
+                commands.BindTexture(i % 4, GL_TEXTURE_2D, 1 + i % 3);
+            if(i % 50 == 0)
+                commands.BindVertexArray(1 + i % 2);
+            commands.DrawArraysInstanced(GL_TRIANGLES, 0, 0, 1, i);
+        }
+    }
+
+    // the same calls made straight away, as the queue did before command buffers
+    void Direct()
+    {
+        auto& residency = LearnOpenGL::TextureResidency::Get();
+        for(int i = 0; i < PACKETS; i++)
+        {
+            if(i % 500 == 0)
+                glUseProgram(1 + i % 3);
+            if(i % 100 == 0)
+            {
+                glActiveTexture(GL_TEXTURE0 + i % 4);
+                glBindTexture(GL_TEXTURE_2D, 1 + i % 3);
+                residency.Touch(1 + i % 3);
+            }
+            if(i % 50 == 0)
+                glBindVertexArray(1 + i % 2);
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 0, 1, i);
+        }
+    }
+}
+
+// Command buffer record and replay throughput, with GL stubbed out so only the buffer's own cost is measured. A driver
+// adds the same cost to replay and to direct calls
+int CommandsBench(const std::vector<std::string>&)
+{
+    StubGL();
+    std::cout << "command buffer:\n";
+    bool ok = Replays();
+
+    CommandBuffer commands;
+    Record(commands);
+    commands.Clear();
+    auto start = Clock::now();
+    Record(commands);
+    double recordMs = MsSince(start);
+    std::cout << "  " << PACKETS << " packets, " << commands.Commands() << " commands, " << (double)commands.Bytes() / commands.Commands()
+        << " bytes per command\n";
+    std::cout << "  record " << recordMs << " ms, " << commands.Commands() / recordMs / 1000.0 << "M commands/s\n";
+
+    for(int round = 0; round < 3; round++)
+    {
+        start = Clock::now();
+        commands.Replay();
+        double replayMs = MsSince(start);
+        start = Clock::now();
+        Direct();
+        double directMs = MsSince(start);
+        std::cout << "  replay " << replayMs << " ms, " << commands.Commands() / replayMs / 1000.0 << "M commands/s, direct calls " << directMs << " ms\n";
+    }
+    return ok ? 0 : 1;
+}
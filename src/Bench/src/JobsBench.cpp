@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <JobSystem.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::JobSystem;
+
+namespace
+{
+    const int ROUNDS = 20;
+    const int OUTER_JOBS = 2000;
+    const int NESTED_JOBS = 8;
+    const int OVERFLOW_JOBS = 20000;
+
+    bool Fail(const std::string& what)
+    {
+        std::cout << "  FAIL: " << what << '\n';
+        return false;
+    }
+
+    // jobs that spawn and wait on jobs, from every thread at once
+    bool Nested(JobSystem& jobs, double& usPerJob)
+    {
+        const long expected = (long)OUTER_JOBS * (NESTED_JOBS * (NESTED_JOBS - 1) / 2) + (long)OUTER_JOBS * (OUTER_JOBS - 1) / 2;
+        auto start = Clock::now();
+        for(int round = 0; round < ROUNDS; round++)
+        {
+            std::atomic<long> sum{0};
+            JobSystem::Counter counter;
+            for(int i = 0; i < OUTER_JOBS; i++)
+            {
+                jobs.Run([&jobs, &sum, i]()
+                {
+                    JobSystem::Counter inner;
+                    for(int k = 0; k < NESTED_JOBS; k++)
+                        jobs.Run([&sum, k]() { sum += k; }, &inner);
+                    jobs.Wait(inner);
+                    sum += i;
+                }, &counter);
+            }
+            jobs.Wait(counter);
+            if(sum != expected)
+                return Fail("nested sum " + std::to_string(sum) + ", expected " + std::to_string(expected));
+        }
+        usPerJob = MsSince(start) * 1000.0 / (ROUNDS * OUTER_JOBS * (NESTED_JOBS + 1));
+        return true;
+    }
+
+    // a -> b -> c, each only started once the one before is done
+    bool Dependencies(JobSystem& jobs)
+    {
+        for(int round = 0; round < ROUNDS * 50; round++)
+        {
+            std::atomic<int> step{0};
+            std::atomic<bool> ordered{true};
+            JobSystem::Counter a, b, c;
+            jobs.Run([&]() { std::this_thread::yield(); if(step++ != 0) ordered = false; }, &a);
+            jobs.Run([&]() { if(step++ != 1) ordered = false; }, &b, &a);
+            jobs.Run([&]() { if(step++ != 2) ordered = false; }, &c, &b);
+            jobs.Wait(c);
+            if(!ordered || step != 3)
+                return Fail("dependency order");
+        }
+        return true;
+    }
+
+    // main thread work queued from workers, run by Wait on the main thread
+    bool MainJobs(JobSystem& jobs)
+    {
+        JobSystem::Counter counter;
+        std::atomic<int> onMain{0};
+        for(int i = 0; i < 100; i++)
+        {
+            jobs.Run([&]()
+            {
+                jobs.RunOnMain([&]()
+                {
+                    if(jobs.IsMainThread())
+                        onMain++;
+                }, &counter);
+            }, &counter);
+        }
+        jobs.Wait(counter);
+        if(onMain != 100)
+            return Fail(std::to_string(onMain) + "/100 main thread jobs ran on the main thread");
+        return true;
+    }
+
+    // more jobs from one thread than its deque holds, the rest go through the shared queue
+    bool Overflow(JobSystem& jobs)
+    {
+        JobSystem::Counter counter;
+        std::atomic<int> ran{0};
+        for(int i = 0; i < OVERFLOW_JOBS; i++)
+            jobs.Run([&ran]() { ran++; }, &counter);
+        jobs.Wait(counter);
+        if(ran != OVERFLOW_JOBS)
+            return Fail(std::to_string(ran) + "/" + std::to_string(OVERFLOW_JOBS) + " overflowing jobs ran");
+        return true;
+    }
+
+    // the same uneven loop on 1, 2, 4... threads
+    void Scaling()
+    {
+        JobSystem jobs(std::max(std::thread::hardware_concurrency(), 8u) - 1);
+        std::vector<float> out(1 << 14);
+        auto loop = [&out](int i)
+        {
+            float x = (float)i;
+            for(int k = 0; k < 200 + i % 64; k++)
+                x = std::sqrt(x + k);
+            out[i] = x;
+        };
+
+        std::cout << "ParallelFor scaling, " << out.size() << " indices, " << std::thread::hardware_concurrency() << " hardware threads:\n";
+        double single = 0.0;
+        for(unsigned int threads = 1; threads <= jobs.GetThreadCount(); threads *= 2)
+        {
+            const int repeats = 5;
+            auto start = Clock::now();
+            for(int repeat = 0; repeat < repeats; repeat++)
+                jobs.ParallelFor(0, (int)out.size(), loop, threads);
+            double ms = MsSince(start) / repeats;
+            if(threads == 1)
+                single = ms;
+            std::cout << "  " << threads << " threads: " << ms << " ms, " << single / ms << "x\n";
+        }
+    }
+}
+
+// Contention checks on a few worker counts, then ParallelFor scaling
+int JobsBench(const std::vector<std::string>& args)
+{
+    std::vector<unsigned int> workerCounts;
+    for(auto& arg : args)
+        workerCounts.push_back((unsigned int)std::stoul(arg));
+    if(workerCounts.empty())
+        workerCounts = {3, 7, 15};
+
+    bool ok = true;
+    for(auto workers : workerCounts)
+    {
+        JobSystem jobs(workers);
+        double usPerJob = 0.0;
+        bool passed = Nested(jobs, usPerJob);
+        passed = Dependencies(jobs) && passed;
+        passed = MainJobs(jobs) && passed;
+        passed = Overflow(jobs) && passed;
+
+        auto stats = jobs.GetStats();
+        std::cout << workers << " workers: " << (passed ? "ok" : "failed") << ", " << usPerJob << " us per nested job, "
+            << stats.jobs << " jobs, " << stats.steals << " steals, " << stats.mainJobs << " main thread jobs\n";
+        ok = ok && passed;
+    }
+
+    Scaling();
+    return ok ? 0 : 1;
+}
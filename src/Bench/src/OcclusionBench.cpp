@@ -0,0 +1,190 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Culling.h>
+#include <Frustum.h>
+#include <OcclusionCuller.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::BoxBounds;
+using LearnOpenGL::OcclusionCuller;
+
+namespace
+{
+    // city block scene: 12x12 blocks of 16 units with 8 unit streets, buildings 8 to 40 units high
+    const int BLOCKS = 12;
+    const float PITCH = 24.0f;
+    const float BLOCK = 16.0f;
+    const int STREET_OBJECTS = 100000;
+
+    struct Building
+    {
+        glm::vec3 center;
+        glm::vec3 halfSize;
+    };
+
+    struct View
+    {
+        const char* name;
+        glm::vec3 eye;
+        glm::vec3 target;
+    };
+
+    // unit cube around the origin, as triangles
+    std::vector<glm::vec3> Cube()
+    {
+        const int faces[6][4] = {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+        glm::vec3 corners[8];
+        for(int i = 0; i < 8; i++)
+            corners[i] = glm::vec3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+
+        std::vector<glm::vec3> triangles;
+        for(auto& face : faces)
+        {
+            for(int corner : {0, 1, 2, 0, 2, 3})
+                triangles.push_back(corners[face[corner]]);
+        }
+        return triangles;
+    }
+
+    // whether the segment from origin to point misses every building
+    bool InSight(const std::vector<Building>& buildings, glm::vec3 origin, glm::vec3 point)
+    {
+        glm::vec3 dir = point - origin;
+        for(auto& building : buildings)
+        {
+            float t0 = 0.0f;
+            float t1 = 1.0f;
+            for(int axis = 0; axis < 3 && t0 <= t1; axis++)
+            {
+                float low = building.center[axis] - building.halfSize[axis] - origin[axis];
+                float high = building.center[axis] + building.halfSize[axis] - origin[axis];
+                if(std::abs(dir[axis]) < 1e-9f)
+                {
+                    if(low > 0.0f || high < 0.0f)
+                        t0 = 2.0f;
+                    continue;
+                }
+                float a = low / dir[axis];
+                float b = high / dir[axis];
+                t0 = std::max(t0, std::min(a, b));
+                t1 = std::min(t1, std::max(a, b));
+            }
+            if(t0 <= t1)
+                return false;
+        }
+        return true;
+    }
+
+    bool Check(bool passed, const std::string& what)
+    {
+        if(!passed)
+            std::cout << "  FAIL: " << what << '\n';
+        return passed;
+    }
+
+    // a 2x2 quad 3 units in front of the camera, boxes around it
+    bool Wall(const glm::mat4& projection)
+    {
+        OcclusionCuller culler;
+        culler.Begin(projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+        std::vector<glm::vec3> quad = {{-1, -1, 0}, {-1, 1, 0}, {1, 1, 0}, {-1, -1, 0}, {1, 1, 0}, {1, -1, 0}};
+        culler.AddOccluder(quad, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f)));
+        culler.BuildHierarchy();
+
+        bool ok = Check(!culler.IsVisible({-0.1f, -0.1f, -5.1f}, {0.1f, 0.1f, -4.9f}), "box behind the wall is visible");
+        ok = Check(culler.IsVisible({-0.1f, -0.1f, -2.1f}, {0.1f, 0.1f, -1.9f}), "box in front of the wall is hidden") && ok;
+        ok = Check(culler.IsVisible({1.5f, -0.1f, -5.1f}, {1.9f, 0.1f, -4.9f}), "box peeking past the wall edge is hidden") && ok;
+        ok = Check(culler.IsVisible({2.0f, -0.1f, -5.1f}, {2.1f, 0.1f, -4.9f}), "box beside the wall is hidden") && ok;
+        ok = Check(culler.IsVisible({-0.1f, -0.1f, -0.2f}, {0.1f, 0.1f, 0.2f}), "box across the near plane is hidden") && ok;
+        std::cout << "wall: " << (ok ? "ok" : "failed") << '\n';
+        return ok;
+    }
+}
+
+// The wall checks, then occluded ratios on the city block scene from three views. Culled boxes with a corner or their
+// center in sight of the eye are counted as false culls, a few grazing building corners are expected
+int OcclusionBench(const std::vector<std::string>&)
+{
+    auto projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 300.0f);
+    bool ok = Wall(projection);
+
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto cube = Cube();
+    std::vector<Building> buildings;
+    std::vector<glm::mat4> models;
+    for(int i = 0; i < BLOCKS; i++)
+    {
+        for(int j = 0; j < BLOCKS; j++)
+        {
+            float height = 8.0f + 32.0f * unit(random);
+            glm::vec3 center((i - BLOCKS / 2) * PITCH + BLOCK / 2, height / 2, (j - BLOCKS / 2) * PITCH + BLOCK / 2);
+            buildings.push_back({center, glm::vec3(BLOCK, height, BLOCK) / 2.0f});
+            models.push_back(glm::scale(glm::translate(glm::mat4(1.0f), center), glm::vec3(BLOCK, height, BLOCK)));
+        }
+    }
+
+    // unit boxes scattered over the whole grid, some end up inside buildings
+    BoxBounds objects;
+    for(int i = 0; i < STREET_OBJECTS; i++)
+    {
+        glm::vec3 position((unit(random) - 0.5f) * BLOCKS * PITCH, unit(random) * 3.0f, (unit(random) - 0.5f) * BLOCKS * PITCH);
+        objects.Push(position - 0.5f, position + 0.5f);
+    }
+
+    const View views[] = {
+        {"street level", {-4.0f, 1.7f, 60.0f}, {-4.0f, 1.7f, 0.0f}},
+        {"diagonal street", {-4.0f, 1.7f, -4.0f}, {40.0f, 1.7f, 40.0f}},
+        {"above the rooftops", {-4.0f, 50.0f, 80.0f}, {0.0f, 0.0f, 0.0f}},
+    };
+    std::cout << "city block, " << BLOCKS * BLOCKS << " buildings, " << STREET_OBJECTS << " boxes:\n";
+    for(auto& view : views)
+    {
+        auto viewProjection = projection * glm::lookAt(view.eye, view.target, glm::vec3(0.0f, 1.0f, 0.0f));
+        LearnOpenGL::Frustum frustum(viewProjection);
+        LearnOpenGL::FrustumCuller frustumCuller;
+        std::vector<uint32_t> inFrustum;
+        frustumCuller.Cull(frustum, objects, inFrustum);
+
+        OcclusionCuller culler;
+        culler.Begin(viewProjection);
+        for(auto& model : models)
+            culler.AddOccluder(cube, model);
+        culler.BuildHierarchy();
+        std::vector<uint32_t> visible = inFrustum;
+        culler.Cull(objects, visible);
+
+        size_t falseCulls = 0;
+        for(size_t i = 0, kept = 0; i < inFrustum.size(); i++)
+        {
+            auto index = inFrustum[i];
+            if(kept < visible.size() && visible[kept] == index)
+            {
+                kept++;
+                continue;
+            }
+
+            glm::vec3 center{objects.centerX[index], objects.centerY[index], objects.centerZ[index]};
+            bool seen = InSight(buildings, view.eye, center);
+            for(int corner = 0; corner < 8 && !seen; corner++)
+                seen = InSight(buildings, view.eye, center + glm::vec3(corner & 1 ? 0.45f : -0.45f, corner & 2 ? 0.45f : -0.45f, corner & 4 ? 0.45f : -0.45f));
+            falseCulls += seen;
+        }
+
+        auto& stats = culler.GetStats();
+        std::cout << "  " << view.name << ": " << stats.occluded << "/" << inFrustum.size() << " occluded ("
+            << (int)std::round(100.0 * stats.occluded / std::max<size_t>(inFrustum.size(), 1)) << "%), " << falseCulls << " false culls, raster "
+            << stats.rasterMs << " ms, test " << stats.testMs << " ms\n";
+        ok = Check(falseCulls * 1000 <= stats.occluded, "more than 0.1% of the culled boxes were in sight") && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <TriangleBvh.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::TriangleBvh;
+
+namespace
+{
+    const int RAYS = 1000000;
+    const int CHECKED_RAYS = 2000;
+    const int COPIES = 512;
+
+    struct Mesh
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> indices;
+    };
+
+    // positions and faces of an OBJ file, faces fanned into triangles. Enough for the models in resources, without assimp
+    bool LoadObj(const std::filesystem::path& path, Mesh& mesh)
+    {
+        std::ifstream file{path};
+        if(!file)
+        {
+            std::cout << "Error: could not open " << path.string() << '\n';
+            return false;
+        }
+
+        std::string line;
+        while(std::getline(file, line))
+        {
+            std::istringstream stream{line};
+            std::string type;
+            stream >> type;
+            if(type == "v")
+            {
+                glm::vec3 position;
+                stream >> position.x >> position.y >> position.z;
+                mesh.positions.push_back(position);
+            }
+            else if(type == "f")
+            {
+                std::vector<unsigned int> face;
+                std::string vertex;
+                while(stream >> vertex)
+                    face.push_back(std::stoi(vertex) - 1);
+                for(size_t i = 1; i + 1 < face.size(); i++)
+                    mesh.indices.insert(mesh.indices.end(), {face[0], face[i], face[i + 1]});
+            }
+        }
+        return !mesh.indices.empty();
+    }
+
+    // copies of mesh laid out on an 8x8 grid of layers, 10 units apart
+    Mesh Replicate(const Mesh& mesh, int copies)
+    {
+        Mesh out;
+        for(int copy = 0; copy < copies; copy++)
+        {
+            glm::vec3 offset(copy % 8 * 10.0f, copy / 8 % 8 * 10.0f, copy / 64 * 10.0f);
+            auto base = (unsigned int)out.positions.size();
+            for(auto& position : mesh.positions)
+                out.positions.push_back(position + offset);
+            for(auto index : mesh.indices)
+                out.indices.push_back(index + base);
+        }
+        return out;
+    }
+
+    // closest hit distance over every triangle, infinity on a miss
+    float BruteForce(const Mesh& mesh, glm::vec3 origin, glm::vec3 dir)
+    {
+        float best = std::numeric_limits<float>::infinity();
+        for(size_t i = 0; i < mesh.indices.size(); i += 3)
+        {
+            auto a = mesh.positions[mesh.indices[i]];
+            auto edge1 = mesh.positions[mesh.indices[i + 1]] - a;
+            auto edge2 = mesh.positions[mesh.indices[i + 2]] - a;
+            auto p = glm::cross(dir, edge2);
+            float det = glm::dot(edge1, p);
+            if(std::abs(det) < 1e-12f)
+                continue;
+
+            float inverse = 1.0f / det;
+            auto t = origin - a;
+            float u = glm::dot(t, p) * inverse;
+            if(u < 0.0f || u > 1.0f)
+                continue;
+            auto q = glm::cross(t, edge1);
+            float v = glm::dot(dir, q) * inverse;
+            if(v < 0.0f || u + v > 1.0f)
+                continue;
+            float distance = glm::dot(edge2, q) * inverse;
+            if(distance > 0.0f && distance < best)
+                best = distance;
+        }
+        return best;
+    }
+
+    bool Same(float a, float b)
+    {
+        return std::isinf(a) ? std::isinf(b) : std::abs(a - b) <= 1e-3f;
+    }
+
+    // Rays from a sphere around the mesh towards random points of its bounds. The first ones are checked against brute
+    // force and against the bvh saved and loaded back, then every ray is timed for closest hits and line of sight
+    bool Run(const Mesh& mesh, bool check)
+    {
+        TriangleBvh bvh;
+        auto start = Clock::now();
+        bvh.Build(mesh.positions, mesh.indices);
+        double buildMs = MsSince(start);
+        std::cout << "  " << mesh.indices.size() / 3 << " triangles, " << bvh.GetNodeCount() << " nodes, build " << buildMs << " ms\n";
+
+        glm::vec3 low{std::numeric_limits<float>::max()};
+        glm::vec3 high{-std::numeric_limits<float>::max()};
+        for(auto& position : mesh.positions)
+        {
+            low = glm::min(low, position);
+            high = glm::max(high, position);
+        }
+        glm::vec3 center = (low + high) * 0.5f;
+        float radius = glm::length(high - low);
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::vector<glm::vec3> origins(RAYS);
+        std::vector<glm::vec3> dirs(RAYS);
+        for(int i = 0; i < RAYS; i++)
+        {
+            origins[i] = center + glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * radius;
+            auto target = center + glm::vec3(unit(random), unit(random), unit(random)) * (high - low) * 0.5f;
+            dirs[i] = glm::normalize(target - origins[i]);
+        }
+
+        bool ok = true;
+        if(check)
+        {
+            auto path = std::filesystem::temp_directory_path() / "bench_raycast.bvh";
+            TriangleBvh loaded;
+            if(!bvh.Save(path) || !loaded.Load(path))
+            {
+                std::cout << "  FAIL: could not save and load the bvh at " << path.string() << '\n';
+                return false;
+            }
+            std::filesystem::remove(path);
+
+            int hits = 0;
+            int mismatches = 0;
+            start = Clock::now();
+            for(int i = 0; i < CHECKED_RAYS; i++)
+            {
+                float expected = BruteForce(mesh, origins[i], dirs[i]);
+                hits += !std::isinf(expected);
+                mismatches += !Same(expected, bvh.Raycast(origins[i], dirs[i]).distance);
+                mismatches += !Same(expected, loaded.Raycast(origins[i], dirs[i]).distance);
+            }
+            double bruteRate = CHECKED_RAYS / MsSince(start) / 1000.0;
+            std::cout << "  brute force " << bruteRate << " Mrays/s (with both bvh rays), " << hits << "/" << CHECKED_RAYS << " hit, "
+                << mismatches << " mismatches\n";
+            if(mismatches)
+            {
+                std::cout << "  FAIL: bvh hits differ from brute force\n";
+                ok = false;
+            }
+        }
+
+        volatile float sink = 0.0f;
+        int hits = 0;
+        start = Clock::now();
+        for(int i = 0; i < RAYS; i++)
+        {
+            auto hit = bvh.Raycast(origins[i], dirs[i]);
+            sink = sink + hit.distance;
+            hits += hit.triangle != TriangleBvh::NONE;
+        }
+        double closestRate = RAYS / MsSince(start) / 1000.0;
+
+        int occluded = 0;
+        start = Clock::now();
+        for(int i = 0; i < RAYS; i++)
+            occluded += bvh.Occluded(origins[i], origins[i] + dirs[i] * radius * 2.0f);
+        double anyRate = RAYS / MsSince(start) / 1000.0;
+
+        std::cout << "  closest hit " << closestRate << " Mrays/s (" << hits * 100 / RAYS << "% hit), any hit " << anyRate << " Mrays/s ("
+            << occluded * 100 / RAYS << "% blocked)\n";
+        return ok;
+    }
+}
+
+// Triangle bvh build time and rays per second on a model, planet.obj by default, then on copies of it
+int RaycastBench(const std::vector<std::string>& args)
+{
+    std::filesystem::path path = args.size() > 0 ? std::filesystem::path{args[0]} : std::filesystem::path{MODELS_DIR} / "planet.obj";
+    int copies = args.size() > 1 ? std::stoi(args[1]) : COPIES;
+
+    Mesh mesh;
+    if(!LoadObj(path, mesh))
+        return 1;
+
+    std::cout << path.filename().string() << ":\n";
+    bool ok = Run(mesh, true);
+    if(copies > 1)
+    {
+        std::cout << path.filename().string() << " x" << copies << ":\n";
+        ok = Run(Replicate(mesh, copies), false) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <TextureResidency.h>
+#include <UploadThread.h>
+
+#include "Bench.h"
+
+using LearnOpenGL::TextureResidency;
+
+namespace
+{
+    const int SIZE = 256;
+
+    struct Level
+    {
+        int width;
+        int height;
+        bool defined;   // specified with texels, not just sized
+    };
+
+    // just the sizes of a texture's levels and its min filter, enough to tell whether it's complete
+    struct Texture
+    {
+        GLint minFilter = GL_NEAREST_MIPMAP_LINEAR;
+        std::vector<Level> levels;
+    };
+
+    // the upload thread makes GL calls too, the bound texture is per thread like with a context each
+    std::mutex mutex;
+    std::unordered_map<GLuint, Texture> textures;
+    GLuint nextName = 1;
+    thread_local GLuint bound = 0;
+    int copyErrors = 0;
+
+    // the levels a mipmapped filter samples have to exist, each half the size of the one above
+    bool Complete(const Texture& texture)
+    {
+        if(texture.levels.empty())
+            return false;
+        if(texture.minFilter == GL_NEAREST || texture.minFilter == GL_LINEAR)
+            return true;
+
+        int width = texture.levels[0].width;
+        int height = texture.levels[0].height;
+        for(size_t level = 1; width > 1 || height > 1; level++)
+        {
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+            if(level >= texture.levels.size() || texture.levels[level].width != width || texture.levels[level].height != height)
+                return false;
+        }
+        return true;
+    }
+
+    void APIENTRY GenTextures(GLsizei count, GLuint* names)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(GLsizei i = 0; i < count; i++)
+        {
+            names[i] = nextName++;
+            textures[names[i]];
+        }
+    }
+
+    void APIENTRY DeleteTextures(GLsizei count, const GLuint* names)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(GLsizei i = 0; i < count; i++)
+            textures.erase(names[i]);
+    }
+
+    void APIENTRY BindTexture(GLenum, GLuint texture)
+    {
+        bound = texture;
+    }
+
+    void APIENTRY TexParameteri(GLenum, GLenum name, GLint value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(name == GL_TEXTURE_MIN_FILTER)
+            textures[bound].minFilter = value;
+    }
+
+    void APIENTRY TexImage2D(GLenum, GLint level, GLint, GLsizei width, GLsizei height, GLint, GLenum, GLenum, const void* pixels)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& levels = textures[bound].levels;
+        if((size_t)level >= levels.size())
+            levels.resize(level + 1, {0, 0, false});
+        levels[level] = {width, height, pixels != nullptr};
+    }
+
+    void APIENTRY GenerateMipmap(GLenum)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& levels = textures[bound].levels;
+        auto base = levels[0];
+        for(size_t level = 1; base.width > 1 || base.height > 1; level++)
+        {
+            base = {std::max(base.width / 2, 1), std::max(base.height / 2, 1), base.defined};
+            if(level >= levels.size())
+                levels.resize(level + 1);
+            levels[level] = base;
+        }
+    }
+
+    void APIENTRY GetTexLevelParameteriv(GLenum, GLint, GLenum, GLint* value)
+    {
+        *value = GL_RGBA8;
+    }
+
+    void APIENTRY GetTexImage(GLenum, GLint, GLenum, GLenum, void*) {}
+    void APIENTRY PixelStorei(GLenum, GLint) {}
+
+    // fails like the driver does when either texture isn't complete
+    void APIENTRY CopyImageSubData(GLuint source, GLenum, GLint sourceLevel, GLint, GLint, GLint, GLuint destination, GLenum, GLint destinationLevel,
+        GLint, GLint, GLint, GLsizei width, GLsizei height, GLsizei)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& from = textures[source];
+        auto& to = textures[destination];
+        if(!Complete(from) || !Complete(to) || (size_t)destinationLevel >= to.levels.size())
+        {
+            copyErrors++;
+            return;
+        }
+
+        auto& level = to.levels[destinationLevel];
+        if(level.width == width && level.height == height)
+            level.defined = from.levels[sourceLevel].defined;
+    }
+
+    GLsync APIENTRY FenceSync(GLenum, GLbitfield)
+    {
+        return (GLsync)1;
+    }
+
+    GLenum APIENTRY ClientWaitSync(GLsync, GLbitfield, GLuint64)
+    {
+        return GL_ALREADY_SIGNALED;
+    }
+
+    void APIENTRY DeleteSync(GLsync) {}
+    void APIENTRY Flush() {}
+
+    void StubGL()
+    {
+        glad_glGenTextures = GenTextures;
+        glad_glDeleteTextures = DeleteTextures;
+        glad_glBindTexture = BindTexture;
+        glad_glTexParameteri = TexParameteri;
+        glad_glTexImage2D = TexImage2D;
+        glad_glGenerateMipmap = GenerateMipmap;
+        glad_glGetTexLevelParameteriv = GetTexLevelParameteriv;
+        glad_glGetTexImage = GetTexImage;
+        glad_glPixelStorei = PixelStorei;
+        glad_glCopyImageSubData = CopyImageSubData;
+        glad_glFenceSync = FenceSync;
+        glad_glClientWaitSync = ClientWaitSync;
+        glad_glDeleteSync = DeleteSync;
+        glad_glFlush = Flush;
+    }
+
+    // a full mip chain from level 0, the way the app's textures are uploaded
+    bool Upload()
+    {
+        static const std::vector<unsigned char> pixels(SIZE * SIZE * 4, 255);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        return true;
+    }
+
+    unsigned int CreateTexture(GLint minFilter)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        Upload();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+        TextureResidency::Get().Register(texture, SIZE, SIZE, GL_RGBA, Upload);
+        return texture;
+    }
+
+    // every level back at full size and holding texels
+    bool Promoted(unsigned int texture, const char* name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& levels = textures[texture].levels;
+        int width = SIZE;
+        int undefined = 0;
+        for(size_t level = 0; level < levels.size() && width > 0; level++, width /= 2)
+            undefined += levels[level].width != width || !levels[level].defined;
+        if(width > 0)
+            undefined += 1;
+        if(undefined)
+            std::cout << "  FAIL: " << name << ", " << undefined << " levels missing, undefined or of the wrong size\n";
+        else
+            std::cout << "  " << name << ": ok\n";
+        return undefined == 0;
+    }
+}
+
+// Textures demoted then promoted through the upload thread, with GL stubbed out by a model of texture completeness.
+// Copies into a texture sampled with a mipmapped filter fail until all of its levels have their full sizes
+int ResidencyBench(const std::vector<std::string>&)
+{
+    StubGL();
+    auto& residency = TextureResidency::Get();
+    LearnOpenGL::UploadThread uploads;
+    residency.SetUploadThread(&uploads);
+
+    std::cout << "texture residency:\n";
+    residency.SetBudget(0);
+    auto mipmapped = CreateTexture(GL_LINEAR_MIPMAP_LINEAR);
+    auto linear = CreateTexture(GL_LINEAR);
+    residency.Update();
+    auto demoted = residency.GetCounters().demoted;
+
+    residency.SetBudget(SIZE * SIZE * 16);
+    residency.Touch(mipmapped);
+    residency.Touch(linear);
+    residency.Update();
+    auto start = Clock::now();
+    while(residency.GetCounters().uploading > 0 && MsSince(start) < 5000.0)
+    {
+        uploads.Poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    bool ok = demoted == 2 && residency.GetCounters().uploading == 0 && residency.GetCounters().demoted == 0;
+    if(!ok)
+        std::cout << "  FAIL: " << demoted << "/2 textures demoted, " << residency.GetCounters().demoted << " still demoted\n";
+    ok = Promoted(mipmapped, "mipmapped filter") && ok;
+    ok = Promoted(linear, "linear filter") && ok;
+    if(copyErrors)
+    {
+        std::cout << "  FAIL: " << copyErrors << " copies into incomplete textures\n";
+        ok = false;
+    }
+
+    residency.SetUploadThread(nullptr);
+    residency.Unregister(mipmapped);
+    residency.Unregister(linear);
+    uploads.Stop();
+    return ok ? 0 : 1;
+}
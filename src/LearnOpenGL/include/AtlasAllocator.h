@@ -0,0 +1,146 @@
+
+
+#ifndef ATLAS_ALLOCATOR_H
+#define ATLAS_ALLOCATOR_H
+
+#include <algorithm>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Quadtree allocator of square power of two tiles in a square atlas. A node is split in 4 to serve a smaller size,
+    // and 4 free siblings merge back into their parent when freed, so the atlas doesn't fragment for good
+    class AtlasAllocator
+    {
+    public:
+        struct Tile
+        {
+            int x = 0;
+            int y = 0;
+            int size = 0;   // 0 for no tile
+        };
+
+        // size and minSize are powers of two
+        AtlasAllocator(int size, int minSize) : size(size), minSize(minSize)
+        {
+            for(int level = size; level >= minSize; level /= 2)
+                levels++;
+            free.resize(levels);
+            free[0].push_back({0, 0, size});
+        }
+
+        // a tile of the given power of two size, or an empty one when there's no room
+        Tile Allocate(int tileSize)
+        {
+            int level = Level(tileSize);
+            if(level < 0)
+                return {};
+
+            // the smallest free node that fits, split down to the size
+            int from = level;
+            while(from >= 0 && free[from].empty())
+                from--;
+            if(from < 0)
+                return {};
+
+            auto tile = Take(free[from]);
+            for(; from < level; from++)
+            {
+                int half = tile.size / 2;
+                free[from + 1].push_back({tile.x + half, tile.y, half});
+                free[from + 1].push_back({tile.x, tile.y + half, half});
+                free[from + 1].push_back({tile.x + half, tile.y + half, half});
+                tile.size = half;
+            }
+            used += tile.size * tile.size;
+            return tile;
+        }
+
+        void Free(Tile tile)
+        {
+            if(!tile.size)
+                return;
+            used -= tile.size * tile.size;
+
+            int level = Level(tile.size);
+            while(level > 0)
+            {
+                // merge with the 3 siblings if they're all free
+                int parentSize = tile.size * 2;
+                int px = tile.x / parentSize * parentSize;
+                int py = tile.y / parentSize * parentSize;
+                auto& list = free[level];
+                int siblings = 0;
+                for(auto& other : list)
+                {
+                    if(other.x / parentSize * parentSize == px && other.y / parentSize * parentSize == py)
+                        siblings++;
+                }
+                if(siblings < 3)
+                    break;
+
+                list.erase(std::remove_if(list.begin(), list.end(), [&](const Tile& other)
+                {
+                    return other.x / parentSize * parentSize == px && other.y / parentSize * parentSize == py;
+                }), list.end());
+                tile = {px, py, parentSize};
+                level--;
+            }
+            free[level].push_back(tile);
+        }
+
+        // the largest power of two size, between minSize and maxSize, at most pixels
+        int FloorSize(float pixels, int maxSize) const
+        {
+            int tileSize = minSize;
+            while(tileSize * 2 <= maxSize && tileSize * 2 <= pixels)
+                tileSize *= 2;
+            return tileSize;
+        }
+
+        int GetSize() const
+        {
+            return size;
+        }
+
+        int GetMinSize() const
+        {
+            return minSize;
+        }
+
+        // texels in allocated tiles
+        long long GetUsed() const
+        {
+            return used;
+        }
+
+    private:
+        int Level(int tileSize) const
+        {
+            int level = 0;
+            for(int s = size; s > tileSize; s /= 2)
+                level++;
+            return (size >> level) == tileSize && level < levels ? level : -1;
+        }
+
+        // lowest tile first, so allocations stay packed toward the origin
+        static Tile Take(std::vector<Tile>& list)
+        {
+            auto it = std::min_element(list.begin(), list.end(), [](const Tile& a, const Tile& b)
+            {
+                return a.y != b.y ? a.y < b.y : a.x < b.x;
+            });
+            auto tile = *it;
+            *it = list.back();
+            list.pop_back();
+            return tile;
+        }
+
+        int size;
+        int minSize;
+        int levels = 0;
+        std::vector<std::vector<Tile>> free;   // free nodes by level, 0 is the whole atlas
+        long long used = 0;
+    };
+}
+#endif
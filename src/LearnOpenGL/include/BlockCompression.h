@@ -0,0 +1,207 @@
+
+
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // BC1 (DXT1) encoding, 4x4 texel blocks of two RGB565 endpoints and 2 bit indices, 8:1 against RGBA8.
+    // Endpoints are taken from the extremes of the block along its principal axis, good enough for photos like the skybox
+    namespace BC1
+    {
+        inline size_t Size(int width, int height)
+        {
+            return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+        }
+
+        inline uint16_t To565(const float* color)
+        {
+            auto r = (uint16_t)std::clamp((int)std::round(color[0] * 31.0f / 255.0f), 0, 31);
+            auto g = (uint16_t)std::clamp((int)std::round(color[1] * 63.0f / 255.0f), 0, 63);
+            auto b = (uint16_t)std::clamp((int)std::round(color[2] * 31.0f / 255.0f), 0, 31);
+            return (r << 11) | (g << 5) | b;
+        }
+
+        inline void From565(uint16_t color, float* out)
+        {
+            out[0] = ((color >> 11) & 31) * 255.0f / 31.0f;
+            out[1] = ((color >> 5) & 63) * 255.0f / 63.0f;
+            out[2] = (color & 31) * 255.0f / 31.0f;
+        }
+
+        // block holds 16 RGBA texels
+        inline void EncodeBlock(const unsigned char* block, unsigned char* out)
+        {
+            float mean[3] = {0, 0, 0};
+            for(int i = 0; i < 16; i++)
+                for(int c = 0; c < 3; c++)
+                    mean[c] += block[i * 4 + c] / 16.0f;
+
+            float cov[6] = {0, 0, 0, 0, 0, 0};
+            for(int i = 0; i < 16; i++)
+            {
+                float d[3] = {block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2]};
+                cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+                cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+            }
+
+            // principal axis by power iteration
+            float axis[3] = {1.0f, 1.0f, 1.0f};
+            for(int iteration = 0; iteration < 4; iteration++)
+            {
+                float next[3] = {
+                    cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                    cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                    cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+                float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                if(length < 1e-6f)
+                    break;
+                for(int c = 0; c < 3; c++)
+                    axis[c] = next[c] / length;
+            }
+
+            float minProj = 1e9f, maxProj = -1e9f;
+            for(int i = 0; i < 16; i++)
+            {
+                float proj = 0.0f;
+                for(int c = 0; c < 3; c++)
+                    proj += (block[i * 4 + c] - mean[c]) * axis[c];
+                minProj = std::min(minProj, proj);
+                maxProj = std::max(maxProj, proj);
+            }
+
+            float maxColor[3], minColor[3];
+            for(int c = 0; c < 3; c++)
+            {
+                maxColor[c] = mean[c] + axis[c] * maxProj;
+                minColor[c] = mean[c] + axis[c] * minProj;
+            }
+
+            uint16_t color0 = To565(maxColor);
+            uint16_t color1 = To565(minColor);
+            // color0 > color1 selects the four color mode
+            if(color0 < color1)
+                std::swap(color0, color1);
+
+            float palette[4][3];
+            From565(color0, palette[0]);
+            From565(color1, palette[1]);
+            for(int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+
+            uint32_t indices = 0;
+            if(color0 != color1)
+            {
+                for(int i = 0; i < 16; i++)
+                {
+                    int best = 0;
+                    float bestDist = 1e9f;
+                    for(int p = 0; p < 4; p++)
+                    {
+                        float dist = 0.0f;
+                        for(int c = 0; c < 3; c++)
+                        {
+                            float d = block[i * 4 + c] - palette[p][c];
+                            dist += d * d;
+                        }
+                        if(dist < bestDist)
+                        {
+                            bestDist = dist;
+                            best = p;
+                        }
+                    }
+                    indices |= best << (i * 2);
+                }
+            }
+
+            out[0] = color0 & 0xFF;
+            out[1] = color0 >> 8;
+            out[2] = color1 & 0xFF;
+            out[3] = color1 >> 8;
+            out[4] = indices & 0xFF;
+            out[5] = (indices >> 8) & 0xFF;
+            out[6] = (indices >> 16) & 0xFF;
+            out[7] = indices >> 24;
+        }
+
+        // rgba is width * height RGBA texels. Edge blocks repeat the last row/column
+        inline std::vector<unsigned char> Encode(const unsigned char* rgba, int width, int height)
+        {
+            std::vector<unsigned char> out(Size(width, height));
+            auto dst = out.data();
+            unsigned char block[16 * 4];
+            for(int by = 0; by < height; by += 4)
+            {
+                for(int bx = 0; bx < width; bx += 4)
+                {
+                    for(int y = 0; y < 4; y++)
+                    {
+                        for(int x = 0; x < 4; x++)
+                        {
+                            int sx = std::min(bx + x, width - 1);
+                            int sy = std::min(by + y, height - 1);
+                            std::copy_n(rgba + (sy * width + sx) * 4, 4, block + (y * 4 + x) * 4);
+                        }
+                    }
+                    EncodeBlock(block, dst);
+                    dst += 8;
+                }
+            }
+            return out;
+        }
+
+        // back to RGBA8, for drivers without S3TC
+        inline std::vector<unsigned char> Decode(const unsigned char* blocks, int width, int height)
+        {
+            std::vector<unsigned char> rgba(width * height * 4);
+            for(int by = 0; by < height; by += 4)
+            {
+                for(int bx = 0; bx < width; bx += 4, blocks += 8)
+                {
+                    uint16_t color0 = blocks[0] | (blocks[1] << 8);
+                    uint16_t color1 = blocks[2] | (blocks[3] << 8);
+                    uint32_t indices = blocks[4] | (blocks[5] << 8) | (blocks[6] << 16) | ((uint32_t)blocks[7] << 24);
+
+                    float palette[4][3];
+                    From565(color0, palette[0]);
+                    From565(color1, palette[1]);
+                    for(int c = 0; c < 3; c++)
+                    {
+                        if(color0 > color1)
+                        {
+                            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+                        }
+                        else
+                        {
+                            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+                            palette[3][c] = 0.0f;
+                        }
+                    }
+
+                    for(int y = 0; y < 4 && by + y < height; y++)
+                    {
+                        for(int x = 0; x < 4 && bx + x < width; x++)
+                        {
+                            int index = (indices >> ((y * 4 + x) * 2)) & 3;
+                            auto texel = &rgba[((by + y) * width + bx + x) * 4];
+                            for(int c = 0; c < 3; c++)
+                                texel[c] = (unsigned char)std::round(palette[index][c]);
+                            texel[3] = 255;
+                        }
+                    }
+                }
+            }
+            return rgba;
+        }
+    }
+}
+#endif
@@ -0,0 +1,487 @@
+
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <Culling.h>
+#include <Frustum.h>
+#include <JobSystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Bounding volume hierarchy over the boxes of a BoxBounds, for frustum and ray queries that only visit the branches
+    // they touch. Built top down with a binned surface area heuristic.
+    //
+    // Moving objects are handled by refitting: the tree shape stays, the node boxes grow or shrink to the new object boxes.
+    // That gets looser as things move apart, so when the estimated traversal cost passes REBUILD_COST times what it was
+    // after the build, a new tree is built by a job from a copy of the bounds, and swapped in by a later Refit
+    class Bvh
+    {
+    public:
+        static constexpr uint32_t LEAF_SIZE = 4;
+        // deeper nodes are left as leaves, the queries keep their stack on the stack
+        static constexpr int MAX_DEPTH = 64;
+        static constexpr int BINS = 16;
+        static constexpr float REBUILD_COST = 1.3f;
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        struct Hit
+        {
+            uint32_t object = NONE;
+            float distance = std::numeric_limits<float>::infinity();
+        };
+
+        struct Stats
+        {
+            size_t nodes = 0;
+            float cost = 0.0f;          // SAH cost of the refitted tree
+            float builtCost = 0.0f;     // and right after it was built
+            unsigned int rebuilds = 0;
+            bool rebuilding = false;
+            float buildMs = 0.0f;       // of the last build, on whichever thread ran it
+            float refitMs = 0.0f;
+        };
+
+        Bvh() = default;
+
+        ~Bvh()
+        {
+            if(building)
+                JobSystem::Get().Wait(builder);
+        }
+
+        Bvh(const Bvh&) = delete;
+        Bvh& operator=(const Bvh&) = delete;
+
+        // builds the tree right away, on this thread
+        void Build(const BoxBounds& bounds)
+        {
+            if(building)
+                JobSystem::Get().Wait(builder);
+            building = false;
+            tree = BuildTree(bounds);
+            Gather(bounds);
+            stats.rebuilds++;
+        }
+
+        // Refits the tree to the moved bounds. Swaps in a finished background build, and starts one once the tree got too
+        // loose. Objects added or removed need a new tree, it's built here then
+        void Refit(const BoxBounds& bounds)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if(bounds.Size() != tree.objects)
+            {
+                Build(bounds);
+            }
+            else
+            {
+                if(building && builder.Done())
+                {
+                    JobSystem::Get().Wait(builder);
+                    building = false;
+                    if(pending.objects == bounds.Size())
+                    {
+                        tree = std::move(pending);
+                        stats.rebuilds++;
+                    }
+                }
+                Gather(bounds);
+            }
+
+            stats.rebuilding = building;
+            if(!building && tree.objects && stats.cost > stats.builtCost * REBUILD_COST)
+            {
+                snapshot = bounds;
+                stats.rebuilding = building = true;
+                JobSystem::Get().Run([this]()
+                {
+                    pending = BuildTree(snapshot);
+                }, &builder);
+            }
+            stats.refitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // out is replaced by the objects whose box touches the frustum. Planes a node is fully inside of aren't tested
+        // again below it, so branches fully in view are just walked
+        void Query(const Frustum& frustum, std::vector<uint32_t>& out) const
+        {
+            out.clear();
+            if(tree.nodes.empty())
+                return;
+
+            std::pair<uint32_t, uint32_t> stack[MAX_DEPTH + 1];
+            int size = 0;
+            stack[size++] = {0, 0x3f};
+            while(size)
+            {
+                auto [index, planes] = stack[--size];
+                auto& node = tree.nodes[index];
+                auto center = (node.min + node.max) * 0.5f;
+                auto extent = (node.max - node.min) * 0.5f;
+                bool outside = false;
+                for(int p = 0; p < 6 && !outside; p++)
+                {
+                    if(!(planes & (1 << p)))
+                        continue;
+                    auto& plane = frustum.planes[p];
+                    float dist = glm::dot(glm::vec3(plane), center) + plane.w;
+                    float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                    if(dist + reach < 0.0f)
+                        outside = true;
+                    else if(dist - reach >= 0.0f)
+                        planes &= ~(1 << p);
+                }
+                if(outside)
+                    continue;
+
+                if(node.count)
+                {
+                    for(uint32_t i = node.offset; i < node.offset + node.count; i++)
+                    {
+                        if(!planes || Overlaps(frustum, tree.boxes[i]))
+                            out.push_back(tree.order[i]);
+                    }
+                }
+                else
+                {
+                    stack[size++] = {node.offset, planes};
+                    stack[size++] = {node.offset + 1, planes};
+                }
+            }
+        }
+
+        // Nearest object along the ray within maxDistance. intersect(object, closest) returns the distance to the object
+        // itself, or infinity when the ray misses it, and is only called when the ray hits the object box closer than
+        // closest. Children are visited nearest first
+        template<typename Intersect>
+        Hit Raycast(glm::vec3 origin, glm::vec3 dir, float maxDistance, Intersect intersect) const
+        {
+            Hit hit;
+            hit.distance = maxDistance;
+            if(tree.nodes.empty())
+                return hit;
+
+            auto inverseDir = 1.0f / dir;
+            // nodes with the distance the ray enters them, checked again when popped as the closest hit may have moved
+            std::pair<uint32_t, float> stack[MAX_DEPTH + 1];
+            int size = 0;
+            stack[size++] = {0, SlabDistance(origin, inverseDir, tree.nodes[0].min, tree.nodes[0].max)};
+            while(size)
+            {
+                auto [index, enter] = stack[--size];
+                if(enter >= hit.distance)
+                    continue;
+                auto& node = tree.nodes[index];
+                if(node.count)
+                {
+                    for(uint32_t i = node.offset; i < node.offset + node.count; i++)
+                    {
+                        if(SlabDistance(origin, inverseDir, tree.boxes[i].min, tree.boxes[i].max) >= hit.distance)
+                            continue;
+                        float distance = intersect(tree.order[i], hit.distance);
+                        if(distance < hit.distance)
+                            hit = {tree.order[i], distance};
+                    }
+                    continue;
+                }
+
+                uint32_t near = node.offset, far = node.offset + 1;
+                float nearDistance = SlabDistance(origin, inverseDir, tree.nodes[near].min, tree.nodes[near].max);
+                float farDistance = SlabDistance(origin, inverseDir, tree.nodes[far].min, tree.nodes[far].max);
+                if(farDistance < nearDistance)
+                {
+                    std::swap(near, far);
+                    std::swap(nearDistance, farDistance);
+                }
+                if(farDistance < hit.distance)
+                    stack[size++] = {far, farDistance};
+                if(nearDistance < hit.distance)
+                    stack[size++] = {near, nearDistance};
+            }
+            if(hit.object == NONE)
+                hit.distance = std::numeric_limits<float>::infinity();
+            return hit;
+        }
+
+        // nearest object box along the ray
+        Hit Raycast(glm::vec3 origin, glm::vec3 dir, float maxDistance) const
+        {
+            auto inverseDir = 1.0f / dir;
+            return Raycast(origin, dir, maxDistance, [&](uint32_t object, float)
+            {
+                auto& bounds = boxes[object];
+                return SlabDistance(origin, inverseDir, bounds.min, bounds.max);
+            });
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        struct Box
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+
+        // an inner node's children are offset and offset + 1, a leaf has count objects from offset in the tree order
+        struct Node
+        {
+            glm::vec3 min;
+            uint32_t offset;
+            glm::vec3 max;
+            uint32_t count;
+        };
+
+        struct Tree
+        {
+            std::vector<Node> nodes;
+            std::vector<uint32_t> order;    // object of every leaf slot
+            std::vector<Box> boxes;         // and its box, refitted
+            size_t objects = 0;
+            float builtCost = 0.0f;
+            float buildMs = 0.0f;
+        };
+
+        static float Area(glm::vec3 min, glm::vec3 max)
+        {
+            auto size = glm::max(max - min, glm::vec3(0.0f));
+            return size.x * size.y + size.y * size.z + size.z * size.x;
+        }
+
+        static Box GetBox(const BoxBounds& bounds, uint32_t i)
+        {
+            glm::vec3 center{bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]};
+            glm::vec3 extent{bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]};
+            return {center - extent, center + extent};
+        }
+
+        static bool Overlaps(const Frustum& frustum, const Box& box)
+        {
+            auto center = (box.min + box.max) * 0.5f;
+            auto extent = (box.max - box.min) * 0.5f;
+            for(auto& plane : frustum.planes)
+            {
+                if(glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.0f)
+                    return false;
+            }
+            return true;
+        }
+
+        // entry distance of the ray into the box, infinity when it misses
+        static float SlabDistance(glm::vec3 origin, glm::vec3 inverseDir, glm::vec3 min, glm::vec3 max)
+        {
+            auto t0 = (min - origin) * inverseDir;
+            auto t1 = (max - origin) * inverseDir;
+            auto near = glm::min(t0, t1);
+            auto far = glm::max(t0, t1);
+            float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+            float exit = std::min(std::min(far.x, far.y), far.z);
+            return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+        }
+
+        // top down, every node split where the surface area heuristic is lowest over BINS centroid bins per axis
+        static Tree BuildTree(const BoxBounds& bounds)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Tree result;
+            result.objects = bounds.Size();
+            if(!result.objects)
+                return result;
+
+            std::vector<Box> boxes(result.objects);
+            std::vector<glm::vec3> centroids(result.objects);
+            result.order.resize(result.objects);
+            for(uint32_t i = 0; i < result.objects; i++)
+            {
+                boxes[i] = GetBox(bounds, i);
+                centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+                result.order[i] = i;
+            }
+
+            auto& nodes = result.nodes;
+            nodes.reserve(2 * result.objects / LEAF_SIZE + 1);
+            nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f), (uint32_t)result.objects});
+            std::pair<uint32_t, int> stack[MAX_DEPTH + 1];
+            int size = 0;
+            stack[size++] = {0, 0};
+            while(size)
+            {
+                auto [index, depth] = stack[--size];
+                uint32_t first = nodes[index].offset;
+                uint32_t count = nodes[index].count;
+
+                glm::vec3 min{std::numeric_limits<float>::max()}, max{-std::numeric_limits<float>::max()};
+                glm::vec3 centroidMin = min, centroidMax = max;
+                for(uint32_t i = first; i < first + count; i++)
+                {
+                    auto& box = boxes[result.order[i]];
+                    min = glm::min(min, box.min);
+                    max = glm::max(max, box.max);
+                    centroidMin = glm::min(centroidMin, centroids[result.order[i]]);
+                    centroidMax = glm::max(centroidMax, centroids[result.order[i]]);
+                }
+                nodes[index].min = min;
+                nodes[index].max = max;
+                if(count <= LEAF_SIZE || depth == MAX_DEPTH)
+                    continue;
+
+                // cheapest split, costs relative to a leaf test per object
+                int bestAxis = -1;
+                int bestBin = 0;
+                float bestCost = count * Area(min, max);
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float extent = centroidMax[axis] - centroidMin[axis];
+                    if(extent <= 0.0f)
+                        continue;
+                    float scale = BINS / extent;
+                    Box bins[BINS];
+                    uint32_t binCounts[BINS] = {};
+                    for(auto& bin : bins)
+                        bin = {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())};
+                    for(uint32_t i = first; i < first + count; i++)
+                    {
+                        uint32_t object = result.order[i];
+                        int bin = std::min((int)((centroids[object][axis] - centroidMin[axis]) * scale), BINS - 1);
+                        binCounts[bin]++;
+                        bins[bin].min = glm::min(bins[bin].min, boxes[object].min);
+                        bins[bin].max = glm::max(bins[bin].max, boxes[object].max);
+                    }
+
+                    // areas and counts left of every split plane, then sweep back from the right
+                    float leftArea[BINS - 1];
+                    uint32_t leftCount[BINS - 1];
+                    Box sweep = bins[0];
+                    uint32_t sum = 0;
+                    for(int bin = 0; bin < BINS - 1; bin++)
+                    {
+                        sweep.min = glm::min(sweep.min, bins[bin].min);
+                        sweep.max = glm::max(sweep.max, bins[bin].max);
+                        sum += binCounts[bin];
+                        leftArea[bin] = Area(sweep.min, sweep.max);
+                        leftCount[bin] = sum;
+                    }
+                    sweep = bins[BINS - 1];
+                    sum = 0;
+                    for(int bin = BINS - 1; bin > 0; bin--)
+                    {
+                        sweep.min = glm::min(sweep.min, bins[bin].min);
+                        sweep.max = glm::max(sweep.max, bins[bin].max);
+                        sum += binCounts[bin];
+                        if(!sum || !leftCount[bin - 1])
+                            continue;
+                        // 1 for visiting the node
+                        float cost = Area(min, max) + leftArea[bin - 1] * leftCount[bin - 1] + Area(sweep.min, sweep.max) * sum;
+                        if(cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestBin = bin;
+                        }
+                    }
+                }
+
+                uint32_t* begin = &result.order[first];
+                uint32_t* middle;
+                if(bestAxis >= 0)
+                {
+                    float scale = BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+                    middle = std::partition(begin, begin + count, [&](uint32_t object)
+                    {
+                        return std::min((int)((centroids[object][bestAxis] - centroidMin[bestAxis]) * scale), BINS - 1) < bestBin;
+                    });
+                }
+                else
+                {
+                    // no split pays off, or every centroid is the same: a leaf if it's small enough, halves otherwise
+                    if(count <= LEAF_SIZE * 4)
+                        continue;
+                    middle = begin + count / 2;
+                }
+
+                uint32_t leftCount = middle - begin;
+                uint32_t left = nodes.size();
+                nodes.push_back({glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount});
+                nodes.push_back({glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount});
+                nodes[index].offset = left;
+                nodes[index].count = 0;
+                stack[size++] = {left + 1, depth + 1};
+                stack[size++] = {left, depth + 1};
+            }
+            result.boxes.resize(result.objects);
+            result.builtCost = Cost(result);
+            result.buildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return result;
+        }
+
+        // SAH cost relative to the root box
+        static float Cost(const Tree& result)
+        {
+            float cost = 0.0f;
+            for(auto& node : result.nodes)
+                cost += Area(node.min, node.max) * (node.count ? node.count : 1);
+            float rootArea = Area(result.nodes[0].min, result.nodes[0].max);
+            return rootArea > 0.0f ? cost / rootArea : 0.0f;
+        }
+
+        // copies the object boxes in tree order and refits the nodes, children come after their parent
+        void Gather(const BoxBounds& bounds)
+        {
+            boxes.resize(bounds.Size());
+            for(uint32_t i = 0; i < bounds.Size(); i++)
+                boxes[i] = GetBox(bounds, i);
+            for(size_t i = 0; i < tree.order.size(); i++)
+                tree.boxes[i] = boxes[tree.order[i]];
+
+            for(size_t i = tree.nodes.size(); i-- > 0;)
+            {
+                auto& node = tree.nodes[i];
+                if(node.count)
+                {
+                    node.min = tree.boxes[node.offset].min;
+                    node.max = tree.boxes[node.offset].max;
+                    for(uint32_t j = node.offset + 1; j < node.offset + node.count; j++)
+                    {
+                        node.min = glm::min(node.min, tree.boxes[j].min);
+                        node.max = glm::max(node.max, tree.boxes[j].max);
+                    }
+                }
+                else
+                {
+                    node.min = glm::min(tree.nodes[node.offset].min, tree.nodes[node.offset + 1].min);
+                    node.max = glm::max(tree.nodes[node.offset].max, tree.nodes[node.offset + 1].max);
+                }
+            }
+
+            stats.nodes = tree.nodes.size();
+            stats.cost = tree.nodes.empty() ? 0.0f : Cost(tree);
+            stats.builtCost = tree.builtCost;
+            stats.buildMs = tree.buildMs;
+        }
+
+        Tree tree;
+        std::vector<Box> boxes;     // by object, for the ray box tests
+
+        // background build, a job counted in builder
+        JobSystem::Counter builder;
+        bool building = false;
+        BoxBounds snapshot;
+        Tree pending;
+
+        Stats stats;
+    };
+}
+#endif
@@ -7,6 +7,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <Frustum.h>
+
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -68,6 +70,18 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // returns the perspective projection matrix for the current Zoom
+    glm::mat4 GetProjectionMatrix(float aspect, float nearPlane, float farPlane)
+    {
+        return glm::perspective(glm::radians(Zoom), aspect, nearPlane, farPlane);
+    }
+
+    // returns the world space planes of the view frustum, for culling what the camera can't see
+    LearnOpenGL::Frustum GetFrustum(float aspect, float nearPlane, float farPlane)
+    {
+        return LearnOpenGL::Frustum{GetProjectionMatrix(aspect, nearPlane, farPlane) * GetViewMatrix()};
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
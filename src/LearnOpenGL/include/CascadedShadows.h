@@ -0,0 +1,214 @@
+
+
+#ifndef CASCADED_SHADOWS_H
+#define CASCADED_SHADOWS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <RenderQueue.h>
+#include <Shader.h>
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Directional light shadows in CASCADES depth maps, layers of one texture array. The view frustum is split along depth
+    // between the near plane and the shadow distance, and every cascade covers the bounding sphere of its slice.
+    //
+    // A sphere keeps the same size whichever way the camera turns, and its center is snapped to whole shadow texels in light
+    // space, so shadow edges don't shimmer when the camera moves. The first NEAR_CASCADES are redrawn every frame, the far ones
+    // take turns, one per frame. A far cascade keeps the matrix it was drawn with, so it's a frame or two late but consistent
+    class CascadedShadows
+    {
+    public:
+        static constexpr int CASCADES = 4;
+        static constexpr int NEAR_CASCADES = 2;
+        static constexpr int SIZE = 1024;
+        // between uniform (0) and logarithmic (1) splits
+        static constexpr float SPLIT_LAMBDA = 0.75f;
+        // how far behind a cascade casters are still drawn, toward the light
+        static constexpr float CASTER_DISTANCE = 20.0f;
+
+        struct Stats
+        {
+            unsigned int cascadesDrawn = 0;
+            size_t triangles = 0;
+            float updateMs = 0.0f;
+        };
+
+        CascadedShadows(const std::filesystem::path& shaderFolder)
+            : shader((shaderFolder / "cascadeVertex.glsl").generic_string().c_str(), (shaderFolder / "cascadeFrag.glsl").generic_string().c_str())
+        {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+            // hardware comparison, bilinear filtered
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            glGenFramebuffers(1, &fbo);
+        }
+
+        ~CascadedShadows()
+        {
+            glDeleteTextures(1, &texture);
+            glDeleteFramebuffers(1, &fbo);
+        }
+
+        CascadedShadows(const CascadedShadows&) = delete;
+        CascadedShadows& operator=(const CascadedShadows&) = delete;
+
+        // the camera projection, shadows end at shadowDistance
+        void SetProjection(float fovY, float aspect, float nearPlane, float shadowDistance)
+        {
+            this->fovY = fovY;
+            this->aspect = aspect;
+            for(int i = 0; i <= CASCADES; i++)
+            {
+                float t = (float)i / CASCADES;
+                float logarithmic = nearPlane * std::pow(shadowDistance / nearPlane, t);
+                float uniform = nearPlane + (shadowDistance - nearPlane) * t;
+                splits[i] = uniform + (logarithmic - uniform) * SPLIT_LAMBDA;
+            }
+        }
+
+        // Fits and draws the cascades due this frame. dir is the direction the light travels.
+        // Leaves the default framebuffer bound, with the viewport to restore
+        void Update(const glm::mat4& view, glm::vec3 dir, const std::vector<const std::vector<DrawPacket>*>& casterLists)
+        {
+            auto start = std::chrono::steady_clock::now();
+            stats.cascadesDrawn = 0;
+            stats.triangles = 0;
+
+            dir = glm::normalize(dir);
+            auto up = std::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            auto lightView = glm::lookAt(glm::vec3(0.0f), dir, up);
+            auto inverseView = glm::inverse(view);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            glViewport(0, 0, SIZE, SIZE);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(2.0f, 4.0f);
+            shader.use();
+            int modelLocation = glGetUniformLocation(shader.ID, "model");
+
+            for(int cascade = 0; cascade < CASCADES; cascade++)
+            {
+                bool due = cascade < NEAR_CASCADES || !drawn[cascade] || (frame % (CASCADES - NEAR_CASCADES)) == (unsigned int)(cascade - NEAR_CASCADES);
+                if(!due)
+                    continue;
+
+                // bounding sphere of the frustum slice, in view space it's on the -Z axis
+                float tanY = std::tan(fovY / 2.0f);
+                float tanX = tanY * aspect;
+                float d0 = splits[cascade];
+                float d1 = splits[cascade + 1];
+                float k = tanX * tanX + tanY * tanY;
+                // center depth where the near and far corners are equally far, clamped to the far plane
+                float centerDepth = glm::min(0.5f * (d0 + d1) * (1.0f + k), d1);
+                float radius = glm::length(glm::vec3(tanX * d1, tanY * d1, d1 - centerDepth));
+                auto center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+                // snapped to whole texels in light space
+                float texel = 2.0f * radius / SIZE;
+                auto lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+                lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+                lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+                // light view looks down -Z, casters up to CASTER_DISTANCE toward the light still cast
+                auto projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                    -lightCenter.z - radius - CASTER_DISTANCE, -lightCenter.z + radius);
+                matrices[cascade] = projection * lightView;
+                texelSizes[cascade] = texel;
+                drawn[cascade] = true;
+
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                shader.setMatrix("lightSpace", glm::value_ptr(matrices[cascade]));
+
+                for(auto casters : casterLists)
+                {
+                    for(auto& caster : *casters)
+                    {
+                        if(!Visible(lightView, lightCenter, radius, caster))
+                            continue;
+
+                        caster.cull ? glEnable(GL_CULL_FACE) : glDisable(GL_CULL_FACE);
+                        glBindVertexArray(caster.vao);
+                        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(caster.model));
+                        glDrawArrays(caster.mode, caster.first, caster.count);
+                        stats.triangles += caster.mode == GL_TRIANGLES ? caster.count / 3 : 0;
+                    }
+                }
+                stats.cascadesDrawn++;
+            }
+            frame++;
+
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glEnable(GL_CULL_FACE);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            stats.updateMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // call every frame, the far cascades matrices change when they're redrawn
+        void SetUniforms(Shader& target, int unit) const
+        {
+            target.use();
+            target.setInt("sunShadows.map", unit);
+            auto ends = glm::vec4(splits[1], splits[2], splits[3], splits[4]);
+            glUniform4fv(glGetUniformLocation(target.ID, "sunShadows.splits"), 1, glm::value_ptr(ends));
+            glUniform4fv(glGetUniformLocation(target.ID, "sunShadows.texelSizes"), 1, texelSizes);
+            glUniformMatrix4fv(glGetUniformLocation(target.ID, "sunShadows.matrices"), CASCADES, GL_FALSE, glm::value_ptr(matrices[0]));
+        }
+
+        void Bind(int unit) const
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        // bounding sphere of the caster against the cascade box, extended toward the light
+        static bool Visible(const glm::mat4& lightView, glm::vec3 lightCenter, float radius, const DrawPacket& caster)
+        {
+            // the VAOs are unit sized shapes
+            float scale = glm::max(glm::length(glm::vec3(caster.model[0])), glm::max(glm::length(glm::vec3(caster.model[1])), glm::length(glm::vec3(caster.model[2]))));
+            float casterRadius = scale * 1.7320508f;
+            auto pos = glm::vec3(lightView * caster.model[3]) - lightCenter;
+            return std::abs(pos.x) <= radius + casterRadius && std::abs(pos.y) <= radius + casterRadius
+                && pos.z >= -radius - casterRadius && pos.z <= radius + CASTER_DISTANCE + casterRadius;
+        }
+
+        Shader shader;
+        unsigned int texture = 0;
+        unsigned int fbo = 0;
+
+        float fovY = 0.0f;
+        float aspect = 1.0f;
+        float splits[CASCADES + 1] = {};
+        glm::mat4 matrices[CASCADES] = {};
+        float texelSizes[CASCADES] = {};
+        bool drawn[CASCADES] = {};
+        unsigned int frame = 0;
+        Stats stats;
+    };
+}
+#endif
@@ -0,0 +1,316 @@
+
+
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <TextureResidency.h>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // GL calls written down to be made later. Any thread can record into its own buffer, only the GL thread replays, so
+    // the work of deciding what to draw can be spread over jobs and the GL thread only makes the calls.
+    //
+    // Commands are plain structs packed one after the other in a byte array, each starting with its op, 2 to 32 bytes.
+    // Recording is a copy to the end of the array and replay a switch on the op, no allocation or virtual call per
+    // command. Whatever a command points to, like attribute values, has to stay alive until the replay
+    class CommandBuffer
+    {
+    public:
+        enum class Op : uint8_t
+        {
+            USE_PROGRAM,
+            BIND_VERTEX_ARRAY,
+            BIND_TEXTURE,
+            BIND_BUFFER_RANGE,
+            ENABLE,
+            DISABLE,
+            BLEND_FUNC,
+            DEPTH_FUNC,
+            DEPTH_MASK,
+            COLOR_MASK,
+            VERTEX_ATTRIBS,
+            DRAW_ARRAYS,
+            DRAW_ARRAYS_INSTANCED,
+            DRAW_ELEMENTS,
+            DRAW_ELEMENTS_INSTANCED,
+        };
+
+        void UseProgram(unsigned int program)
+        {
+            Write(Name{Op::USE_PROGRAM, program});
+        }
+
+        void BindVertexArray(unsigned int vao)
+        {
+            Write(Name{Op::BIND_VERTEX_ARRAY, vao});
+        }
+
+        // on unit, and counted as used for texture streaming when it's a 2D texture
+        void BindTexture(unsigned int unit, GLenum target, unsigned int texture)
+        {
+            Write(Texture{Op::BIND_TEXTURE, (uint8_t)unit, target, texture});
+        }
+
+        // a range of buffer on an indexed binding, like a uniform block
+        void BindBufferRange(GLenum target, unsigned int index, unsigned int buffer, GLintptr offset, GLsizeiptr size)
+        {
+            Write(BufferRange{Op::BIND_BUFFER_RANGE, (uint8_t)index, target, buffer, (uint64_t)offset, (uint64_t)size});
+        }
+
+        void Enable(GLenum cap)
+        {
+            Write(Name{Op::ENABLE, cap});
+        }
+
+        void Disable(GLenum cap)
+        {
+            Write(Name{Op::DISABLE, cap});
+        }
+
+        void BlendFunc(GLenum source, GLenum destination)
+        {
+            Write(Pair{Op::BLEND_FUNC, source, destination});
+        }
+
+        void DepthFunc(GLenum func)
+        {
+            Write(Name{Op::DEPTH_FUNC, func});
+        }
+
+        void DepthMask(bool write)
+        {
+            Write(Flags{Op::DEPTH_MASK, write});
+        }
+
+        void ColorMask(bool write)
+        {
+            Write(Flags{Op::COLOR_MASK, write});
+        }
+
+        // constant vec4 attributes from first on, values read at replay
+        void VertexAttribs(unsigned int first, unsigned int count, const float* values)
+        {
+            Write(Attribs{Op::VERTEX_ATTRIBS, (uint8_t)first, (uint8_t)count, values});
+        }
+
+        void DrawArrays(GLenum mode, int first, int count)
+        {
+            Write(Draw{Op::DRAW_ARRAYS, mode, first, count, 1, 0, 0});
+        }
+
+        void DrawArraysInstanced(GLenum mode, int first, int count, int instances, unsigned int baseInstance)
+        {
+            Write(Draw{Op::DRAW_ARRAYS_INSTANCED, mode, first, count, instances, 0, baseInstance});
+        }
+
+        // indices are GL_UNSIGNED_INT, first counts them
+        void DrawElements(GLenum mode, int first, int count, int baseVertex = 0)
+        {
+            Write(Draw{Op::DRAW_ELEMENTS, mode, first, count, 1, baseVertex, 0});
+        }
+
+        void DrawElementsInstanced(GLenum mode, int first, int count, int instances, int baseVertex, unsigned int baseInstance)
+        {
+            Write(Draw{Op::DRAW_ELEMENTS_INSTANCED, mode, first, count, instances, baseVertex, baseInstance});
+        }
+
+        void Clear()
+        {
+            bytes.clear();
+            commands = 0;
+        }
+
+        size_t Commands() const
+        {
+            return commands;
+        }
+
+        size_t Bytes() const
+        {
+            return bytes.size();
+        }
+
+        // makes the calls, in the order they were recorded. GL thread only
+        void Replay() const
+        {
+            auto& residency = TextureResidency::Get();
+            const uint8_t* at = bytes.data();
+            const uint8_t* end = at + bytes.size();
+            while(at < end)
+            {
+                switch((Op)*at)
+                {
+                case Op::USE_PROGRAM:
+                    glUseProgram(Read<Name>(at).name);
+                    break;
+                case Op::BIND_VERTEX_ARRAY:
+                    glBindVertexArray(Read<Name>(at).name);
+                    break;
+                case Op::BIND_TEXTURE:
+                {
+                    auto command = Read<Texture>(at);
+                    glActiveTexture(GL_TEXTURE0 + command.unit);
+                    glBindTexture(command.target, command.texture);
+                    if(command.target == GL_TEXTURE_2D)
+                        residency.Touch(command.texture);
+                    break;
+                }
+                case Op::BIND_BUFFER_RANGE:
+                {
+                    auto command = Read<BufferRange>(at);
+                    glBindBufferRange(command.target, command.index, command.buffer, (GLintptr)command.offset, (GLsizeiptr)command.size);
+                    break;
+                }
+                case Op::ENABLE:
+                    glEnable(Read<Name>(at).name);
+                    break;
+                case Op::DISABLE:
+                    glDisable(Read<Name>(at).name);
+                    break;
+                case Op::BLEND_FUNC:
+                {
+                    auto command = Read<Pair>(at);
+                    glBlendFunc(command.a, command.b);
+                    break;
+                }
+                case Op::DEPTH_FUNC:
+                    glDepthFunc(Read<Name>(at).name);
+                    break;
+                case Op::DEPTH_MASK:
+                    glDepthMask(Read<Flags>(at).value ? GL_TRUE : GL_FALSE);
+                    break;
+                case Op::COLOR_MASK:
+                {
+                    GLboolean value = Read<Flags>(at).value ? GL_TRUE : GL_FALSE;
+                    glColorMask(value, value, value, value);
+                    break;
+                }
+                case Op::VERTEX_ATTRIBS:
+                {
+                    auto command = Read<Attribs>(at);
+                    for(unsigned int i = 0; i < command.count; i++)
+                        glVertexAttrib4fv(command.first + i, command.values + i * 4);
+                    break;
+                }
+                case Op::DRAW_ARRAYS:
+                {
+                    auto command = Read<Draw>(at);
+                    glDrawArrays(command.mode, command.first, command.count);
+                    break;
+                }
+                case Op::DRAW_ARRAYS_INSTANCED:
+                {
+                    auto command = Read<Draw>(at);
+                    glDrawArraysInstancedBaseInstance(command.mode, command.first, command.count, command.instances, command.baseInstance);
+                    break;
+                }
+                case Op::DRAW_ELEMENTS:
+                {
+                    auto command = Read<Draw>(at);
+                    auto offset = (void*)(command.first * sizeof(unsigned int));
+                    if(command.baseVertex)
+                        glDrawElementsBaseVertex(command.mode, command.count, GL_UNSIGNED_INT, offset, command.baseVertex);
+                    else
+                        glDrawElements(command.mode, command.count, GL_UNSIGNED_INT, offset);
+                    break;
+                }
+                case Op::DRAW_ELEMENTS_INSTANCED:
+                {
+                    auto command = Read<Draw>(at);
+                    glDrawElementsInstancedBaseVertexBaseInstance(command.mode, command.count, GL_UNSIGNED_INT, (void*)(command.first * sizeof(unsigned int)),
+                        command.instances, command.baseVertex, command.baseInstance);
+                    break;
+                }
+                }
+            }
+        }
+
+    private:
+        // the commands, op first in each
+        struct Name
+        {
+            Op op;
+            uint32_t name;
+        };
+
+        struct Flags
+        {
+            Op op;
+            bool value;
+        };
+
+        struct Pair
+        {
+            Op op;
+            uint32_t a;
+            uint32_t b;
+        };
+
+        struct Texture
+        {
+            Op op;
+            uint8_t unit;
+            uint32_t target;
+            uint32_t texture;
+        };
+
+        struct BufferRange
+        {
+            Op op;
+            uint8_t index;
+            uint32_t target;
+            uint32_t buffer;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct Attribs
+        {
+            Op op;
+            uint8_t first;
+            uint8_t count;
+            const float* values;
+        };
+
+        struct Draw
+        {
+            Op op;
+            uint32_t mode;
+            int32_t first;
+            int32_t count;
+            int32_t instances;
+            int32_t baseVertex;
+            uint32_t baseInstance;
+        };
+
+        template<typename Command>
+        void Write(const Command& command)
+        {
+            static_assert(std::is_trivially_copyable<Command>::value, "commands are copied as bytes");
+            auto data = reinterpret_cast<const uint8_t*>(&command);
+            bytes.insert(bytes.end(), data, data + sizeof(Command));
+            commands++;
+        }
+
+        // the command at, moving past it. Copied out, as the array has no alignment to speak of
+        template<typename Command>
+        static Command Read(const uint8_t*& at)
+        {
+            Command command;
+            std::memcpy(&command, at, sizeof(Command));
+            at += sizeof(Command);
+            return command;
+        }
+
+        std::vector<uint8_t> bytes;
+        size_t commands = 0;
+    };
+}
+#endif
@@ -0,0 +1,124 @@
+
+
+#ifndef CONE_STEP_MAP_H
+#define CONE_STEP_MAP_H
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Relaxed cone step mapping (Policarpo & Oliveira, GPU Gems 3 ch. 18).
+    // For every texel we store the widest cone, with its apex on the surface, such that a ray entering it
+    // crosses the surface at most once before reaching the apex. Marching a ray from cone boundary to cone boundary
+    // can then overshoot into the surface at most once, which a short binary search fixes, so the shader converges in a few steps.
+    //
+    // Depth is in [0, 1] with 0 at the top. Ratios are in texture widths per unit of depth, clamped to [0, 1].
+    class ConeStepMap
+    {
+    public:
+        // depth holds one value per texel, row major. Returns one ratio per texel
+        static std::vector<float> Bake(const std::vector<float>& depth, int width, int height, unsigned int threads = std::thread::hardware_concurrency())
+        {
+            std::vector<float> ratios(width * height);
+            ParallelFor(0, height, [&](int y)
+            {
+                for(int x = 0; x < width; x++)
+                    ratios[y * width + x] = BakeTexel(depth, width, height, x, y);
+            }, threads);
+
+            return ratios;
+        }
+
+    private:
+        static float DepthAt(const std::vector<float>& depth, int width, int x, int y)
+        {
+            return depth[y * width + x];
+        }
+
+        static float BakeTexel(const std::vector<float>& depth, int width, int height, int x, int y)
+        {
+            const float srcDepth = DepthAt(depth, width, x, y);
+            // nothing can be above a texel on the top surface
+            if(srcDepth <= 0.0f)
+                return 1.0f;
+
+            const float texel = 1.0f / std::max(width, height);
+            float best = 1.0f;
+
+            // Candidates are visited in growing square rings. A candidate at distance r can't give a ratio under
+            // r / srcDepth, as the point we measure to lies beyond it, so we can stop once rings get that far
+            int maxRing = std::max(width, height);
+            for(int ring = 1; ring < maxRing; ring++)
+            {
+                if(ring * texel / srcDepth >= best)
+                    break;
+
+                for(int dy = -ring; dy <= ring; dy++)
+                {
+                    bool edgeRow = dy == -ring || dy == ring;
+                    for(int dx = -ring; dx <= ring; dx += edgeRow ? 1 : 2 * ring)
+                    {
+                        int dstX = x + dx;
+                        int dstY = y + dy;
+                        if(dstX < 0 || dstY < 0 || dstX >= width || dstY >= height)
+                            continue;
+
+                        best = std::min(best, RatioTo(depth, width, height, x, y, srcDepth, dstX, dstY, best));
+                    }
+                }
+            }
+            return best;
+        }
+
+        // Casts a ray from the top of the source texel through the surface at dst and looks for the point where it leaves the surface again.
+        // The cone at the source must not reach that point, or a ray could go through a whole bump while stepping inside the cone.
+        // Gives up as soon as the ratio can't get under best
+        static float RatioTo(const std::vector<float>& depth, int width, int height, int srcX, int srcY, float srcDepth, int dstX, int dstY, float best)
+        {
+            float dstDepth = DepthAt(depth, width, dstX, dstY);
+            if(dstDepth <= 0.0f)
+                return 1.0f;
+
+            // ray in texels, scaled so it advances one texel per step along its major axis
+            float dirX = dstX - srcX;
+            float dirY = dstY - srcY;
+            float steps = std::max(std::abs(dirX), std::abs(dirY));
+            dirX /= steps;
+            dirY /= steps;
+            float dirZ = dstDepth / steps;
+
+            const float maxDist = best * srcDepth * std::max(width, height);
+            float rayX = dstX + 0.5f;
+            float rayY = dstY + 0.5f;
+            float rayZ = dstDepth;
+            for(float dist = steps; ; dist += 1.0f)
+            {
+                rayX += dirX;
+                rayY += dirY;
+                rayZ += dirZ;
+                int texelX = (int)rayX;
+                int texelY = (int)rayY;
+                if(rayZ >= 1.0f || rayX < 0.0f || rayY < 0.0f || texelX >= width || texelY >= height || dist >= maxDist)
+                    return 1.0f;
+
+                // back above the surface
+                if(rayZ < DepthAt(depth, width, texelX, texelY))
+                    break;
+            }
+
+            // only points above the apex constrain the cone
+            if(rayZ >= srcDepth)
+                return 1.0f;
+
+            float distX = (rayX - (srcX + 0.5f)) / width;
+            float distY = (rayY - (srcY + 0.5f)) / height;
+            return std::sqrt(distX * distX + distY * distY) / (srcDepth - rayZ);
+        }
+    };
+}
+#endif
@@ -0,0 +1,202 @@
+
+
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include <glad/glad.h>
+
+#include <BlockCompression.h>
+#include <GLExtensions.h>
+#include <Parallel.h>
+#include <TextureFile.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+// from EXT_texture_sRGB, which glad was generated without
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+
+namespace LearnOpenGL
+{
+    // Six faces texture, in GL order: +X, -X, +Y, -Y, +Z, -Z (right, left, top, bottom, front, back).
+    // Faces can be loaded straight from images, decoded in parallel, or from a single baked file holding
+    // the whole BC1 compressed mip chain, which is what the app uses after the first launch.
+    class Cubemap
+    {
+    public:
+        using Faces = std::array<std::filesystem::path, 6>;
+
+        static Faces FacesAt(const std::filesystem::path& dir, const std::string& extension = ".jpg")
+        {
+            return {dir / ("right" + extension), dir / ("left" + extension), dir / ("top" + extension),
+                dir / ("bottom" + extension), dir / ("front" + extension), dir / ("back" + extension)};
+        }
+
+        // decodes the faces as jobs, as RGBA
+        static bool LoadFaces(const Faces& faces, std::array<Image, 6>& images)
+        {
+            std::array<bool, 6> loaded;
+            ParallelFor(0, 6, [&](int face)
+            {
+                loaded[face] = LoadImage(faces[face], images[face], 4);
+            });
+
+            bool ok = std::all_of(loaded.begin(), loaded.end(), [](bool face) { return face; });
+
+            for(auto& image : images)
+            {
+                if(ok && (image.width != images[0].width || image.height != images[0].height || image.width != image.height))
+                {
+                    std::cout << "Error: cubemap faces must be square and all the same size\n";
+                    return false;
+                }
+            }
+            return ok;
+        }
+
+        // uploads decoded faces as they are, letting GL build the mips
+        static unsigned int FromFaces(const Faces& faces)
+        {
+            std::array<Image, 6> images;
+            if(!LoadFaces(faces, images))
+                return 0;
+
+            auto texture = Gen();
+            for(int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8_ALPHA8, images[face].width, images[face].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, images[face].pixels.data());
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            return texture;
+        }
+
+        // decodes the faces in parallel and writes them to path as a BC1 compressed, mip complete cubemap
+        static bool Bake(const Faces& faces, const std::filesystem::path& path)
+        {
+            std::array<Image, 6> images;
+            if(!LoadFaces(faces, images))
+                return false;
+
+            TextureFile file;
+            file.format = TextureFile::Format::BC1_SRGB;
+            file.width = images[0].width;
+            file.height = images[0].height;
+            file.faces = 6;
+            file.levels = MipCount(file.width);
+            file.data.resize(file.faces * file.levels);
+
+            ParallelFor(0, 6, [&](int face)
+            {
+                Image level = std::move(images[face]);
+                for(uint32_t i = 0; i < file.levels; i++)
+                {
+                    file.Level(face, i) = BC1::Encode(level.pixels.data(), level.width, level.height);
+                    if(i + 1 < file.levels)
+                        level = Downsample(level);
+                }
+            });
+
+            return file.Save(path);
+        }
+
+        // uploads a baked cubemap with a single read, decompressing it on the CPU if the driver lacks S3TC
+        static unsigned int FromFile(const std::filesystem::path& path)
+        {
+            TextureFile file;
+            if(!file.Load(path) || file.faces != 6 || file.format != TextureFile::Format::BC1_SRGB)
+            {
+                std::cout << "Error: could not load cubemap at " << path.string() << '\n';
+                return 0;
+            }
+
+            bool compressed = HasExtension("GL_EXT_texture_compression_s3tc") && HasExtension("GL_EXT_texture_sRGB");
+            auto texture = Gen();
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, file.levels - 1);
+            for(uint32_t face = 0; face < 6; face++)
+            {
+                for(uint32_t level = 0; level < file.levels; level++)
+                {
+                    auto& data = file.Level(face, level);
+                    auto width = file.LevelWidth(level);
+                    auto height = file.LevelHeight(level);
+                    if(compressed)
+                        glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, width, height, 0, data.size(), data.data());
+                    else
+                        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, BC1::Decode(data.data(), width, height).data());
+                }
+            }
+            return texture;
+        }
+
+    private:
+        static unsigned int Gen()
+        {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            // filter across face edges instead of clamping at each face
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+            return texture;
+        }
+
+        static uint32_t MipCount(uint32_t size)
+        {
+            uint32_t levels = 1;
+            while(size > 1)
+            {
+                size /= 2;
+                levels++;
+            }
+            return levels;
+        }
+
+        // 2x2 box filter in linear space, as the faces are sRGB
+        static Image Downsample(const Image& image)
+        {
+            static const auto toLinear = []()
+            {
+                std::array<float, 256> table;
+                for(int i = 0; i < 256; i++)
+                    table[i] = std::pow(i / 255.0f, 2.2f);
+                return table;
+            }();
+            static const auto toGamma = []()
+            {
+                std::array<unsigned char, 4096> table;
+                for(int i = 0; i < 4096; i++)
+                    table[i] = (unsigned char)std::round(std::pow(i / 4095.0f, 1.0f / 2.2f) * 255.0f);
+                return table;
+            }();
+
+            Image half;
+            half.width = std::max(image.width / 2, 1);
+            half.height = std::max(image.height / 2, 1);
+            half.channels = image.channels;
+            half.pixels.resize(half.width * half.height * half.channels);
+            for(int y = 0; y < half.height; y++)
+            {
+                for(int x = 0; x < half.width; x++)
+                {
+                    int x0 = std::min(x * 2, image.width - 1), x1 = std::min(x * 2 + 1, image.width - 1);
+                    int y0 = std::min(y * 2, image.height - 1), y1 = std::min(y * 2 + 1, image.height - 1);
+                    for(int c = 0; c < image.channels; c++)
+                    {
+                        float sum = toLinear[image.At(x0, y0)[c]] + toLinear[image.At(x1, y0)[c]] + toLinear[image.At(x0, y1)[c]] + toLinear[image.At(x1, y1)[c]];
+                        half.At(x, y)[c] = toGamma[(int)(sum / 4.0f * 4095.0f + 0.5f)];
+                    }
+                }
+            }
+            return half;
+        }
+    };
+}
+#endif
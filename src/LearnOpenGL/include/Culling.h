@@ -0,0 +1,293 @@
+
+
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <Frustum.h>
+#include <Parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CULLING_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    // Bounding spheres of many objects, as a structure of arrays for the culling kernels
+    struct SphereBounds
+    {
+        std::vector<float> x, y, z, radius;
+
+        void Push(glm::vec3 center, float r)
+        {
+            x.push_back(center.x);
+            y.push_back(center.y);
+            z.push_back(center.z);
+            radius.push_back(r);
+        }
+
+        void Clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            radius.clear();
+        }
+
+        size_t Size() const
+        {
+            return x.size();
+        }
+    };
+
+    // Axis aligned boxes of many objects, as centers and half extents in a structure of arrays
+    struct BoxBounds
+    {
+        std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+        void Push(glm::vec3 min, glm::vec3 max)
+        {
+            auto center = (min + max) * 0.5f;
+            auto extent = (max - min) * 0.5f;
+            centerX.push_back(center.x);
+            centerY.push_back(center.y);
+            centerZ.push_back(center.z);
+            extentX.push_back(extent.x);
+            extentY.push_back(extent.y);
+            extentZ.push_back(extent.z);
+        }
+
+        void Clear()
+        {
+            for(auto array : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+                array->clear();
+        }
+
+        size_t Size() const
+        {
+            return centerX.size();
+        }
+    };
+
+    // Tests bounds against the planes of a frustum, 8 at a time with AVX2 or 4 with SSE. The bounds are cut in CHUNK sized
+    // ranges spread over the hardware threads, each writes its visible indices to its own range of a scratch buffer, and the
+    // ranges are then packed together, so the output is in the same order as the bounds. Compile with AVX2 enabled for the 8 wide kernels
+    class FrustumCuller
+    {
+    public:
+        static constexpr size_t CHUNK = 16384;
+
+        struct Stats
+        {
+            size_t tested = 0;
+            size_t visible = 0;
+            float cullMs = 0.0f;
+        };
+
+        // visible is replaced by the indices of the spheres touching the frustum
+        void Cull(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& visible)
+        {
+            Run(bounds.Size(), visible, [&](size_t begin, size_t end, uint32_t* out)
+            {
+                return CullSpheres(frustum, bounds, begin, end, out);
+            });
+        }
+
+        // visible is replaced by the indices of the boxes touching the frustum
+        void Cull(const Frustum& frustum, const BoxBounds& bounds, std::vector<uint32_t>& visible)
+        {
+            Run(bounds.Size(), visible, [&](size_t begin, size_t end, uint32_t* out)
+            {
+                return CullBoxes(frustum, bounds, begin, end, out);
+            });
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        template<typename Kernel>
+        void Run(size_t count, std::vector<uint32_t>& visible, Kernel kernel)
+        {
+            auto start = std::chrono::steady_clock::now();
+            size_t chunks = (count + CHUNK - 1) / CHUNK;
+            if(scratch.size() < count)
+                scratch.resize(count);
+            chunkCounts.resize(chunks);
+            // a single chunk isn't worth waking threads for
+            unsigned int threads = chunks > 1 ? std::thread::hardware_concurrency() : 1;
+            ParallelFor(0, (int)chunks, [&](int chunk)
+            {
+                size_t begin = chunk * CHUNK;
+                size_t end = std::min(begin + CHUNK, count);
+                chunkCounts[chunk] = kernel(begin, end, &scratch[begin]);
+            }, threads);
+
+            visible.clear();
+            for(size_t chunk = 0; chunk < chunks; chunk++)
+                visible.insert(visible.end(), &scratch[chunk * CHUNK], &scratch[chunk * CHUNK] + chunkCounts[chunk]);
+
+            stats.tested = count;
+            stats.visible = visible.size();
+            stats.cullMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        static size_t CullSpheres(const Frustum& frustum, const SphereBounds& bounds, size_t begin, size_t end, uint32_t* out)
+        {
+            size_t written = 0;
+            size_t i = begin;
+#if defined(CULLING_AVX2)
+            __m256 planes[6][4];
+            for(int p = 0; p < 6; p++)
+                for(int c = 0; c < 4; c++)
+                    planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+            for(; i + 8 <= end; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(&bounds.x[i]);
+                __m256 y = _mm256_loadu_ps(&bounds.y[i]);
+                __m256 z = _mm256_loadu_ps(&bounds.z[i]);
+                __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+                __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                for(int p = 0; p < 6; p++)
+                {
+                    __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+                        _mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, negRadius, _CMP_GE_OQ));
+                }
+                int mask = _mm256_movemask_ps(inside);
+                for(int lane = 0; mask; lane++, mask >>= 1)
+                    if(mask & 1)
+                        out[written++] = i + lane;
+            }
+#elif defined(CULLING_SSE)
+            __m128 planes[6][4];
+            for(int p = 0; p < 6; p++)
+                for(int c = 0; c < 4; c++)
+                    planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+            for(; i + 4 <= end; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(&bounds.x[i]);
+                __m128 y = _mm_loadu_ps(&bounds.y[i]);
+                __m128 z = _mm_loadu_ps(&bounds.z[i]);
+                __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for(int p = 0; p < 6; p++)
+                {
+                    __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)), _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negRadius));
+                }
+                int mask = _mm_movemask_ps(inside);
+                for(int lane = 0; mask; lane++, mask >>= 1)
+                    if(mask & 1)
+                        out[written++] = i + lane;
+            }
+#endif
+            for(; i < end; i++)
+            {
+                if(frustum.Intersects(glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]), bounds.radius[i]))
+                    out[written++] = i;
+            }
+            return written;
+        }
+
+        // a box is out when its corner furthest along a plane normal is behind it: center distance + extent projected on |normal| < 0
+        static size_t CullBoxes(const Frustum& frustum, const BoxBounds& bounds, size_t begin, size_t end, uint32_t* out)
+        {
+            size_t written = 0;
+            size_t i = begin;
+#if defined(CULLING_AVX2)
+            __m256 planes[6][4], absPlanes[6][3];
+            for(int p = 0; p < 6; p++)
+            {
+                for(int c = 0; c < 4; c++)
+                    planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+                for(int c = 0; c < 3; c++)
+                    absPlanes[p][c] = _mm256_set1_ps(std::abs(frustum.planes[p][c]));
+            }
+            for(; i + 8 <= end; i += 8)
+            {
+                __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+                __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+                __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+                __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+                __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+                __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+                __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                for(int p = 0; p < 6; p++)
+                {
+                    __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], cx), _mm256_mul_ps(planes[p][1], cy)),
+                        _mm256_add_ps(_mm256_mul_ps(planes[p][2], cz), planes[p][3]));
+                    __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absPlanes[p][0], ex), _mm256_mul_ps(absPlanes[p][1], ey)), _mm256_mul_ps(absPlanes[p][2], ez));
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+                }
+                int mask = _mm256_movemask_ps(inside);
+                for(int lane = 0; mask; lane++, mask >>= 1)
+                    if(mask & 1)
+                        out[written++] = i + lane;
+            }
+#elif defined(CULLING_SSE)
+            __m128 planes[6][4], absPlanes[6][3];
+            for(int p = 0; p < 6; p++)
+            {
+                for(int c = 0; c < 4; c++)
+                    planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+                for(int c = 0; c < 3; c++)
+                    absPlanes[p][c] = _mm_set1_ps(std::abs(frustum.planes[p][c]));
+            }
+            for(; i + 4 <= end; i += 4)
+            {
+                __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+                __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+                __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+                __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+                __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+                __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for(int p = 0; p < 6; p++)
+                {
+                    __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], cx), _mm_mul_ps(planes[p][1], cy)), _mm_add_ps(_mm_mul_ps(planes[p][2], cz), planes[p][3]));
+                    __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absPlanes[p][0], ex), _mm_mul_ps(absPlanes[p][1], ey)), _mm_mul_ps(absPlanes[p][2], ez));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, reach), _mm_setzero_ps()));
+                }
+                int mask = _mm_movemask_ps(inside);
+                for(int lane = 0; mask; lane++, mask >>= 1)
+                    if(mask & 1)
+                        out[written++] = i + lane;
+            }
+#endif
+            for(; i < end; i++)
+            {
+                glm::vec3 center{bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]};
+                glm::vec3 extent{bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]};
+                bool inside = true;
+                for(int p = 0; inside && p < 6; p++)
+                {
+                    auto& plane = frustum.planes[p];
+                    inside = glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) >= 0.0f;
+                }
+                if(inside)
+                    out[written++] = i;
+            }
+            return written;
+        }
+
+        std::vector<uint32_t> scratch;
+        std::vector<size_t> chunkCounts;
+        Stats stats;
+    };
+}
+#endif
@@ -0,0 +1,111 @@
+
+
+#ifndef FRAGMENT_COUNTER_H
+#define FRAGMENT_COUNTER_H
+
+#include <glad/glad.h>
+
+#include <GLExtensions.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Counts the fragment shader invocations inside the Begin/End pairs of a frame. Results are read LATENCY frames late so it
+    // never stalls. Without pipeline statistics queries it counts the samples passing the depth test instead, which leaves out
+    // the fragments killed by a late depth test
+    class FragmentCounter
+    {
+    public:
+        static constexpr int LATENCY = 3;
+
+        FragmentCounter()
+        {
+            GLint major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            invocations = major > 4 || (major == 4 && minor >= 6) || HasExtension("GL_ARB_pipeline_statistics_query");
+            target = invocations ? GL_FRAGMENT_SHADER_INVOCATIONS : GL_SAMPLES_PASSED;
+        }
+
+        ~FragmentCounter()
+        {
+            for(auto& slot : frames)
+                glDeleteQueries(slot.queries.size(), slot.queries.data());
+        }
+
+        FragmentCounter(const FragmentCounter&) = delete;
+        FragmentCounter& operator=(const FragmentCounter&) = delete;
+
+        // a frame may count several ranges, but a single query of a kind can be active, so they can't nest with other counters
+        void Begin()
+        {
+            auto& slot = frames[frame % LATENCY];
+            if(slot.used == slot.queries.size())
+            {
+                unsigned int query;
+                glGenQueries(1, &query);
+                slot.queries.push_back(query);
+            }
+            glBeginQuery(target, slot.queries[slot.used]);
+        }
+
+        void End()
+        {
+            glEndQuery(target);
+            frames[frame % LATENCY].used++;
+        }
+
+        // sums the oldest frame, if the GPU is done with it, and reuses its queries for the next one
+        void EndFrame()
+        {
+            frame++;
+            auto& slot = frames[frame % LATENCY];
+            if(frame < LATENCY)
+                return;
+
+            GLuint64 sum = 0;
+            for(size_t i = 0; i < slot.used; i++)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+                if(!available)
+                {
+                    sum = count;
+                    break;
+                }
+                GLuint64 result = 0;
+                glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &result);
+                sum += result;
+            }
+            count = sum;
+            slot.used = 0;
+        }
+
+        uint64_t GetCount() const
+        {
+            return count;
+        }
+
+        // false when counting samples passed
+        bool CountsInvocations() const
+        {
+            return invocations;
+        }
+
+    private:
+        struct Frame
+        {
+            std::vector<unsigned int> queries;
+            size_t used = 0;
+        };
+
+        GLenum target;
+        bool invocations;
+        Frame frames[LATENCY];
+        uint64_t frame = 0;
+        GLuint64 count = 0;
+    };
+}
+#endif
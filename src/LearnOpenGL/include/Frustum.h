@@ -0,0 +1,46 @@
+
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+namespace LearnOpenGL
+{
+    // The 6 planes of a view projection, normals pointing inside, so a point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+
+        Frustum() = default;
+
+        // Gribb and Hartmann: the planes are sums and differences of the matrix rows
+        explicit Frustum(const glm::mat4& viewProjection)
+        {
+            auto row = [&](int i)
+            {
+                return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+            };
+            planes[0] = row(3) + row(0);    // left
+            planes[1] = row(3) - row(0);    // right
+            planes[2] = row(3) + row(1);    // bottom
+            planes[3] = row(3) - row(1);    // top
+            planes[4] = row(3) + row(2);    // near
+            planes[5] = row(3) - row(2);    // far
+            for(auto& plane : planes)
+                plane /= glm::length(glm::vec3(plane));
+        }
+
+        // conservative, a sphere just outside a corner still passes
+        bool Intersects(glm::vec3 center, float radius) const
+        {
+            for(auto& plane : planes)
+            {
+                if(glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                    return false;
+            }
+            return true;
+        }
+    };
+}
+#endif
@@ -0,0 +1,121 @@
+
+
+#ifndef G_BUFFER_H
+#define G_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+namespace LearnOpenGL
+{
+    // Render targets of the deferred path, 12 bytes per pixel:
+    //  albedo: SRGB8_ALPHA8, diffuse and specular intensity
+    //  normal: RGB10_A2, octahedral normal and shininess
+    //  depth:  DEPTH_COMPONENT24, world positions are rebuilt from it
+    class GBuffer
+    {
+    public:
+        GBuffer(int width, int height)
+        {
+            Create(width, height);
+        }
+
+        ~GBuffer()
+        {
+            Destroy();
+        }
+
+        GBuffer(const GBuffer&) = delete;
+        GBuffer& operator=(const GBuffer&) = delete;
+
+        void Resize(int width, int height)
+        {
+            if(width == this->width && height == this->height)
+                return;
+            Destroy();
+            Create(width, height);
+        }
+
+        // binds and clears it for the geometry pass. Albedo is written linear and stored sRGB, so it keeps its precision in the darks
+        void Bind()
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glViewport(0, 0, width, height);
+            glEnable(GL_FRAMEBUFFER_SRGB);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        // back to the default framebuffer, which the shaders gamma correct themselves
+        void Unbind()
+        {
+            glDisable(GL_FRAMEBUFFER_SRGB);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        void BindTextures(int albedoUnit, int normalUnit, int depthUnit) const
+        {
+            const int units[3] = {albedoUnit, normalUnit, depthUnit};
+            const unsigned int textures[3] = {albedo, normal, depth};
+            for(int i = 0; i < 3; i++)
+            {
+                glActiveTexture(GL_TEXTURE0 + units[i]);
+                glBindTexture(GL_TEXTURE_2D, textures[i]);
+            }
+        }
+
+        size_t Bytes() const
+        {
+            return (size_t)width * height * 12;
+        }
+
+    private:
+        void Create(int width, int height)
+        {
+            this->width = width;
+            this->height = height;
+
+            glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            albedo = Attach(GL_COLOR_ATTACHMENT0, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+            normal = Attach(GL_COLOR_ATTACHMENT1, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+            depth = Attach(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+
+            const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, drawBuffers);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "Error: G-buffer framebuffer is not complete\n";
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        unsigned int Attach(GLenum attachment, GLenum internalFormat, GLenum format, GLenum type)
+        {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+            return texture;
+        }
+
+        void Destroy()
+        {
+            const unsigned int textures[3] = {albedo, normal, depth};
+            glDeleteTextures(3, textures);
+            glDeleteFramebuffers(1, &fbo);
+        }
+
+        int width = 0;
+        int height = 0;
+        unsigned int fbo = 0;
+        unsigned int albedo = 0;
+        unsigned int normal = 0;
+        unsigned int depth = 0;
+    };
+}
+#endif
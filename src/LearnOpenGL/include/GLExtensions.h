@@ -0,0 +1,26 @@
+
+
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+namespace LearnOpenGL
+{
+    // glad was generated without extensions, so we look them up in the current context ourselves
+    inline bool HasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for(GLint i = 0; i < count; i++)
+        {
+            auto extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if(extension && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+}
+#endif
@@ -0,0 +1,504 @@
+
+
+#ifndef IMAGE_BASED_LIGHTING_H
+#define IMAGE_BASED_LIGHTING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <BlockCompression.h>
+#include <Parallel.h>
+#include <Shader.h>
+#include <TextureFile.h>
+
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IBL_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    // Linear radiance cubemap on the CPU, input of the bakes. Faces in GL order
+    struct CubeImage
+    {
+        int size = 0;
+        std::array<std::vector<glm::vec3>, 6> faces;
+
+        // direction through the face at s, t in [-1, 1], following the GL cubemap face layout. Not normalized
+        static glm::vec3 Direction(int face, float s, float t)
+        {
+            switch(face)
+            {
+                case 0: return glm::vec3( 1.0f, -t, -s);
+                case 1: return glm::vec3(-1.0f, -t,  s);
+                case 2: return glm::vec3( s,  1.0f,  t);
+                case 3: return glm::vec3( s, -1.0f, -t);
+                case 4: return glm::vec3( s, -t,  1.0f);
+                default: return glm::vec3(-s, -t, -1.0f);
+            }
+        }
+
+        glm::vec3 Sample(glm::vec3 dir) const
+        {
+            glm::vec3 a = glm::abs(dir);
+            int face;
+            float s, t, ma;
+            if(a.x >= a.y && a.x >= a.z)
+            {
+                ma = a.x;
+                face = dir.x > 0 ? 0 : 1;
+                s = dir.x > 0 ? -dir.z : dir.z;
+                t = -dir.y;
+            }
+            else if(a.y >= a.z)
+            {
+                ma = a.y;
+                face = dir.y > 0 ? 2 : 3;
+                s = dir.x;
+                t = dir.y > 0 ? dir.z : -dir.z;
+            }
+            else
+            {
+                ma = a.z;
+                face = dir.z > 0 ? 4 : 5;
+                s = dir.z > 0 ? dir.x : -dir.x;
+                t = -dir.y;
+            }
+
+            // bilinear, clamped at the face edges
+            float u = glm::clamp((s / ma + 1.0f) * 0.5f * size - 0.5f, 0.0f, size - 1.0f);
+            float v = glm::clamp((t / ma + 1.0f) * 0.5f * size - 0.5f, 0.0f, size - 1.0f);
+            int x0 = (int)u, y0 = (int)v;
+            int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+            float fx = u - x0, fy = v - y0;
+            auto& texels = faces[face];
+            auto top = glm::mix(texels[y0 * size + x0], texels[y0 * size + x1], fx);
+            auto bottom = glm::mix(texels[y1 * size + x0], texels[y1 * size + x1], fx);
+            return glm::mix(top, bottom, fy);
+        }
+    };
+
+    // Image based ambient from the skybox: diffuse irradiance as 9 spherical harmonics coefficients,
+    // a GGX prefiltered specular cubemap with roughness along its mips, and the split-sum BRDF lookup table.
+    // Everything is baked on the CPU and cached on disk, the shader only needs a few uniforms and two fetches.
+    class ImageBasedLighting
+    {
+    public:
+        static constexpr int SPECULAR_SIZE = 128;
+        static constexpr int SPECULAR_LEVELS = 6;
+        static constexpr int SPECULAR_SAMPLES = 128;
+        static constexpr int BRDF_SIZE = 128;
+        static constexpr int BRDF_SAMPLES = 256;
+
+        std::array<glm::vec3, 9> irradiance;
+        unsigned int specular = 0;
+        unsigned int brdf = 0;
+
+        // the three files Bake writes into dir
+        static std::array<std::filesystem::path, 3> Files(const std::filesystem::path& dir)
+        {
+            return {dir / "irradiance_sh.tex", dir / "specular.tex", dir / "brdf_lut.tex"};
+        }
+
+        static bool NeedsBake(const std::filesystem::path& skyboxPath, const std::filesystem::path& dir)
+        {
+            for(auto& file : Files(dir))
+                if(LearnOpenGL::NeedsTextureBake(file, {skyboxPath}))
+                    return true;
+            return false;
+        }
+
+        // skyboxPath is a cubemap baked by Cubemap::Bake
+        static bool Bake(const std::filesystem::path& skyboxPath, const std::filesystem::path& dir)
+        {
+            std::vector<CubeImage> mips;
+            if(!LoadMips(skyboxPath, mips))
+                return false;
+
+            auto files = Files(dir);
+            return ProjectIrradiance(mips).Save(files[0]) && PrefilterSpecular(mips).Save(files[1]) && IntegrateBRDF().Save(files[2]);
+        }
+
+        bool Load(const std::filesystem::path& dir)
+        {
+            auto files = Files(dir);
+            TextureFile sh, prefiltered, lut;
+            if(!sh.Load(files[0]) || !prefiltered.Load(files[1]) || !lut.Load(files[2]))
+            {
+                std::cout << "Error: could not load image based lighting from " << dir.string() << '\n';
+                return false;
+            }
+
+            auto coefficients = (const float*)sh.Level(0, 0).data();
+            for(int i = 0; i < 9; i++)
+                irradiance[i] = glm::vec3(coefficients[i * 4], coefficients[i * 4 + 1], coefficients[i * 4 + 2]);
+
+            glGenTextures(1, &specular);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, specular);
+            for(uint32_t face = 0; face < 6; face++)
+                for(uint32_t level = 0; level < prefiltered.levels; level++)
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_SRGB8_ALPHA8, prefiltered.LevelWidth(level), prefiltered.LevelHeight(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, prefiltered.Level(face, level).data());
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, prefiltered.levels - 1);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+            glGenTextures(1, &brdf);
+            glBindTexture(GL_TEXTURE_2D, brdf);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, lut.width, lut.height, 0, GL_RG, GL_HALF_FLOAT, lut.Level(0, 0).data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return true;
+        }
+
+        // sets the environment uniforms. The textures are expected at specularUnit and brdfUnit
+        void SetUniforms(Shader& shader, int specularUnit, int brdfUnit, float strength) const
+        {
+            shader.use();
+            for(int i = 0; i < 9; i++)
+            {
+                auto coefficient = irradiance[i];
+                shader.setVec3("environment.irradiance[" + std::to_string(i) + "]", &coefficient.x);
+            }
+            shader.setInt("environment.specular", specularUnit);
+            shader.setInt("environment.brdf", brdfUnit);
+            shader.setFloat("environment.specularLevels", SPECULAR_LEVELS);
+            shader.setFloat("environment.strength", strength);
+        }
+
+        void Bind(int specularUnit, int brdfUnit) const
+        {
+            glActiveTexture(GL_TEXTURE0 + specularUnit);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, specular);
+            glActiveTexture(GL_TEXTURE0 + brdfUnit);
+            glBindTexture(GL_TEXTURE_2D, brdf);
+        }
+
+    private:
+        // every level of a baked BC1 cubemap, back to linear floats
+        static bool LoadMips(const std::filesystem::path& skyboxPath, std::vector<CubeImage>& mips)
+        {
+            TextureFile file;
+            if(!file.Load(skyboxPath) || file.faces != 6 || file.format != TextureFile::Format::BC1_SRGB)
+            {
+                std::cout << "Error: " << skyboxPath.string() << " is not a baked cubemap\n";
+                return false;
+            }
+
+            std::array<float, 256> toLinear;
+            for(int i = 0; i < 256; i++)
+                toLinear[i] = std::pow(i / 255.0f, 2.2f);
+
+            mips.resize(file.levels);
+            ParallelFor(0, file.levels * 6, [&](int index)
+            {
+                int level = index / 6;
+                int face = index % 6;
+                int size = file.LevelWidth(level);
+                auto rgba = BC1::Decode(file.Level(face, level).data(), size, size);
+                auto& texels = mips[level].faces[face];
+                texels.resize(size * size);
+                for(int i = 0; i < size * size; i++)
+                    texels[i] = glm::vec3(toLinear[rgba[i * 4]], toLinear[rgba[i * 4 + 1]], toLinear[rgba[i * 4 + 2]]);
+                mips[level].size = size;
+            });
+            return true;
+        }
+
+        // the first mip at most size wide
+        static const CubeImage& MipAtMost(const std::vector<CubeImage>& mips, int size)
+        {
+            for(auto& mip : mips)
+                if(mip.size <= size)
+                    return mip;
+            return mips.back();
+        }
+
+        // Projects the radiance of one face row onto the first 9 SH basis functions, weighting every texel by its solid angle
+        static void ProjectRow(const CubeImage& cube, int face, int y, float* sums)
+        {
+            const int size = cube.size;
+            const float t = (y + 0.5f) / size * 2.0f - 1.0f;
+            auto& texels = cube.faces[face];
+            int x = 0;
+#ifdef IBL_SSE
+            // four texels at a time, one per lane
+            __m128 acc[27];
+            for(auto& a : acc)
+                a = _mm_setzero_ps();
+
+            const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            const __m128 scale = _mm_set1_ps(2.0f / size);
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 texelArea = _mm_set1_ps(4.0f / (size * size));
+            for(; x + 4 <= size; x += 4)
+            {
+                __m128 s = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), scale), one);
+                __m128 ts = _mm_set1_ps(t);
+                __m128 dx, dy, dz;
+                switch(face)
+                {
+                    case 0: dx = one; dy = _mm_sub_ps(_mm_setzero_ps(), ts); dz = _mm_sub_ps(_mm_setzero_ps(), s); break;
+                    case 1: dx = _mm_sub_ps(_mm_setzero_ps(), one); dy = _mm_sub_ps(_mm_setzero_ps(), ts); dz = s; break;
+                    case 2: dx = s; dy = one; dz = ts; break;
+                    case 3: dx = s; dy = _mm_sub_ps(_mm_setzero_ps(), one); dz = _mm_sub_ps(_mm_setzero_ps(), ts); break;
+                    case 4: dx = s; dy = _mm_sub_ps(_mm_setzero_ps(), ts); dz = one; break;
+                    default: dx = _mm_sub_ps(_mm_setzero_ps(), s); dy = _mm_sub_ps(_mm_setzero_ps(), ts); dz = _mm_sub_ps(_mm_setzero_ps(), one); break;
+                }
+
+                // 1 + s^2 + t^2 is the squared length of the direction, the solid angle goes with its -3/2 power
+                __m128 lengthSq = _mm_add_ps(one, _mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(ts, ts)));
+                __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+                __m128 weight = _mm_mul_ps(texelArea, _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength)));
+                dx = _mm_mul_ps(dx, invLength);
+                dy = _mm_mul_ps(dy, invLength);
+                dz = _mm_mul_ps(dz, invLength);
+
+                __m128 basis[9];
+                basis[0] = _mm_set1_ps(0.282095f);
+                basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), dy);
+                basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), dz);
+                basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), dx);
+                basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dy));
+                basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dy, dz));
+                basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one));
+                basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dz));
+                basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+                auto row = &texels[y * size + x];
+                __m128 color[3];
+                for(int c = 0; c < 3; c++)
+                    color[c] = _mm_mul_ps(weight, _mm_set_ps(row[3][c], row[2][c], row[1][c], row[0][c]));
+
+                for(int i = 0; i < 9; i++)
+                    for(int c = 0; c < 3; c++)
+                        acc[i * 3 + c] = _mm_add_ps(acc[i * 3 + c], _mm_mul_ps(basis[i], color[c]));
+            }
+
+            for(int i = 0; i < 27; i++)
+            {
+                float lanesOut[4];
+                _mm_storeu_ps(lanesOut, acc[i]);
+                sums[i] += lanesOut[0] + lanesOut[1] + lanesOut[2] + lanesOut[3];
+            }
+#endif
+            for(; x < size; x++)
+            {
+                float s = (x + 0.5f) / size * 2.0f - 1.0f;
+                float lengthSq = 1.0f + s * s + t * t;
+                float weight = 4.0f / (size * size) / (lengthSq * std::sqrt(lengthSq));
+                auto d = glm::normalize(CubeImage::Direction(face, s, t));
+                float basis[9] = {0.282095f, 0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x,
+                    1.092548f * d.x * d.y, 1.092548f * d.y * d.z, 0.315392f * (3.0f * d.z * d.z - 1.0f),
+                    1.092548f * d.x * d.z, 0.546274f * (d.x * d.x - d.y * d.y)};
+                auto color = texels[y * size + x] * weight;
+                for(int i = 0; i < 9; i++)
+                    for(int c = 0; c < 3; c++)
+                        sums[i * 3 + c] += basis[i] * color[c];
+            }
+        }
+
+        // Radiance to irradiance coefficients, already convolved with the clamped cosine and divided by pi,
+        // so the shader gets the diffuse ambient by evaluating the basis at the normal and multiplying by albedo
+        static TextureFile ProjectIrradiance(const std::vector<CubeImage>& mips)
+        {
+            auto& cube = MipAtMost(mips, 256);
+            std::vector<std::array<float, 27>> rows(6 * cube.size);
+            ParallelFor(0, 6 * cube.size, [&](int index)
+            {
+                rows[index].fill(0.0f);
+                ProjectRow(cube, index / cube.size, index % cube.size, rows[index].data());
+            });
+
+            std::array<float, 27> sums{};
+            for(auto& row : rows)
+                for(int i = 0; i < 27; i++)
+                    sums[i] += row[i];
+
+            // cosine lobe convolution per band: pi, 2pi/3, pi/4, then / pi
+            const float bands[9] = {1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+            TextureFile file;
+            file.format = TextureFile::Format::RGBA32F;
+            file.width = 9;
+            file.height = 1;
+            file.data.assign(1, std::vector<unsigned char>(9 * 4 * sizeof(float)));
+            auto coefficients = (float*)file.Level(0, 0).data();
+            for(int i = 0; i < 9; i++)
+            {
+                for(int c = 0; c < 3; c++)
+                    coefficients[i * 4 + c] = sums[i * 3 + c] * bands[i];
+                coefficients[i * 4 + 3] = 0.0f;
+            }
+            return file;
+        }
+
+        static glm::vec2 Hammersley(unsigned int i, unsigned int count)
+        {
+            unsigned int bits = i;
+            bits = (bits << 16u) | (bits >> 16u);
+            bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+            bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+            bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+            bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+            return glm::vec2(float(i) / float(count), float(bits) * 2.3283064365386963e-10f);
+        }
+
+        // half vector around +Z, distributed as GGX for alpha = roughness^2
+        static glm::vec3 ImportanceSampleGGX(glm::vec2 xi, float roughness)
+        {
+            float a = roughness * roughness;
+            float phi = 2.0f * glm::pi<float>() * xi.x;
+            float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+        }
+
+        static float DistributionGGX(float nDotH, float roughness)
+        {
+            float a = roughness * roughness;
+            float a2 = a * a;
+            float d = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+            return a2 / (glm::pi<float>() * d * d);
+        }
+
+        // Roughness goes from 0 at level 0 to 1 at the last level. Assumes N = V = R, as the split-sum does.
+        // Samples are read from a blurrier source mip the less dense they are, which keeps 128 samples free of fireflies
+        static TextureFile PrefilterSpecular(const std::vector<CubeImage>& mips)
+        {
+            TextureFile file;
+            file.format = TextureFile::Format::RGBA8;
+            file.width = SPECULAR_SIZE;
+            file.height = SPECULAR_SIZE;
+            file.faces = 6;
+            file.levels = SPECULAR_LEVELS;
+            // sized up front, the jobs below only write their own rows
+            file.data.resize(6 * SPECULAR_LEVELS);
+            for(int face = 0; face < 6; face++)
+            {
+                for(int level = 0; level < SPECULAR_LEVELS; level++)
+                    file.Level(face, level).resize(file.LevelWidth(level) * file.LevelWidth(level) * 4);
+            }
+
+            struct Sample
+            {
+                glm::vec3 dir;   // tangent space, around +Z
+                float weight;    // N dot L
+                int mip;
+            };
+
+            const float sourceTexelAngle = 4.0f * glm::pi<float>() / (6.0f * mips[0].size * mips[0].size);
+            for(int level = 0; level < SPECULAR_LEVELS; level++)
+            {
+                float roughness = level / float(SPECULAR_LEVELS - 1);
+                int size = file.LevelWidth(level);
+
+                std::vector<Sample> samples;
+                int count = level == 0 ? 1 : SPECULAR_SAMPLES;
+                for(int i = 0; i < count; i++)
+                {
+                    auto h = level == 0 ? glm::vec3(0.0f, 0.0f, 1.0f) : ImportanceSampleGGX(Hammersley(i, count), roughness);
+                    auto l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+                    if(l.z <= 0.0f)
+                        continue;
+
+                    // source mip whose texels cover about the solid angle of this sample
+                    float pdf = DistributionGGX(h.z, roughness) / 4.0f;
+                    float sampleAngle = level == 0 ? 0.0f : 1.0f / (count * pdf + 1e-4f);
+                    float mip = level == 0 ? std::log2(mips[0].size / (float)size) : 0.5f * std::log2(sampleAngle / sourceTexelAngle) + 1.0f;
+                    samples.push_back({l, l.z, glm::clamp((int)std::round(mip), 0, (int)mips.size() - 1)});
+                }
+
+                ParallelFor(0, 6 * size, [&](int index)
+                {
+                    int face = index / size;
+                    int y = index % size;
+                    auto& out = file.Level(face, level);
+                    for(int x = 0; x < size; x++)
+                    {
+                        auto n = glm::normalize(CubeImage::Direction(face, (x + 0.5f) / size * 2.0f - 1.0f, (y + 0.5f) / size * 2.0f - 1.0f));
+                        auto up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                        auto tangent = glm::normalize(glm::cross(up, n));
+                        auto bitangent = glm::cross(n, tangent);
+
+                        glm::vec3 color{0.0f};
+                        float weight = 0.0f;
+                        for(auto& sample : samples)
+                        {
+                            auto l = tangent * sample.dir.x + bitangent * sample.dir.y + n * sample.dir.z;
+                            color += mips[sample.mip].Sample(l) * sample.weight;
+                            weight += sample.weight;
+                        }
+                        color /= weight;
+
+                        auto texel = &out[(y * size + x) * 4];
+                        for(int c = 0; c < 3; c++)
+                            texel[c] = (unsigned char)std::round(std::pow(glm::clamp(color[c], 0.0f, 1.0f), 1.0f / 2.2f) * 255.0f);
+                        texel[3] = 255;
+                    }
+                });
+            }
+            return file;
+        }
+
+        // Split-sum environment BRDF: scale and bias to F0 as a function of N dot V (x) and roughness (y)
+        static TextureFile IntegrateBRDF()
+        {
+            TextureFile file;
+            file.format = TextureFile::Format::RG16F;
+            file.width = BRDF_SIZE;
+            file.height = BRDF_SIZE;
+            file.data.assign(1, std::vector<unsigned char>(BRDF_SIZE * BRDF_SIZE * 2 * sizeof(uint16_t)));
+            auto texels = (uint16_t*)file.Level(0, 0).data();
+
+            ParallelFor(0, BRDF_SIZE, [&](int y)
+            {
+                float roughness = (y + 0.5f) / BRDF_SIZE;
+                // Schlick-GGX k for image based lighting
+                float k = roughness * roughness / 2.0f;
+                for(int x = 0; x < BRDF_SIZE; x++)
+                {
+                    float nDotV = (x + 0.5f) / BRDF_SIZE;
+                    glm::vec3 v{std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV};
+
+                    float scale = 0.0f, bias = 0.0f;
+                    for(int i = 0; i < BRDF_SAMPLES; i++)
+                    {
+                        auto h = ImportanceSampleGGX(Hammersley(i, BRDF_SAMPLES), roughness);
+                        auto l = 2.0f * glm::dot(v, h) * h - v;
+                        float nDotL = glm::max(l.z, 0.0f);
+                        float nDotH = glm::max(h.z, 0.0f);
+                        float vDotH = glm::max(glm::dot(v, h), 0.0f);
+                        if(nDotL <= 0.0f)
+                            continue;
+
+                        float g = (nDotV / (nDotV * (1.0f - k) + k)) * (nDotL / (nDotL * (1.0f - k) + k));
+                        float visibility = g * vDotH / (nDotH * nDotV);
+                        float fresnel = std::pow(1.0f - vDotH, 5.0f);
+                        scale += (1.0f - fresnel) * visibility;
+                        bias += fresnel * visibility;
+                    }
+
+                    texels[(y * BRDF_SIZE + x) * 2] = glm::packHalf1x16(scale / BRDF_SAMPLES);
+                    texels[(y * BRDF_SIZE + x) * 2 + 1] = glm::packHalf1x16(bias / BRDF_SAMPLES);
+                }
+            });
+            return file;
+        }
+    };
+}
+#endif
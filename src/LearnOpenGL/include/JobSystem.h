@@ -0,0 +1,414 @@
+
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Work stealing job system. Each worker and the main thread own a deque of jobs. The owner pushes and pops at the
+    // bottom, idle threads steal from the top of the others (Chase and Lev, with the memory orders of Le et al.), so most
+    // of the time a thread only touches its own deque. Jobs pushed by other threads go through a shared queue.
+    //
+    // A Counter follows a group of jobs, Run adds to it and it drops as they finish. A job can be held back until a
+    // counter reaches zero, and Wait runs other jobs meanwhile instead of blocking, so jobs can wait on jobs.
+    // GL only works on the main thread, the one holding the context. That is the thread that created the system until
+    // another one calls SetMainThread. RunOnMain queues work for it, done at RunMainJobs
+    class JobSystem
+    {
+        struct Job;
+
+    public:
+        // jobs of a group still to finish. Not to be reused while jobs wait on it
+        class Counter
+        {
+        public:
+            bool Done() const
+            {
+                return pending.load(std::memory_order_acquire) == 0;
+            }
+
+        private:
+            friend class JobSystem;
+            std::atomic<int> pending{0};
+            std::mutex mutex;
+            std::vector<Job*> waiting;
+        };
+
+        struct Stats
+        {
+            unsigned int threads = 0;   // workers and the main thread
+            uint64_t jobs = 0;          // run by them
+            uint64_t steals = 0;
+            uint64_t mainJobs = 0;
+        };
+
+        static JobSystem& Get()
+        {
+            static JobSystem system;
+            return system;
+        }
+
+        // at least one worker, so jobs run in the background even on a single core
+        explicit JobSystem(unsigned int workers = std::max(std::thread::hardware_concurrency(), 2u) - 1)
+        {
+            for(unsigned int i = 0; i <= workers; i++)
+                pool.push_back(std::make_unique<Thread>());
+            current = this;
+            currentIndex = 0;
+            mainThread = std::this_thread::get_id();
+            for(unsigned int i = 1; i <= workers; i++)
+                pool[i]->thread = std::thread([this, i]() { Work(i); });
+        }
+
+        ~JobSystem()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto& thread : pool)
+            {
+                if(thread->thread.joinable())
+                    thread->thread.join();
+            }
+            if(current == this)
+                current = nullptr;
+        }
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        // queues function, counted in counter if given, and only started once dependency is done
+        void Run(std::function<void()> function, Counter* counter = nullptr, Counter* dependency = nullptr)
+        {
+            auto job = new Job{std::move(function), counter};
+            if(counter)
+                counter->pending.fetch_add(1, std::memory_order_relaxed);
+            if(dependency)
+            {
+                std::lock_guard<std::mutex> lock(dependency->mutex);
+                if(!dependency->Done())
+                {
+                    dependency->waiting.push_back(job);
+                    return;
+                }
+            }
+            Submit(job);
+        }
+
+        // runs jobs until the counter is done, main thread jobs too when called on it. The counter can be destroyed after
+        void Wait(Counter& counter)
+        {
+            int self = ThreadIndex();
+            bool main = IsMainThread();
+            while(!counter.Done())
+            {
+                if(main)
+                    RunMainJobs();
+                if(auto job = Find(self))
+                    Execute(job, self);
+                else
+                    std::this_thread::yield();
+            }
+            std::lock_guard<std::mutex> lock(counter.mutex);
+        }
+
+        // queues GL work for the main thread
+        void RunOnMain(std::function<void()> function, Counter* counter = nullptr)
+        {
+            if(counter)
+                counter->pending.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(mainMutex);
+            mainJobs.push_back(new Job{std::move(function), counter});
+        }
+
+        // runs what was queued for the main thread, call it there once a frame
+        void RunMainJobs()
+        {
+            std::vector<Job*> jobs;
+            {
+                std::lock_guard<std::mutex> lock(mainMutex);
+                jobs.swap(mainJobs);
+            }
+            for(auto job : jobs)
+            {
+                job->function();
+                Finish(job);
+            }
+            mainJobCount.fetch_add(jobs.size(), std::memory_order_relaxed);
+        }
+
+        // Calls function(i) for every i in [begin, end) on up to threads threads, the calling one included. Indices are
+        // handed out one at a time, so uneven work balances itself
+        template<typename Function>
+        void ParallelFor(int begin, int end, Function function, unsigned int threads = std::thread::hardware_concurrency())
+        {
+            threads = std::min({std::max(threads, 1u), (unsigned int)std::max(end - begin, 1), GetThreadCount()});
+            if(threads == 1)
+            {
+                for(int i = begin; i < end; i++)
+                    function(i);
+                return;
+            }
+
+            std::atomic<int> next{begin};
+            auto worker = [&]()
+            {
+                for(int i = next++; i < end; i = next++)
+                    function(i);
+            };
+            Counter counter;
+            for(unsigned int i = 1; i < threads; i++)
+                Run(worker, &counter);
+            worker();
+            Wait(counter);
+        }
+
+        unsigned int GetThreadCount() const
+        {
+            return pool.size();
+        }
+
+        // moves the main thread jobs to the calling thread, for when the GL context does
+        void SetMainThread()
+        {
+            mainThread = std::this_thread::get_id();
+        }
+
+        bool IsMainThread() const
+        {
+            return std::this_thread::get_id() == mainThread.load();
+        }
+
+        Stats GetStats() const
+        {
+            Stats stats;
+            stats.threads = pool.size();
+            for(auto& thread : pool)
+            {
+                stats.jobs += thread->jobs.load(std::memory_order_relaxed);
+                stats.steals += thread->steals.load(std::memory_order_relaxed);
+            }
+            stats.mainJobs = mainJobCount.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        struct Job
+        {
+            std::function<void()> function;
+            Counter* counter;
+        };
+
+        // Chase Lev deque of fixed size, only the owner pushes and pops
+        class Deque
+        {
+        public:
+            static constexpr int64_t CAPACITY = 4096;
+
+            // false when full
+            bool Push(Job* job)
+            {
+                int64_t b = bottom.load(std::memory_order_relaxed);
+                int64_t t = top.load(std::memory_order_acquire);
+                if(b - t >= CAPACITY)
+                    return false;
+                buffer[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_release);
+                return true;
+            }
+
+            Job* Pop()
+            {
+                int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int64_t t = top.load(std::memory_order_relaxed);
+                Job* job = nullptr;
+                if(t <= b)
+                {
+                    job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+                    // the last one, thieves may be after it too
+                    if(t == b)
+                    {
+                        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                            job = nullptr;
+                        bottom.store(b + 1, std::memory_order_relaxed);
+                    }
+                }
+                else
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                return job;
+            }
+
+            // null when empty or when another thread got there first
+            Job* Steal()
+            {
+                int64_t t = top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                int64_t b = bottom.load(std::memory_order_acquire);
+                if(t >= b)
+                    return nullptr;
+                Job* job = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return nullptr;
+                return job;
+            }
+
+        private:
+            // apart, the owner writes bottom and thieves top
+            alignas(64) std::atomic<int64_t> top{0};
+            alignas(64) std::atomic<int64_t> bottom{0};
+            std::array<std::atomic<Job*>, CAPACITY> buffer;
+        };
+
+        struct Thread
+        {
+            Deque deque;
+            std::thread thread;
+            alignas(64) std::atomic<uint64_t> jobs{0};
+            std::atomic<uint64_t> steals{0};
+        };
+
+        // index of the calling thread here, -1 for threads the system didn't start
+        int ThreadIndex() const
+        {
+            return current == this ? currentIndex : -1;
+        }
+
+        void Submit(Job* job)
+        {
+            int self = ThreadIndex();
+            if(self < 0 || !pool[self]->deque.Push(job))
+            {
+                std::lock_guard<std::mutex> lock(sharedMutex);
+                shared.push_back(job);
+            }
+            queued.fetch_add(1);
+            if(sleeping.load() > 0)
+            {
+                // taking the lock makes sure a worker about to sleep either sees the job or gets the notify
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                wake.notify_one();
+            }
+        }
+
+        // own deque first, then the shared queue, then the others, starting past self so thieves spread out
+        Job* Find(int self)
+        {
+            Job* job = self >= 0 ? pool[self]->deque.Pop() : nullptr;
+            if(!job && queued.load(std::memory_order_relaxed) > 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sharedMutex);
+                    if(!shared.empty())
+                    {
+                        job = shared.front();
+                        shared.pop_front();
+                    }
+                }
+                int count = pool.size();
+                for(int i = 1; !job && i <= count; i++)
+                {
+                    int victim = (std::max(self, 0) + i) % count;
+                    if(victim == self)
+                        continue;
+                    job = pool[victim]->deque.Steal();
+                    if(job && self >= 0)
+                        pool[self]->steals.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if(job)
+                queued.fetch_sub(1);
+            return job;
+        }
+
+        void Execute(Job* job, int self)
+        {
+            job->function();
+            if(self >= 0)
+                pool[self]->jobs.fetch_add(1, std::memory_order_relaxed);
+            Finish(job);
+        }
+
+        // Drops the job's counter, releasing the jobs that waited on it when it reaches zero. The last drop happens under
+        // the counter lock, so once Wait got the lock after it, nothing touches the counter anymore
+        void Finish(Job* job)
+        {
+            auto counter = job->counter;
+            delete job;
+            if(!counter)
+                return;
+            int pending = counter->pending.load(std::memory_order_relaxed);
+            while(pending > 1 && !counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+            }
+            if(pending > 1)
+                return;
+
+            std::vector<Job*> released;
+            {
+                std::lock_guard<std::mutex> lock(counter->mutex);
+                if(counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    released.swap(counter->waiting);
+            }
+            for(auto waiting : released)
+                Submit(waiting);
+        }
+
+        void Work(int self)
+        {
+            current = this;
+            currentIndex = self;
+            while(true)
+            {
+                if(auto job = Find(self))
+                {
+                    Execute(job, self);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                sleeping.fetch_add(1);
+                wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+                sleeping.fetch_sub(1);
+                if(stopping)
+                    break;
+            }
+        }
+
+        static inline thread_local const JobSystem* current = nullptr;
+        static inline thread_local int currentIndex = -1;
+
+        std::vector<std::unique_ptr<Thread>> pool;
+
+        std::mutex sharedMutex;
+        std::deque<Job*> shared;
+
+        // jobs in deques or the shared queue, workers sleep while there are none
+        std::atomic<int> queued{0};
+        std::atomic<int> sleeping{0};
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        std::atomic<std::thread::id> mainThread;
+        std::mutex mainMutex;
+        std::vector<Job*> mainJobs;
+        std::atomic<uint64_t> mainJobCount{0};
+    };
+}
+#endif
@@ -0,0 +1,426 @@
+
+
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <Culling.h>
+#include <Frustum.h>
+#include <Parallel.h>
+#include <Shader.h>
+#include <StreamBuffer.h>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERS_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    struct PointLight
+    {
+        glm::vec3 pos{0.0f};
+        glm::vec3 diffuse{0.0f};
+        glm::vec3 specular{0.0f};
+        float constant = 1.0f;
+        float linear = 0.0f;
+        float quadratic = 0.0f;
+        float radius = 1.0f;    // no light at all past it
+        int shadowId = -1;      // stable key of the light in PointShadows, -1 for no shadows
+        int shadow = -1;        // its slot in PointShadows, set by PointShadows::Allocate
+    };
+
+    // Distance at which the brightest channel of the light falls under threshold, with the attenuation of lighting.glsl.
+    // Without any falloff that never happens
+    inline float LightRange(const PointLight& light, float threshold)
+    {
+        auto color = glm::max(light.diffuse, light.specular);
+        float peak = glm::max(color.r, glm::max(color.g, color.b));
+        // quadratic * d² + linear * d + c = 0
+        float c = light.constant - peak / threshold;
+        if(c >= 0.0f)
+            return 0.0f;
+        if(light.quadratic > 0.0f)
+            return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+        if(light.linear > 0.0f)
+            return -c / light.linear;
+        return std::numeric_limits<float>::infinity();
+    }
+
+    // Clustered forward shading. The view frustum is split into SIZE_X * SIZE_Y tiles on screen and SIZE_Z exponential depth slices.
+    // Every frame the lights are assigned to the clusters their sphere touches, on the CPU, and the fragment shader only loops
+    // over the lights of its own cluster. Three texture buffers feed the shader:
+    //  lights:  4 RGBA32F texels per light: pos and radius, diffuse, specular, attenuation and shadow
+    //  grid:    one RG32UI texel per cluster: offset into indices and light count
+    //  indices: R32UI light indices, cluster after cluster
+    class LightClusters
+    {
+    public:
+        static constexpr int SIZE_X = 16;
+        static constexpr int SIZE_Y = 9;
+        static constexpr int SIZE_Z = 24;
+        static constexpr int COUNT = SIZE_X * SIZE_Y * SIZE_Z;
+        static constexpr int TEXELS_PER_LIGHT = 4;
+
+        struct Stats
+        {
+            unsigned int lights = 0;
+            unsigned int culled = 0;        // outside the frustum, by the last Cull
+            unsigned int indices = 0;       // sum of the light count of every cluster
+            unsigned int maxPerCluster = 0;
+            unsigned int dropped = 0;       // indices over the texture buffer size limit
+            float assignMs = 0.0f;
+        };
+
+        LightClusters()
+        {
+            glGenBuffers(3, buffers.data());
+            glGenTextures(3, textures.data());
+            for(int i = 0; i < 3; i++)
+            {
+                glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+                glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+            GLint maxTexels;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+            maxIndices = maxTexels;
+        }
+
+        ~LightClusters()
+        {
+            glDeleteTextures(3, textures.data());
+            glDeleteBuffers(3, buffers.data());
+        }
+
+        LightClusters(const LightClusters&) = delete;
+        LightClusters& operator=(const LightClusters&) = delete;
+
+        // fovY in radians. Cluster bounds are only rebuilt when something changed
+        void SetProjection(float fovY, float aspect, float nearPlane, float farPlane)
+        {
+            if(fovY == this->fovY && aspect == this->aspect && nearPlane == this->nearPlane && farPlane == this->farPlane)
+                return;
+            this->fovY = fovY;
+            this->aspect = aspect;
+            this->nearPlane = nearPlane;
+            this->farPlane = farPlane;
+
+            // view space bounds, with depth as a positive distance along -Z
+            float tanY = std::tan(fovY / 2.0f);
+            float tanX = tanY * aspect;
+            for(int z = 0; z < SIZE_Z; z++)
+            {
+                float d0 = SliceDepth(z);
+                float d1 = SliceDepth(z + 1);
+                for(int y = 0; y < SIZE_Y; y++)
+                {
+                    float y0 = -1.0f + 2.0f * y / SIZE_Y, y1 = -1.0f + 2.0f * (y + 1) / SIZE_Y;
+                    for(int x = 0; x < SIZE_X; x++)
+                    {
+                        float x0 = -1.0f + 2.0f * x / SIZE_X, x1 = -1.0f + 2.0f * (x + 1) / SIZE_X;
+                        auto& bounds = clusterBounds[Index(x, y, z)];
+                        bounds.min = glm::vec3(std::min(x0 * d0, x0 * d1) * tanX, std::min(y0 * d0, y0 * d1) * tanY, d0);
+                        bounds.max = glm::vec3(std::max(x1 * d0, x1 * d1) * tanX, std::max(y1 * d0, y1 * d1) * tanY, d1);
+                    }
+                }
+            }
+        }
+
+        // Drops the lights whose sphere misses the frustum, keeping the order of the others. Call before anything else uses
+        // the frame lights, a light out of view lights nothing on screen
+        void Cull(std::vector<PointLight>& lights, const Frustum& frustum)
+        {
+            spheres.Clear();
+            for(auto& light : lights)
+                spheres.Push(light.pos, light.radius);
+            culler.Cull(frustum, spheres, visible);
+
+            culled = lights.size() - visible.size();
+            for(size_t i = 0; i < visible.size(); i++)
+                lights[i] = lights[visible[i]];
+            lights.resize(visible.size());
+        }
+
+        // assigns the lights to the clusters and uploads everything
+        void Update(const std::vector<PointLight>& lights, const glm::mat4& view)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            // view space, structure of arrays padded to 4 lights with some that can't touch anything
+            size_t padded = (lights.size() + 3) & ~(size_t)3;
+            lightX.assign(padded, 1e18f);
+            lightY.assign(padded, 1e18f);
+            lightZ.assign(padded, 1e18f);
+            lightRadius.assign(padded, 0.0f);
+            for(size_t i = 0; i < lights.size(); i++)
+            {
+                auto pos = view * glm::vec4(lights[i].pos, 1.0f);
+                lightX[i] = pos.x;
+                lightY[i] = pos.y;
+                lightZ[i] = -pos.z;
+                lightRadius[i] = lights[i].radius;
+            }
+
+            ParallelFor(0, SIZE_Z, [&](int z)
+            {
+                AssignSlice(z);
+            });
+
+            // slices to one list
+            stats = Stats{};
+            stats.lights = lights.size();
+            stats.culled = culled;
+            grid.resize(COUNT * 2);
+            indices.clear();
+            for(int z = 0; z < SIZE_Z; z++)
+            {
+                auto& slice = slices[z];
+                uint32_t base = indices.size();
+                for(int i = 0; i < SIZE_X * SIZE_Y; i++)
+                {
+                    auto cluster = z * SIZE_X * SIZE_Y + i;
+                    uint32_t offset = base + slice.offsets[i];
+                    uint32_t count = slice.counts[i];
+                    if(offset + count > maxIndices)
+                    {
+                        auto kept = offset < maxIndices ? maxIndices - offset : 0;
+                        stats.dropped += count - kept;
+                        count = kept;
+                    }
+                    grid[cluster * 2] = offset;
+                    grid[cluster * 2 + 1] = count;
+                    stats.maxPerCluster = std::max(stats.maxPerCluster, count);
+                }
+                indices.insert(indices.end(), slice.indices.begin(), slice.indices.end());
+            }
+            if(indices.size() > maxIndices)
+                indices.resize(maxIndices);
+            stats.indices = indices.size();
+
+            lightTexels.resize(std::max<size_t>(lights.size(), 1) * TEXELS_PER_LIGHT);
+            for(size_t i = 0; i < lights.size(); i++)
+            {
+                auto& light = lights[i];
+                auto texels = &lightTexels[i * TEXELS_PER_LIGHT];
+                texels[0] = glm::vec4(light.pos, light.radius);
+                texels[1] = glm::vec4(light.diffuse, 0.0f);
+                texels[2] = glm::vec4(light.specular, 0.0f);
+                texels[3] = glm::vec4(light.constant, light.linear, light.quadratic, (float)light.shadow);
+            }
+
+            Upload(0, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+            Upload(1, grid.data(), grid.size() * sizeof(uint32_t));
+            Upload(2, indices.data(), std::max<size_t>(indices.size(), 1) * sizeof(uint32_t));
+            stats.assignMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // screen size is the viewport the clusters are laid over
+        void SetUniforms(Shader& shader, int lightsUnit, int gridUnit, int indicesUnit, int screenWidth, int screenHeight) const
+        {
+            shader.use();
+            shader.setInt("clusters.lights", lightsUnit);
+            shader.setInt("clusters.grid", gridUnit);
+            shader.setInt("clusters.indices", indicesUnit);
+            glUniform3ui(glGetUniformLocation(shader.ID, "clusters.size"), SIZE_X, SIZE_Y, SIZE_Z);
+            glUniform2f(glGetUniformLocation(shader.ID, "clusters.tileScale"), (float)SIZE_X / screenWidth, (float)SIZE_Y / screenHeight);
+            // slice = log(depth) * scale + bias
+            float scale = SIZE_Z / std::log(farPlane / nearPlane);
+            glUniform2f(glGetUniformLocation(shader.ID, "clusters.sliceScaleBias"), scale, -std::log(nearPlane) * scale);
+        }
+
+        // where the texture buffers are written every frame, as ranges of it, nullptr for buffers of their own
+        void SetStreamBuffer(StreamBuffer* stream)
+        {
+            this->stream = stream;
+            if(stream)
+            {
+                // the query needs 4.3, which persistent mapping implies
+                GLint alignment = 16;
+                glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+                offsetAlignment = alignment;
+            }
+            else
+            {
+                for(int i = 0; i < 3; i++)
+                    Attach(i, buffers[i], 0, 0);
+            }
+        }
+
+        void Bind(int lightsUnit, int gridUnit, int indicesUnit) const
+        {
+            const int units[3] = {lightsUnit, gridUnit, indicesUnit};
+            for(int i = 0; i < 3; i++)
+            {
+                glActiveTexture(GL_TEXTURE0 + units[i]);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            }
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        struct Bounds
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+
+        // lights of one depth slice, clusters in row order
+        struct Slice
+        {
+            std::array<uint32_t, SIZE_X * SIZE_Y> offsets;
+            std::array<uint32_t, SIZE_X * SIZE_Y> counts;
+            std::vector<uint32_t> indices;
+            // lights touching the slice depth range, padded to 4
+            std::vector<uint32_t> candidates;
+            std::vector<float> x, y, z, radius;
+        };
+
+        static int Index(int x, int y, int z)
+        {
+            return (z * SIZE_Y + y) * SIZE_X + x;
+        }
+
+        float SliceDepth(int z) const
+        {
+            return nearPlane * std::pow(farPlane / nearPlane, (float)z / SIZE_Z);
+        }
+
+        void AssignSlice(int z)
+        {
+            auto& slice = slices[z];
+            slice.indices.clear();
+            slice.candidates.clear();
+
+            // first only keep the lights in the depth range of the slice, the clusters then test far fewer
+            float d0 = SliceDepth(z), d1 = SliceDepth(z + 1);
+            for(size_t i = 0; i < lightZ.size(); i++)
+                if(lightZ[i] + lightRadius[i] >= d0 && lightZ[i] - lightRadius[i] <= d1)
+                    slice.candidates.push_back(i);
+
+            size_t padded = (slice.candidates.size() + 3) & ~(size_t)3;
+            slice.x.assign(padded, 1e18f);
+            slice.y.assign(padded, 1e18f);
+            slice.z.assign(padded, 1e18f);
+            slice.radius.assign(padded, 0.0f);
+            for(size_t i = 0; i < slice.candidates.size(); i++)
+            {
+                auto light = slice.candidates[i];
+                slice.x[i] = lightX[light];
+                slice.y[i] = lightY[light];
+                slice.z[i] = lightZ[light];
+                slice.radius[i] = lightRadius[light];
+            }
+
+            for(int i = 0; i < SIZE_X * SIZE_Y; i++)
+            {
+                slice.offsets[i] = slice.indices.size();
+                auto& bounds = clusterBounds[z * SIZE_X * SIZE_Y + i];
+                AssignCluster(slice, bounds);
+                slice.counts[i] = slice.indices.size() - slice.offsets[i];
+            }
+        }
+
+        // sphere against box: squared distance from the center to the box under the squared radius
+        static void AssignCluster(Slice& slice, const Bounds& bounds)
+        {
+            size_t count = slice.x.size();
+            size_t i = 0;
+#ifdef CLUSTERS_SSE
+            const __m128 minX = _mm_set1_ps(bounds.min.x), maxX = _mm_set1_ps(bounds.max.x);
+            const __m128 minY = _mm_set1_ps(bounds.min.y), maxY = _mm_set1_ps(bounds.max.y);
+            const __m128 minZ = _mm_set1_ps(bounds.min.z), maxZ = _mm_set1_ps(bounds.max.z);
+            const __m128 zero = _mm_setzero_ps();
+            for(; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(&slice.x[i]);
+                __m128 y = _mm_loadu_ps(&slice.y[i]);
+                __m128 z = _mm_loadu_ps(&slice.z[i]);
+                __m128 r = _mm_loadu_ps(&slice.radius[i]);
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+                __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, _mm_mul_ps(r, r)));
+                for(int lane = 0; mask; lane++, mask >>= 1)
+                    if(mask & 1)
+                        slice.indices.push_back(slice.candidates[i + lane]);
+            }
+#endif
+            for(; i < count; i++)
+            {
+                glm::vec3 center{slice.x[i], slice.y[i], slice.z[i]};
+                auto d = glm::max(glm::max(bounds.min - center, center - bounds.max), glm::vec3(0.0f));
+                if(glm::dot(d, d) <= slice.radius[i] * slice.radius[i])
+                    slice.indices.push_back(slice.candidates[i]);
+            }
+        }
+
+        void Upload(int buffer, const void* data, size_t bytes)
+        {
+            if(stream)
+            {
+                auto allocation = stream->Allocate(bytes, offsetAlignment);
+                std::memcpy(allocation.data, data, bytes);
+                Attach(buffer, allocation.buffer, allocation.offset, allocation.size);
+                return;
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+            glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+
+        // points a texture at a range of source, or all of it for size 0, keeping the bound buffer texture
+        void Attach(int texture, unsigned int source, size_t offset, size_t size)
+        {
+            GLint bound;
+            glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &bound);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[texture]);
+            if(size)
+                glTexBufferRange(GL_TEXTURE_BUFFER, formats[texture], source, offset, size);
+            else
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[texture], source);
+            glBindTexture(GL_TEXTURE_BUFFER, bound);
+        }
+
+        float fovY = 0.0f, aspect = 0.0f, nearPlane = 0.0f, farPlane = 0.0f;
+        std::array<Bounds, COUNT> clusterBounds;
+        std::array<Slice, SIZE_Z> slices;
+        std::vector<float> lightX, lightY, lightZ, lightRadius;
+        SphereBounds spheres;
+        FrustumCuller culler;
+        std::vector<uint32_t> visible;
+        unsigned int culled = 0;
+
+        std::vector<glm::vec4> lightTexels;
+        std::vector<uint32_t> grid;
+        std::vector<uint32_t> indices;
+        uint32_t maxIndices = 0;
+
+        static constexpr GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        std::array<unsigned int, 3> buffers;
+        std::array<unsigned int, 3> textures;
+        StreamBuffer* stream = nullptr;
+        size_t offsetAlignment = 16;
+        Stats stats;
+    };
+}
+#endif
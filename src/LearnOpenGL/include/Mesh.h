@@ -9,6 +9,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <Shader.h>
+#include <TextureResidency.h>
+#include <TriangleBvh.h>
 
 #include <string>
 #include <vector>
@@ -41,14 +43,25 @@ namespace LearnOpenGL
         std::vector<Vertex>       vertices;
         std::vector<unsigned int> indices;
         std::vector<Texture>      textures;
+        // triangles for ray casting, in mesh space
+        TriangleBvh               bvh;
         unsigned int VAO;
 
-        // constructor
-        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+        // constructor, builds the bvh unless a cached one is given
+        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, TriangleBvh bvh = {})
         {
             this->vertices = vertices;
             this->indices = indices;
             this->textures = textures;
+            this->bvh = std::move(bvh);
+            if(this->bvh.Empty())
+            {
+                std::vector<glm::vec3> positions;
+                positions.reserve(vertices.size());
+                for(auto& vertex : vertices)
+                    positions.push_back(vertex.Position);
+                this->bvh.Build(positions, indices);
+            }
 
             // now that we have all the required data, set the vertex buffers and its attribute pointers.
             setupMesh();
@@ -81,6 +94,7 @@ namespace LearnOpenGL
                 glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
                 // and finally bind the texture
                 glBindTexture(GL_TEXTURE_2D, textures[i].id);
+                TextureResidency::Get().Touch(textures[i].id);
             }
             
             // draw mesh
@@ -92,6 +106,12 @@ namespace LearnOpenGL
             glActiveTexture(GL_TEXTURE0);
         }
 
+        // closest triangle along a ray in mesh space
+        TriangleBvh::Hit Raycast(glm::vec3 origin, glm::vec3 dir, float maxDistance = std::numeric_limits<float>::infinity()) const
+        {
+            return bvh.Raycast(origin, dir, maxDistance);
+        }
+
     private:
         // render data 
         unsigned int VBO, EBO;
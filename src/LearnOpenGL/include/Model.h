@@ -9,12 +9,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include <Mesh.h>
 #include <Shader.h>
+#include <TextureFile.h>
+#include <TextureResidency.h>
+#include <TriangleBvh.h>
 
 #include <string>
 #include <fstream>
@@ -36,9 +40,11 @@ namespace LearnOpenGL
         std::vector<Mesh>    meshes;
         std::string directory;
         bool gammaCorrection;
+        // where the mesh bvhs are cached, built on every load when empty
+        std::filesystem::path bvhCache;
 
         // constructor, expects a filepath to a 3D model.
-        Model(std::string const &path, bool gamma = false) : gammaCorrection(gamma)
+        Model(std::string const &path, bool gamma = false, std::filesystem::path bvhCache = {}) : gammaCorrection(gamma), bvhCache(bvhCache)
         {
             loadModel(path);
         }
@@ -49,8 +55,44 @@ namespace LearnOpenGL
             for(unsigned int i = 0; i < meshes.size(); i++)
                 meshes[i].Draw(shader);
         }
+
+        // closest hit over all meshes along a ray in model space, mesh is NONE on a miss
+        struct Hit
+        {
+            uint32_t mesh = TriangleBvh::NONE;
+            TriangleBvh::Hit triangle;
+        };
+
+        Hit Raycast(glm::vec3 origin, glm::vec3 dir, float maxDistance = std::numeric_limits<float>::infinity()) const
+        {
+            Hit hit;
+            for(uint32_t i = 0; i < meshes.size(); i++)
+            {
+                auto triangle = meshes[i].Raycast(origin, dir, maxDistance);
+                if(triangle.triangle != TriangleBvh::NONE)
+                {
+                    hit = {i, triangle};
+                    maxDistance = triangle.distance;
+                }
+            }
+            return hit;
+        }
+
+        // line of sight between two points in model space
+        bool Occluded(glm::vec3 from, glm::vec3 to) const
+        {
+            for(auto& mesh : meshes)
+            {
+                if(mesh.bvh.Occluded(from, to))
+                    return true;
+            }
+            return false;
+        }
         
     private:
+        // path of the model file, the cached bvhs are checked against it
+        std::string path;
+
         // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
         void loadModel(std::string const &path)
         {
@@ -65,6 +107,7 @@ namespace LearnOpenGL
             }
             // retrieve the directory path of the filepath
             directory = path.substr(0, path.find_last_of('/'));
+            this->path = path;
 
             // process ASSIMP's root node recursively
             processNode(scene->mRootNode, scene);
@@ -169,8 +212,21 @@ namespace LearnOpenGL
             std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
             textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
             
+            // the bvh from the cache when it's newer than the model, built by the mesh and saved otherwise
+            TriangleBvh bvh;
+            std::filesystem::path cached;
+            bool loaded = false;
+            if(!bvhCache.empty())
+            {
+                cached = bvhCache / (std::filesystem::path(path).stem().string() + "_" + std::to_string(meshes.size()) + ".bvh");
+                loaded = !NeedsBake(cached, {path}) && bvh.Load(cached);
+            }
+
             // return a mesh object created from the extracted mesh data
-            return Mesh(vertices, indices, textures);
+            Mesh result(vertices, indices, textures, std::move(bvh));
+            if(!cached.empty() && !loaded)
+                result.bvh.Save(cached);
+            return result;
         }
 
         // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -208,6 +264,35 @@ namespace LearnOpenGL
     };
 
 
+    // uploads the image at filename into the currently bound GL_TEXTURE_2D, with a full mip chain
+    bool UploadTextureFromFile(const std::string &filename, int* width = nullptr, int* height = nullptr, GLenum* format = nullptr)
+    {
+        int w, h, nrComponents;
+        unsigned char *data = stbi_load(filename.c_str(), &w, &h, &nrComponents, 0);
+        if (!data)
+            return false;
+
+        GLenum dataFormat = GL_RGBA;
+        if (nrComponents == 1)
+            dataFormat = GL_RED;
+        else if (nrComponents == 3)
+            dataFormat = GL_RGB;
+        else if (nrComponents == 4)
+            dataFormat = GL_RGBA;
+
+        glTexImage2D(GL_TEXTURE_2D, 0, dataFormat, w, h, 0, dataFormat, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        stbi_image_free(data);
+
+        if(width)
+            *width = w;
+        if(height)
+            *height = h;
+        if(format)
+            *format = dataFormat;
+        return true;
+    }
+
     unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma)
     {
         std::string filename = std::string(path);
@@ -215,34 +300,26 @@ namespace LearnOpenGL
 
         unsigned int textureID;
         glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
 
-        int width, height, nrComponents;
-        unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        int width, height;
+        GLenum format;
+        if (UploadTextureFromFile(filename, &width, &height, &format))
         {
-            GLenum format;
-            if (nrComponents == 1)
-                format = GL_RED;
-            else if (nrComponents == 3)
-                format = GL_RGB;
-            else if (nrComponents == 4)
-                format = GL_RGBA;
-
-            glBindTexture(GL_TEXTURE_2D, textureID);
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-            stbi_image_free(data);
+            // track its memory, reloading goes back to disk
+            TextureResidency::Get().Register(textureID, width, height, format, [filename]()
+            {
+                return UploadTextureFromFile(filename);
+            });
         }
         else
         {
             std::cout << "Texture failed to load at path: " << path << std::endl;
-            stbi_image_free(data);
         }
 
         return textureID;
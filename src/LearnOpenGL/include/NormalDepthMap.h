@@ -0,0 +1,66 @@
+
+
+#ifndef NORMAL_DEPTH_MAP_H
+#define NORMAL_DEPTH_MAP_H
+
+#include <ConeStepMap.h>
+#include <TextureFile.h>
+
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Packs a tangent space normal map and a depth map into a single RGBA8 texture.
+    // rg: normal xy (z is rebuilt in the shader), b: depth, a: square root of the relaxed cone ratio
+    inline bool PackNormalDepth(const Image& normal, const Image& depth, TextureFile& packed)
+    {
+        if(normal.width != depth.width || normal.height != depth.height)
+        {
+            std::cout << "Error: normal map is " << normal.width << "x" << normal.height << " but depth map is " << depth.width << "x" << depth.height << '\n';
+            return false;
+        }
+
+        packed.format = TextureFile::Format::RGBA8;
+        packed.width = normal.width;
+        packed.height = normal.height;
+        packed.faces = 1;
+        packed.levels = 1;
+        packed.data.assign(1, std::vector<unsigned char>(normal.width * normal.height * 4));
+
+        std::vector<float> depths(depth.width * depth.height);
+        for(size_t i = 0; i < depths.size(); i++)
+            depths[i] = depth.pixels[i * depth.channels] / 255.0f;
+        auto cones = ConeStepMap::Bake(depths, depth.width, depth.height);
+
+        auto& pixels = packed.Level(0, 0);
+        for(int y = 0; y < normal.height; y++)
+        {
+            for(int x = 0; x < normal.width; x++)
+            {
+                auto n = normal.At(x, y);
+                auto d = depth.At(x, y);
+                auto p = &pixels[(y * normal.width + x) * 4];
+                p[0] = n[0];
+                p[1] = n[1];
+                p[2] = d[0];
+                // the square root gives more precision to the narrow cones
+                p[3] = (unsigned char)std::round(std::sqrt(cones[y * normal.width + x]) * 255.0f);
+            }
+        }
+        return true;
+    }
+
+    inline bool BakeNormalDepth(const std::filesystem::path& normalPath, const std::filesystem::path& depthPath, const std::filesystem::path& outPath)
+    {
+        Image normal, depth;
+        if(!LoadImage(normalPath, normal, 3) || !LoadImage(depthPath, depth, 1))
+            return false;
+
+        TextureFile packed;
+        return PackNormalDepth(normal, depth, packed) && packed.Save(outPath);
+    }
+}
+#endif
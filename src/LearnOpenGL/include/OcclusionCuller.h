@@ -0,0 +1,303 @@
+
+
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <Culling.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_CULLER_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    // Software occlusion culling, on the CPU only. A few large occluders are rasterized into a small depth buffer, 4 pixels
+    // at a time, and a max depth pyramid is built over it: a texel of level n holds the farthest occluder depth of its
+    // 2^n x 2^n pixels. A box is hidden when its nearest point is behind every texel its screen rect touches, at the level
+    // where the rect spans 2 or 3 texels.
+    //
+    // Depth is window depth, 0 at the near plane and 1 at the far one, the buffer is cleared to 1. Occluders are sampled at
+    // pixel centers, boxes are tested a pixel wider to make up for it
+    class OcclusionCuller
+    {
+    public:
+        struct Stats
+        {
+            size_t occluderTriangles = 0;
+            size_t tested = 0;
+            size_t occluded = 0;
+            float rasterMs = 0.0f;
+            float testMs = 0.0f;
+        };
+
+        // the width is rounded up to a multiple of 4
+        OcclusionCuller(int width = 256, int height = 192) : width((width + 3) & ~3), height(height)
+        {
+            for(int w = this->width, h = height; ; w = (w + 1) / 2, h = (h + 1) / 2)
+            {
+                levels.push_back({w, h, std::vector<float>(w * h, 1.0f)});
+                if(w == 1 && h == 1)
+                    break;
+            }
+        }
+
+        // clears the depth for a new frame seen through viewProjection
+        void Begin(const glm::mat4& viewProjection)
+        {
+            this->viewProjection = viewProjection;
+            std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+            stats = {};
+        }
+
+        // rasterizes a triangle list, both windings, placed by model
+        void AddOccluder(const std::vector<glm::vec3>& triangles, const glm::mat4& model)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto transform = viewProjection * model;
+            for(size_t i = 0; i + 2 < triangles.size(); i += 3)
+            {
+                glm::vec4 clip[3];
+                for(int v = 0; v < 3; v++)
+                    clip[v] = transform * glm::vec4(triangles[i + v], 1.0f);
+                RasterizeClipped(clip);
+                stats.occluderTriangles++;
+            }
+            stats.rasterMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // builds the pyramid, call once the occluders are in and before testing
+        void BuildHierarchy()
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(size_t level = 1; level < levels.size(); level++)
+            {
+                auto& src = levels[level - 1];
+                auto& dst = levels[level];
+                for(int y = 0; y < dst.height; y++)
+                {
+                    int y0 = y * 2;
+                    int y1 = std::min(y0 + 1, src.height - 1);
+                    for(int x = 0; x < dst.width; x++)
+                    {
+                        int x0 = x * 2;
+                        int x1 = std::min(x0 + 1, src.width - 1);
+                        dst.depth[y * dst.width + x] = std::max(std::max(src.At(x0, y0), src.At(x1, y0)), std::max(src.At(x0, y1), src.At(x1, y1)));
+                    }
+                }
+            }
+            stats.rasterMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // false when the box is hidden behind the occluders or off screen
+        bool IsVisible(glm::vec3 min, glm::vec3 max) const
+        {
+            // the corners are the min corner plus the matrix columns scaled by the size
+            auto size = max - min;
+            auto base = viewProjection * glm::vec4(min, 1.0f);
+            glm::vec4 steps[3] = {viewProjection[0] * size.x, viewProjection[1] * size.y, viewProjection[2] * size.z};
+            float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+            for(int corner = 0; corner < 8; corner++)
+            {
+                auto clip = base;
+                for(int axis = 0; axis < 3; axis++)
+                    if(corner & (1 << axis))
+                        clip += steps[axis];
+                // crossing the near plane, too close to say anything
+                if(clip.z < -clip.w)
+                    return true;
+                auto window = WindowPosition(clip);
+                minX = std::min(minX, window.x);
+                maxX = std::max(maxX, window.x);
+                minY = std::min(minY, window.y);
+                maxY = std::max(maxY, window.y);
+                nearest = std::min(nearest, window.z);
+            }
+
+            // grown by a pixel: an occluder covering a pixel center may leave part of it open, the open side then
+            // has a neighbor pixel center left uncovered
+            int x0 = (int)std::max(std::floor(minX) - 1.0f, 0.0f);
+            int y0 = (int)std::max(std::floor(minY) - 1.0f, 0.0f);
+            int x1 = (int)std::min(std::floor(maxX) + 1.0f, width - 1.0f);
+            int y1 = (int)std::min(std::floor(maxY) + 1.0f, height - 1.0f);
+            if(x0 > x1 || y0 > y1)
+                return false;
+
+            // the level where the rect is at most 2 texels across, so 3 at most once aligned
+            size_t level = 0;
+            while(level + 1 < levels.size() && std::max(x1 - x0, y1 - y0) >> level >= 2)
+                level++;
+            auto& texels = levels[level];
+            for(int y = y0 >> level; y <= y1 >> level; y++)
+            {
+                for(int x = x0 >> level; x <= x1 >> level; x++)
+                {
+                    if(nearest <= texels.At(x, y))
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        // keeps the indices in visible whose box isn't hidden, in order
+        void Cull(const BoxBounds& bounds, std::vector<uint32_t>& visible)
+        {
+            auto start = std::chrono::steady_clock::now();
+            size_t kept = 0;
+            for(auto i : visible)
+            {
+                glm::vec3 center{bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]};
+                glm::vec3 extent{bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]};
+                if(IsVisible(center - extent, center + extent))
+                    visible[kept++] = i;
+            }
+            stats.tested += visible.size();
+            stats.occluded += visible.size() - kept;
+            visible.resize(kept);
+            stats.testMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // occluder depth of a pixel, 1 where nothing was drawn
+        float GetDepth(int x, int y) const
+        {
+            return levels[0].At(x, y);
+        }
+
+        int GetWidth() const
+        {
+            return width;
+        }
+
+        int GetHeight() const
+        {
+            return height;
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        struct Level
+        {
+            int width;
+            int height;
+            std::vector<float> depth;
+
+            float At(int x, int y) const
+            {
+                return depth[y * width + x];
+            }
+        };
+
+        glm::vec3 WindowPosition(const glm::vec4& clip) const
+        {
+            auto ndc = glm::vec3(clip) / clip.w;
+            return {(ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f};
+        }
+
+        // clips against the near plane, z >= -w, the other planes are left to the bounding rect
+        void RasterizeClipped(const glm::vec4* clip)
+        {
+            glm::vec4 polygon[4];
+            int count = 0;
+            for(int v = 0; v < 3; v++)
+            {
+                auto& a = clip[v];
+                auto& b = clip[(v + 1) % 3];
+                float da = a.z + a.w;
+                float db = b.z + b.w;
+                if(da >= 0.0f)
+                    polygon[count++] = a;
+                if((da >= 0.0f) != (db >= 0.0f))
+                    polygon[count++] = a + (b - a) * (da / (da - db));
+            }
+            for(int v = 1; v + 1 < count; v++)
+                Rasterize(WindowPosition(polygon[0]), WindowPosition(polygon[v]), WindowPosition(polygon[v + 1]));
+        }
+
+        // pixels whose center is inside, keeping the nearest depth
+        void Rasterize(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+        {
+            float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+            if(area == 0.0f)
+                return;
+            if(area < 0.0f)
+            {
+                std::swap(v1, v2);
+                area = -area;
+            }
+
+            // clamped as floats, vertices far off screen don't fit an int
+            int x0 = (int)std::max(std::floor(std::min({v0.x, v1.x, v2.x})), 0.0f) & ~3;
+            int y0 = (int)std::max(std::floor(std::min({v0.y, v1.y, v2.y})), 0.0f);
+            int x1 = (int)std::min(std::ceil(std::max({v0.x, v1.x, v2.x})), width - 1.0f);
+            int y1 = (int)std::min(std::ceil(std::max({v0.y, v1.y, v2.y})), height - 1.0f);
+            if(x0 > x1 || y0 > y1)
+                return;
+
+            // edge functions a * x + b * y + c, positive inside, and the depth plane
+            glm::vec3 a{v1.y - v2.y, v2.y - v0.y, v0.y - v1.y};
+            glm::vec3 b{v2.x - v1.x, v0.x - v2.x, v1.x - v0.x};
+            glm::vec3 c{v1.x * v2.y - v2.x * v1.y, v2.x * v0.y - v0.x * v2.y, v0.x * v1.y - v1.x * v0.y};
+            glm::vec3 z = glm::vec3(v0.z, v1.z, v2.z) / area;
+            float dzdx = glm::dot(a, z);
+            float dzdy = glm::dot(b, z);
+            float dz0 = glm::dot(c, z);
+
+            auto& depth = levels[0].depth;
+            for(int y = y0; y <= y1; y++)
+            {
+                float py = y + 0.5f;
+                int x = x0;
+#ifdef OCCLUSION_CULLER_SSE
+                __m128 steps = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                __m128 rowE0 = _mm_set1_ps(b.x * py + c.x);
+                __m128 rowE1 = _mm_set1_ps(b.y * py + c.y);
+                __m128 rowE2 = _mm_set1_ps(b.z * py + c.z);
+                __m128 rowZ = _mm_set1_ps(dzdy * py + dz0);
+                __m128 a0 = _mm_set1_ps(a.x), a1 = _mm_set1_ps(a.y), a2 = _mm_set1_ps(a.z), dx = _mm_set1_ps(dzdx);
+                for(; x + 4 <= width && x <= x1; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), steps);
+                    __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), rowE0);
+                    __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), rowE1);
+                    __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), rowE2);
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, _mm_setzero_ps()), _mm_cmpge_ps(e1, _mm_setzero_ps())), _mm_cmpge_ps(e2, _mm_setzero_ps()));
+                    if(!_mm_movemask_ps(inside))
+                        continue;
+                    __m128 pz = _mm_add_ps(_mm_mul_ps(dx, px), rowZ);
+                    float* row = &depth[y * width + x];
+                    __m128 old = _mm_loadu_ps(row);
+                    __m128 nearer = _mm_min_ps(old, pz);
+                    _mm_storeu_ps(row, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+#endif
+                for(; x <= x1; x++)
+                {
+                    float px = x + 0.5f;
+                    if(a.x * px + b.x * py + c.x < 0.0f || a.y * px + b.y * py + c.y < 0.0f || a.z * px + b.z * py + c.z < 0.0f)
+                        continue;
+                    float& d = depth[y * width + x];
+                    d = std::min(d, dzdx * px + dzdy * py + dz0);
+                }
+            }
+        }
+
+        int width;
+        int height;
+        glm::mat4 viewProjection{1.0f};
+        std::vector<Level> levels;
+        Stats stats;
+    };
+}
+#endif
@@ -0,0 +1,20 @@
+
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <JobSystem.h>
+
+#include <thread>
+
+namespace LearnOpenGL
+{
+    // Calls function(i) for every i in [begin, end), spread over up to threads threads of the job system, the calling one
+    // included. Indices are handed out one at a time, so uneven work like bake rows balances itself
+    template<typename Function>
+    void ParallelFor(int begin, int end, Function function, unsigned int threads = std::thread::hardware_concurrency())
+    {
+        JobSystem::Get().ParallelFor(begin, end, function, threads);
+    }
+}
+#endif
@@ -0,0 +1,581 @@
+
+
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <AtlasAllocator.h>
+#include <GLExtensions.h>
+#include <LightClusters.h>
+#include <RenderQueue.h>
+#include <Shader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Omnidirectional shadows of point lights, as light distance over radius in one depth atlas. Every cube face of a light
+    // is its own square tile, handed out by a quadtree allocator, so the shadow memory is ATLAS_SIZE² whatever the light count.
+    //
+    // Allocate sizes the faces of each light with a shadowId by how big the light looks on screen, and gives it a slot in the
+    // tiles buffer the shader reads, in PointLight::shadow. When the lights want more than the atlas, every size is halved
+    // until they fit, the least important lights first losing their shadows. Faces change size at most MAX_REPACKS lights a
+    // frame, with some slack before shrinking, so lights don't keep bouncing between two sizes.
+    //
+    // Static casters are rendered into a light's tiles again only when it moves, its radius or its tiles change, or the static
+    // casters change. Lights with dynamic casters in range get a second set of tiles every frame, with only those, and the
+    // shader keeps the nearer of both lookups. All of it is drawn in a single framebuffer bind, a viewport per face.
+    //
+    // Casters are culled against each face frustum on the CPU, so a face only rasterizes what it sees. Where the vertex shader
+    // can write gl_ViewportIndex, a caster is one instanced draw over its visible faces. Otherwise every face is its own pass
+    class PointShadows
+    {
+    public:
+        static constexpr int ATLAS_SIZE = 4096;
+        static constexpr int MIN_FACE_SIZE = 64;
+        static constexpr int MAX_FACE_SIZE = 512;
+        // slots in the tiles buffer, lights past it have no shadows
+        static constexpr int MAX_LIGHTS = 64;
+        static constexpr int MAX_REPACKS = 2;
+        // face texels per pixel of the light sphere on screen
+        static constexpr float FACE_SCALE = 0.5f;
+        // share of the atlas the static faces may take, the rest is left for dynamic ones
+        static constexpr float STATIC_BUDGET = 0.75f;
+        static constexpr float NEAR_PLANE = 0.05f;
+
+        struct Stats
+        {
+            bool instanced = false;         // instanced into the faces, or a pass per face
+            size_t faceTriangles[6] = {};   // submitted to +X, -X, +Y, -Y, +Z, -Z, over all the lights
+            size_t triangles = 0;           // submitted to all the faces
+            size_t unculledTriangles = 0;   // every caster to every face
+            unsigned int shadowed = 0;
+            unsigned int dropped = 0;       // wanted a shadow but got no tiles
+            unsigned int repacks = 0;
+            unsigned int staticRenders = 0;
+            unsigned int dynamicRenders = 0;
+            float atlasUsage = 0.0f;
+            float updateMs = 0.0f;
+        };
+
+        PointShadows(const std::filesystem::path& shaderFolder)
+            : faceShader((shaderFolder / "shadowVertex.glsl").generic_string().c_str(), (shaderFolder / "shadowFrag.glsl").generic_string().c_str()),
+              allocator(ATLAS_SIZE, MIN_FACE_SIZE)
+        {
+            bool viewportIndex = HasExtension("GL_ARB_shader_viewport_layer_array") || HasExtension("GL_AMD_vertex_shader_viewport_index");
+            if(viewportIndex && glViewportIndexedf && glScissorIndexed)
+            {
+                auto vertexPath = (shaderFolder / "shadowInstancedVertex.glsl").generic_string();
+                auto fragPath = (shaderFolder / "shadowFrag.glsl").generic_string();
+                instancedShader = std::make_unique<Shader>(vertexPath.c_str(), fragPath.c_str());
+            }
+            stats.instanced = instancedShader != nullptr;
+
+            glGenTextures(1, &atlas);
+            glBindTexture(GL_TEXTURE_2D, atlas);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, ATLAS_SIZE, ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atlas, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            glGenBuffers(1, &tileBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, tileBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(tileTexels), nullptr, GL_DYNAMIC_DRAW);
+            glGenTextures(1, &tileTexture);
+            glBindTexture(GL_TEXTURE_BUFFER, tileTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, tileBuffer);
+        }
+
+        ~PointShadows()
+        {
+            glDeleteTextures(1, &atlas);
+            glDeleteTextures(1, &tileTexture);
+            glDeleteBuffers(1, &tileBuffer);
+            glDeleteFramebuffers(1, &fbo);
+        }
+
+        PointShadows(const PointShadows&) = delete;
+        PointShadows& operator=(const PointShadows&) = delete;
+
+        // Sizes the faces of the lights with a shadowId and sets their shadow slot, -1 for the ones without tiles.
+        // Call before the lights are uploaded to the clusters. Lights missing since the last call lose their tiles
+        void Allocate(std::vector<PointLight>& lights, glm::vec3 viewPos, float fovY, int screenHeight)
+        {
+            stats.shadowed = 0;
+            stats.dropped = 0;
+            stats.repacks = 0;
+
+            // last frame dynamic faces and the tiles of the lights gone first, so the others can have them
+            for(auto& slot : slots)
+            {
+                FreeFaces(slot.dynamicFaces);
+                slot.seen = false;
+            }
+            for(auto& light : lights)
+            {
+                light.shadow = -1;
+                auto it = slotOf.find(light.shadowId);
+                if(light.shadowId >= 0 && it != slotOf.end())
+                    slots[it->second].seen = true;
+            }
+            for(int i = 0; i < MAX_LIGHTS; i++)
+            {
+                if(slots[i].id >= 0 && !slots[i].seen)
+                    Release(i);
+            }
+
+            // face size by the light sphere size on screen, most important first
+            float pixelsPerUnit = screenHeight * 0.5f / std::tan(fovY * 0.5f);
+            requests.clear();
+            for(size_t i = 0; i < lights.size(); i++)
+            {
+                auto& light = lights[i];
+                if(light.shadowId < 0)
+                    continue;
+                float dist = glm::max(glm::length(light.pos - viewPos), light.radius);
+                requests.push_back({i, light.radius / dist * pixelsPerUnit * FACE_SCALE});
+            }
+            std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b)
+            {
+                return a.ideal > b.ideal;
+            });
+
+            // the same scale for everyone until the static faces fit their budget
+            float scale = 1.0f;
+            for(;;)
+            {
+                double texels = 0.0;
+                for(auto& request : requests)
+                {
+                    double size = allocator.FloorSize(request.ideal * scale, MAX_FACE_SIZE);
+                    texels += 6.0 * size * size;
+                }
+                if(texels <= STATIC_BUDGET * ATLAS_SIZE * ATLAS_SIZE || scale * MAX_FACE_SIZE < MIN_FACE_SIZE)
+                    break;
+                scale *= 0.5f;
+            }
+
+            for(auto& request : requests)
+            {
+                auto& light = lights[request.light];
+                int slot = FindSlot(light.shadowId);
+                if(slot < 0)
+                {
+                    stats.dropped++;
+                    continue;
+                }
+
+                auto& entry = slots[slot];
+                float ideal = request.ideal * scale;
+                int size = allocator.FloorSize(ideal, MAX_FACE_SIZE);
+                int current = entry.faces[0].size;
+                // a step down only once well under the current size
+                bool keep = current && (size == current || (size == current / 2 && ideal >= 0.4f * current));
+                if(current && !keep && stats.repacks < MAX_REPACKS)
+                {
+                    FreeFaces(entry.faces);
+                    stats.repacks++;
+                }
+                if(!entry.faces[0].size && !AllocateFaces(entry.faces, size))
+                {
+                    Release(slot);
+                    stats.dropped++;
+                    continue;
+                }
+                if(entry.faces[0].size != current)
+                    entry.valid = false;
+
+                light.shadow = slot;
+                stats.shadowed++;
+            }
+        }
+
+        // Draws the faces of the lights with a shadow slot. Casters only use their geometry, model and culling.
+        // Leaves the default framebuffer bound, with the viewport to restore
+        void Update(const std::vector<PointLight>& lights, const std::vector<DrawPacket>& staticCasters, const std::vector<DrawPacket>& dynamicCasters)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(auto& count : stats.faceTriangles)
+                count = 0;
+            stats.triangles = 0;
+            stats.unculledTriangles = 0;
+            stats.staticRenders = 0;
+            stats.dynamicRenders = 0;
+
+            if(StaticCastersChanged(staticCasters))
+                staticVersion++;
+
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glEnable(GL_SCISSOR_TEST);
+            for(auto& light : lights)
+            {
+                if(light.shadow < 0 || light.shadow >= MAX_LIGHTS)
+                    continue;
+
+                auto& entry = slots[light.shadow];
+                if(!entry.valid || entry.pos != light.pos || entry.radius != light.radius || entry.version != staticVersion)
+                {
+                    casters.clear();
+                    for(auto& caster : staticCasters)
+                        casters.push_back(&caster);
+                    Render(entry.faces, light, casters);
+                    entry.valid = true;
+                    entry.pos = light.pos;
+                    entry.radius = light.radius;
+                    entry.version = staticVersion;
+                    stats.staticRenders++;
+                }
+
+                // only the dynamic casters touching the light sphere
+                casters.clear();
+                for(auto& caster : dynamicCasters)
+                {
+                    if(glm::length(glm::vec3(caster.model[3]) - light.pos) < light.radius + BoundingRadius(caster))
+                        casters.push_back(&caster);
+                }
+                if(!casters.empty() && AllocateFaces(entry.dynamicFaces, entry.faces[0].size))
+                {
+                    Render(entry.dynamicFaces, light, casters);
+                    stats.dynamicRenders++;
+                }
+            }
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glEnable(GL_CULL_FACE);
+
+            UploadTiles();
+            stats.atlasUsage = (float)((double)allocator.GetUsed() / ((double)ATLAS_SIZE * ATLAS_SIZE));
+            stats.updateMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // redraws every light, e.g. when the static casters were edited in place
+        void Invalidate()
+        {
+            for(auto& entry : slots)
+                entry.valid = false;
+        }
+
+        void SetUniforms(Shader& target, int atlasUnit, int tilesUnit) const
+        {
+            target.use();
+            target.setInt("pointShadows.atlas", atlasUnit);
+            target.setInt("pointShadows.tiles", tilesUnit);
+        }
+
+        void Bind(int atlasUnit, int tilesUnit) const
+        {
+            glActiveTexture(GL_TEXTURE0 + atlasUnit);
+            glBindTexture(GL_TEXTURE_2D, atlas);
+            glActiveTexture(GL_TEXTURE0 + tilesUnit);
+            glBindTexture(GL_TEXTURE_BUFFER, tileTexture);
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        using Tile = AtlasAllocator::Tile;
+
+        struct Slot
+        {
+            int id = -1;                // shadowId of the light, -1 for a free slot
+            bool seen = false;
+            Tile faces[6];              // static casters
+            Tile dynamicFaces[6];       // dynamic casters, this frame only
+            bool valid = false;         // static faces drawn for pos, radius and version
+            glm::vec3 pos{0.0f};
+            float radius = 0.0f;
+            unsigned int version = 0;
+        };
+
+        struct Request
+        {
+            size_t light;
+            float ideal;    // face size in texels
+        };
+
+        // the light slot, a new one if it had none, -1 when they're all taken
+        int FindSlot(int id)
+        {
+            auto it = slotOf.find(id);
+            if(it != slotOf.end())
+                return it->second;
+            for(int i = 0; i < MAX_LIGHTS; i++)
+            {
+                if(slots[i].id < 0)
+                {
+                    slots[i] = Slot{};
+                    slots[i].id = id;
+                    slotOf[id] = i;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void Release(int slot)
+        {
+            auto& entry = slots[slot];
+            FreeFaces(entry.faces);
+            FreeFaces(entry.dynamicFaces);
+            slotOf.erase(entry.id);
+            entry = Slot{};
+        }
+
+        // 6 faces of the size, or smaller ones if the atlas is too full
+        bool AllocateFaces(Tile* faces, int size)
+        {
+            for(; size >= MIN_FACE_SIZE; size /= 2)
+            {
+                int face = 0;
+                for(; face < 6; face++)
+                {
+                    faces[face] = allocator.Allocate(size);
+                    if(!faces[face].size)
+                        break;
+                }
+                if(face == 6)
+                    return true;
+                FreeFaces(faces);
+            }
+            return false;
+        }
+
+        void FreeFaces(Tile* faces)
+        {
+            for(int face = 0; face < 6; face++)
+            {
+                allocator.Free(faces[face]);
+                faces[face] = {};
+            }
+        }
+
+        // Per slot, 7 texels in atlas units: the static and dynamic face sizes, then per face the static and dynamic tile
+        // corners. A dynamic size of 0 means no dynamic casters
+        void UploadTiles()
+        {
+            float texel = 1.0f / ATLAS_SIZE;
+            for(int i = 0; i < MAX_LIGHTS; i++)
+            {
+                auto& entry = slots[i];
+                auto texels = &tileTexels[i * 7];
+                texels[0] = glm::vec4(entry.faces[0].size, entry.dynamicFaces[0].size, 0.0f, 0.0f) * texel;
+                for(int face = 0; face < 6; face++)
+                {
+                    auto& a = entry.faces[face];
+                    auto& b = entry.dynamicFaces[face];
+                    texels[1 + face] = glm::vec4(a.x, a.y, b.x, b.y) * texel;
+                }
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, tileBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(tileTexels), tileTexels);
+        }
+
+        // clears the faces and draws the casters into them
+        void Render(const Tile* faces, const PointLight& light, const std::vector<const DrawPacket*>& casters)
+        {
+            glm::mat4 matrices[6];
+            auto projection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, light.radius);
+            for(int face = 0; face < 6; face++)
+                matrices[face] = projection * glm::lookAt(light.pos, light.pos + FACE_DIRS[face], FACE_UPS[face]);
+
+            // faces each caster touches, as a bit mask
+            masks.clear();
+            for(auto caster : casters)
+            {
+                int mask = FaceMask(light, *caster);
+                masks.push_back(mask);
+                size_t triangles = caster->mode == GL_TRIANGLES ? caster->count / 3 : 0;
+                for(int face = 0; face < 6; face++)
+                {
+                    if(mask & (1 << face))
+                        stats.faceTriangles[face] += triangles;
+                }
+                stats.triangles += triangles * BitCount(mask);
+                stats.unculledTriangles += triangles * 6;
+            }
+
+            for(int face = 0; face < 6; face++)
+            {
+                glScissor(faces[face].x, faces[face].y, faces[face].size, faces[face].size);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+
+            if(instancedShader)
+                RenderInstanced(faces, light, casters, matrices);
+            else
+                RenderFaces(faces, light, casters, matrices);
+        }
+
+        // one instanced draw per caster, an instance per visible face, the vertex shader picks the face viewport
+        void RenderInstanced(const Tile* faces, const PointLight& light, const std::vector<const DrawPacket*>& casters, glm::mat4* matrices)
+        {
+            for(int face = 0; face < 6; face++)
+            {
+                auto& tile = faces[face];
+                glViewportIndexedf(face, tile.x, tile.y, tile.size, tile.size);
+                glScissorIndexed(face, tile.x, tile.y, tile.size, tile.size);
+            }
+
+            auto& shader = *instancedShader;
+            SetLightUniforms(shader, light);
+            glUniformMatrix4fv(glGetUniformLocation(shader.ID, "shadowMatrices"), 6, GL_FALSE, glm::value_ptr(matrices[0]));
+            int modelLocation = glGetUniformLocation(shader.ID, "model");
+            int facesLocation = glGetUniformLocation(shader.ID, "faces");
+
+            for(size_t i = 0; i < casters.size(); i++)
+            {
+                int visible[6];
+                int count = 0;
+                for(int face = 0; face < 6; face++)
+                {
+                    if(masks[i] & (1 << face))
+                        visible[count++] = face;
+                }
+                if(!count)
+                    continue;
+
+                auto caster = casters[i];
+                caster->cull ? glEnable(GL_CULL_FACE) : glDisable(GL_CULL_FACE);
+                glBindVertexArray(caster->vao);
+                glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(caster->model));
+                glUniform1iv(facesLocation, count, visible);
+                glDrawArraysInstanced(caster->mode, caster->first, caster->count, count);
+            }
+        }
+
+        // a pass per face, with only the casters it sees
+        void RenderFaces(const Tile* faces, const PointLight& light, const std::vector<const DrawPacket*>& casters, glm::mat4* matrices)
+        {
+            auto& shader = faceShader;
+            SetLightUniforms(shader, light);
+            int modelLocation = glGetUniformLocation(shader.ID, "model");
+
+            for(int face = 0; face < 6; face++)
+            {
+                auto& tile = faces[face];
+                glViewport(tile.x, tile.y, tile.size, tile.size);
+                glScissor(tile.x, tile.y, tile.size, tile.size);
+                shader.setMatrix("shadowMatrix", glm::value_ptr(matrices[face]));
+
+                for(size_t i = 0; i < casters.size(); i++)
+                {
+                    if(!(masks[i] & (1 << face)))
+                        continue;
+
+                    auto caster = casters[i];
+                    caster->cull ? glEnable(GL_CULL_FACE) : glDisable(GL_CULL_FACE);
+                    glBindVertexArray(caster->vao);
+                    glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(caster->model));
+                    glDrawArrays(caster->mode, caster->first, caster->count);
+                }
+            }
+        }
+
+        void SetLightUniforms(Shader& shader, const PointLight& light)
+        {
+            shader.use();
+            auto pos = light.pos;
+            shader.setVec3("lightPos", glm::value_ptr(pos));
+            shader.setFloat("far_plane", light.radius);
+        }
+
+        // Faces whose frustum the caster bounding sphere touches. A face sees the points further along its axis than
+        // along the two others, so its side planes go through the light at 45 degrees
+        int FaceMask(const PointLight& light, const DrawPacket& caster) const
+        {
+            auto center = glm::vec3(caster.model[3]) - light.pos;
+            float radius = BoundingRadius(caster);
+            if(glm::length(center) > light.radius + radius)
+                return 0;
+
+            int mask = 0;
+            for(int face = 0; face < 6; face++)
+            {
+                auto dir = FACE_DIRS[face];
+                auto up = FACE_UPS[face];
+                auto side = glm::cross(dir, up);
+                float along = glm::dot(dir, center);
+                float limit = -radius * 1.4142136f;
+                if(along - glm::abs(glm::dot(up, center)) >= limit && along - glm::abs(glm::dot(side, center)) >= limit)
+                    mask |= 1 << face;
+            }
+            return mask;
+        }
+
+        static int BitCount(int mask)
+        {
+            int count = 0;
+            for(; mask; mask &= mask - 1)
+                count++;
+            return count;
+        }
+
+        // the VAOs are unit sized shapes
+        static float BoundingRadius(const DrawPacket& caster)
+        {
+            float scale = glm::max(glm::length(glm::vec3(caster.model[0])), glm::max(glm::length(glm::vec3(caster.model[1])), glm::length(glm::vec3(caster.model[2]))));
+            return scale * 1.7320508f;
+        }
+
+        bool StaticCastersChanged(const std::vector<DrawPacket>& casters)
+        {
+            bool changed = casters.size() != lastStatic.size();
+            for(size_t i = 0; !changed && i < casters.size(); i++)
+            {
+                auto& a = casters[i];
+                auto& b = lastStatic[i];
+                changed = a.vao != b.vao || a.mode != b.mode || a.first != b.first || a.count != b.count || a.cull != b.cull || a.model != b.model;
+            }
+            if(changed)
+                lastStatic = casters;
+            return changed;
+        }
+
+        // the same as lighting.glsl
+        inline static const glm::vec3 FACE_DIRS[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+        inline static const glm::vec3 FACE_UPS[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+        Shader faceShader;
+        std::unique_ptr<Shader> instancedShader;
+        unsigned int atlas = 0;
+        unsigned int fbo = 0;
+        unsigned int tileBuffer = 0;
+        unsigned int tileTexture = 0;
+
+        AtlasAllocator allocator;
+        Slot slots[MAX_LIGHTS];
+        std::unordered_map<int, int> slotOf;   // slot by shadowId
+        std::vector<Request> requests;
+        glm::vec4 tileTexels[MAX_LIGHTS * 7] = {};
+
+        unsigned int staticVersion = 0;
+        std::vector<DrawPacket> lastStatic;
+        std::vector<const DrawPacket*> casters;
+        std::vector<int> masks;
+        Stats stats;
+    };
+}
+#endif
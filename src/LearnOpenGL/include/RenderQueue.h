@@ -0,0 +1,623 @@
+
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <CommandBuffer.h>
+#include <FragmentCounter.h>
+#include <Parallel.h>
+#include <StreamBuffer.h>
+#include <TextureResidency.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RENDER_QUEUE_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    // 2D textures a draw needs, by texture unit. 0 leaves the unit as it is
+    struct Material
+    {
+        static constexpr int MAX_TEXTURES = 4;
+        std::array<unsigned int, MAX_TEXTURES> textures{};
+    };
+
+    // Everything needed to replay a draw. The model matrix reaches the shader through the object buffer
+    struct DrawPacket
+    {
+        uint8_t pass = 0;           // passes are drawn in order, 16 at most
+        bool blend = false;         // alpha blended, drawn back to front after the pass opaques
+        bool cull = true;
+        unsigned int program = 0;
+        unsigned int material = 0;  // index returned by AddMaterial
+        unsigned int vao = 0;
+        GLenum mode = GL_TRIANGLES;
+        int first = 0;
+        int count = 0;
+        glm::mat4 model{1.0f};
+    };
+
+    // Collects the frame draws and submits them sorted by a 64 bit key, so state changes happen as few times as possible.
+    //
+    // Opaque:  pass (4) | 0 | program (8) | material (12) | vao (8) | depth (24) | unused (7)
+    // Blended: pass (4) | 1 | inverted depth (24) | program (8) | material (12) | vao (8) | unused (7)
+    //
+    // Opaques go front to back inside the same state, blended draws back to front regardless of state.
+    // GL names are small sequential integers, so their low bits are enough to group draws. Replay compares the full names,
+    // so a clash costs a redundant bind at most.
+    //
+    // With the depth prepass on, opaques whose program is expensive enough are first drawn depth only by a cheap program,
+    // then shaded with GL_EQUAL and no depth writes, so the expensive program runs once per visible pixel.
+    //
+    // The matrices of every packet are computed in one pass on the CPU and uploaded to one buffer, OBJECT_VEC4S per packet:
+    // projection * view * model, model, and the normal matrix, the inverse transpose of the model 3x3, in 3 vec4.
+    // VAOs drawn by the queue read it as per instance attributes from OBJECT_ATTRIBUTE on, and every draw is a single
+    // instance whose base instance is the packet index, so the vertex shader gets its matrices without any per draw upload.
+    // Without base instances, the attributes are set as constants before each draw instead. Given a stream buffer, the
+    // matrices are written straight into it and the base instance starts at their offset, instead of reallocating a buffer.
+    //
+    // The sorted packets are cut into batches of RECORD_BATCH, recorded into command buffers by jobs and replayed in order
+    // on the GL thread. Each batch starts from nothing bound, so a batch boundary costs a few redundant binds
+    class RenderQueue
+    {
+    public:
+        static constexpr int OBJECT_VEC4S = 11;
+        static constexpr size_t OBJECT_BYTES = OBJECT_VEC4S * sizeof(glm::vec4);
+        static constexpr int OBJECT_ATTRIBUTE = 5;
+        static constexpr size_t RECORD_BATCH = 4096;
+
+        // fragment cost of a program over its depth program's from which the prepass pays for itself
+        static constexpr float PREPASS_MIN_COST = 2.0f;
+
+        struct Stats
+        {
+            size_t packets = 0;
+            size_t prepassed = 0;
+            unsigned int programBinds = 0;
+            unsigned int textureBinds = 0;
+            unsigned int vaoBinds = 0;
+            size_t commands = 0;
+            float objectsMs = 0.0f;
+            float sortMs = 0.0f;
+            float recordMs = 0.0f;
+            float submitMs = 0.0f;
+        };
+
+        RenderQueue()
+        {
+            // core since 4.2
+            baseInstance = glDrawArraysInstancedBaseInstance != nullptr;
+            glGenBuffers(1, &objectBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, objectBuffer);
+            glBufferData(GL_ARRAY_BUFFER, OBJECT_VEC4S * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        ~RenderQueue()
+        {
+            glDeleteBuffers(1, &objectBuffer);
+        }
+
+        RenderQueue(const RenderQueue&) = delete;
+        RenderQueue& operator=(const RenderQueue&) = delete;
+
+        unsigned int AddMaterial(const Material& material)
+        {
+            materials.push_back(material);
+            return materials.size() - 1;
+        }
+
+        // Lets draws with program join the depth prepass. depthProgram must use the same vertex shader and discard
+        // the same fragments. cost is the fragment cost of program relative to depthProgram
+        void SetDepthProgram(unsigned int program, unsigned int depthProgram, float cost)
+        {
+            depthPrograms[program] = {depthProgram, cost};
+        }
+
+        void SetDepthPrepass(bool enabled)
+        {
+            prepass = enabled;
+        }
+
+        bool GetDepthPrepass() const
+        {
+            return prepass;
+        }
+
+        // where the object matrices go every frame, nullptr for a buffer of the queue's own. Used with base instances only
+        void SetStreamBuffer(StreamBuffer* stream)
+        {
+            this->stream = stream;
+        }
+
+        // counters of the fragments drawn by the depth prepass and by the shading pass, nullptr for none
+        void SetCounters(FragmentCounter* prepassCounter, FragmentCounter* shadingCounter)
+        {
+            this->prepassCounter = prepassCounter;
+            this->shadingCounter = shadingCounter;
+        }
+
+        // call before pushing the frame draws
+        void Begin(const glm::mat4& viewProjection, glm::vec3 viewPos, float farPlane)
+        {
+            this->viewProjection = viewProjection;
+            this->viewPos = viewPos;
+            this->farPlane = farPlane;
+            packets.clear();
+            keys.clear();
+        }
+
+        void Push(const DrawPacket& packet)
+        {
+            keys.push_back(MakeKey(packet));
+            packets.push_back(packet);
+        }
+
+        // moves the packets drawn with program out of the queue, to submit them in another pass
+        void Extract(unsigned int program, std::vector<DrawPacket>& out)
+        {
+            size_t kept = 0;
+            for(size_t i = 0; i < packets.size(); i++)
+            {
+                if(packets[i].program == program)
+                {
+                    out.push_back(packets[i]);
+                    continue;
+                }
+                packets[kept] = packets[i];
+                keys[kept] = keys[i];
+                kept++;
+            }
+            packets.resize(kept);
+            keys.resize(kept);
+        }
+
+        // sorts and replays every packet pushed since Begin. GL state is left with culling on, no blending, depth writes on and GL_LESS
+        void Submit()
+        {
+            auto start = std::chrono::steady_clock::now();
+            UpdateObjects();
+            auto objectsDone = std::chrono::steady_clock::now();
+            Sort();
+            auto sorted = std::chrono::steady_clock::now();
+            SetupVaos();
+            RecordBatches();
+            auto recorded = std::chrono::steady_clock::now();
+            if(prepassCounter)
+                prepassCounter->Begin();
+            if(prepass)
+                Replay(true);
+            if(prepassCounter)
+                prepassCounter->End();
+            if(shadingCounter)
+                shadingCounter->Begin();
+            Replay(false);
+            if(shadingCounter)
+                shadingCounter->End();
+            auto end = std::chrono::steady_clock::now();
+
+            stats.packets = packets.size();
+            stats.objectsMs = std::chrono::duration<float, std::milli>(objectsDone - start).count();
+            stats.sortMs = std::chrono::duration<float, std::milli>(sorted - objectsDone).count();
+            stats.recordMs = std::chrono::duration<float, std::milli>(recorded - sorted).count();
+            stats.submitMs = std::chrono::duration<float, std::milli>(end - recorded).count();
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        // a run of sorted packets, recorded for both passes
+        struct Batch
+        {
+            struct Counts
+            {
+                unsigned int programBinds = 0;
+                unsigned int textureBinds = 0;
+                unsigned int vaoBinds = 0;
+            };
+
+            CommandBuffer depth;
+            CommandBuffer shading;
+            size_t prepassed = 0;
+            Counts counts[2];   // depth, shading
+        };
+
+        uint64_t MakeKey(const DrawPacket& packet) const
+        {
+            float dist = glm::length(glm::vec3(packet.model[3]) - viewPos);
+            uint64_t depth = (uint64_t)(glm::clamp(dist / farPlane, 0.0f, 1.0f) * 0xFFFFFF);
+            uint64_t pass = packet.pass & 0xF;
+            uint64_t program = packet.program & 0xFF;
+            uint64_t material = packet.material & 0xFFF;
+            uint64_t vao = packet.vao & 0xFF;
+
+            if(!packet.blend)
+                return pass << 60 | program << 51 | material << 39 | vao << 31 | depth << 7;
+            return pass << 60 | 1ull << 59 | (0xFFFFFF - depth) << 35 | program << 27 | material << 15 | vao << 7;
+        }
+
+        // matrices of every packet, in push order, written to the stream buffer or uploaded in one go
+        void UpdateObjects()
+        {
+            if(stream && baseInstance)
+            {
+                auto allocation = stream->Allocate(std::max<size_t>(packets.size(), 1) * OBJECT_BYTES, OBJECT_BYTES);
+                auto out = static_cast<glm::vec4*>(allocation.data);
+                for(size_t i = 0; i < packets.size(); i++)
+                    WriteObject(packets[i].model, out + i * OBJECT_VEC4S);
+                SetObjectSource(allocation.buffer);
+                objectBase = allocation.offset / OBJECT_BYTES;
+                return;
+            }
+
+            objects.resize(std::max<size_t>(packets.size(), 1) * OBJECT_VEC4S);
+            for(size_t i = 0; i < packets.size(); i++)
+                WriteObject(packets[i].model, &objects[i * OBJECT_VEC4S]);
+
+            glBindBuffer(GL_ARRAY_BUFFER, objectBuffer);
+            glBufferData(GL_ARRAY_BUFFER, objects.size() * sizeof(glm::vec4), objects.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            SetObjectSource(objectBuffer);
+            objectBase = 0;
+        }
+
+        // the VAOs point at the buffer by name, so they're set up again when it changes
+        void SetObjectSource(unsigned int buffer)
+        {
+            if(buffer == objectSource)
+                return;
+            objectSource = buffer;
+            objectVaos.clear();
+        }
+
+        // points the object attributes of the bound VAO at the object buffer, once per VAO. Reallocating the buffer
+        // storage keeps its name, so they stay valid
+        void SetupObjects(unsigned int vao)
+        {
+            if(!baseInstance || !objectVaos.insert(vao).second)
+                return;
+            glBindBuffer(GL_ARRAY_BUFFER, objectSource);
+            for(int i = 0; i < OBJECT_VEC4S; i++)
+            {
+                // the normal matrix columns are vec3
+                int size = i < 8 ? 4 : 3;
+                glEnableVertexAttribArray(OBJECT_ATTRIBUTE + i);
+                glVertexAttribPointer(OBJECT_ATTRIBUTE + i, size, GL_FLOAT, GL_FALSE, OBJECT_VEC4S * sizeof(glm::vec4), (void*)(i * sizeof(glm::vec4)));
+                glVertexAttribDivisor(OBJECT_ATTRIBUTE + i, 1);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        // sets the object attributes up on every VAO drawn for the first time
+        void SetupVaos()
+        {
+            if(!baseInstance)
+                return;
+            unsigned int last = 0;
+            bool bound = false;
+            for(auto index : order)
+            {
+                auto vao = packets[index].vao;
+                if(vao == last || objectVaos.count(vao))
+                    continue;
+                last = vao;
+                glBindVertexArray(vao);
+                SetupObjects(vao);
+                bound = true;
+            }
+            if(bound)
+                glBindVertexArray(0);
+        }
+
+        void Draw(CommandBuffer& commands, const DrawPacket& packet, uint32_t index) const
+        {
+            if(baseInstance)
+            {
+                commands.DrawArraysInstanced(packet.mode, packet.first, packet.count, 1, objectBase + index);
+                return;
+            }
+            commands.VertexAttribs(OBJECT_ATTRIBUTE, OBJECT_VEC4S, glm::value_ptr(objects[index * OBJECT_VEC4S]));
+            commands.DrawArrays(packet.mode, packet.first, packet.count);
+        }
+
+        // The columns of the normal matrix are the cross products of the model columns over the determinant,
+        // which is the inverse transpose without a full inverse
+        void WriteObject(const glm::mat4& model, glm::vec4* out) const
+        {
+#ifdef RENDER_QUEUE_SSE
+            __m128 vp[4], m[4];
+            for(int c = 0; c < 4; c++)
+            {
+                vp[c] = _mm_loadu_ps(&viewProjection[c][0]);
+                m[c] = _mm_loadu_ps(&model[c][0]);
+            }
+            for(int c = 0; c < 4; c++)
+            {
+                __m128 x = _mm_shuffle_ps(m[c], m[c], _MM_SHUFFLE(0, 0, 0, 0));
+                __m128 y = _mm_shuffle_ps(m[c], m[c], _MM_SHUFFLE(1, 1, 1, 1));
+                __m128 z = _mm_shuffle_ps(m[c], m[c], _MM_SHUFFLE(2, 2, 2, 2));
+                __m128 w = _mm_shuffle_ps(m[c], m[c], _MM_SHUFFLE(3, 3, 3, 3));
+                __m128 column = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vp[0], x), _mm_mul_ps(vp[1], y)), _mm_add_ps(_mm_mul_ps(vp[2], z), _mm_mul_ps(vp[3], w)));
+                _mm_storeu_ps(&out[c].x, column);
+                _mm_storeu_ps(&out[4 + c].x, m[c]);
+            }
+
+            // a.yzx * b.zxy - a.zxy * b.yzx
+            auto cross = [](__m128 a, __m128 b)
+            {
+                __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+                __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+                __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+                return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+            };
+            __m128 n0 = cross(m[1], m[2]);
+            __m128 n1 = cross(m[2], m[0]);
+            __m128 n2 = cross(m[0], m[1]);
+            __m128 products = _mm_mul_ps(m[0], n0);
+            float det = _mm_cvtss_f32(products) + _mm_cvtss_f32(_mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 1, 1, 1)))
+                + _mm_cvtss_f32(_mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 2, 2, 2)));
+            __m128 inverseDet = _mm_set1_ps(det != 0.0f ? 1.0f / det : 0.0f);
+            _mm_storeu_ps(&out[8].x, _mm_mul_ps(n0, inverseDet));
+            _mm_storeu_ps(&out[9].x, _mm_mul_ps(n1, inverseDet));
+            _mm_storeu_ps(&out[10].x, _mm_mul_ps(n2, inverseDet));
+#else
+            auto mvp = viewProjection * model;
+            for(int c = 0; c < 4; c++)
+            {
+                out[c] = mvp[c];
+                out[4 + c] = model[c];
+            }
+            auto a = glm::vec3(model[0]), b = glm::vec3(model[1]), c = glm::vec3(model[2]);
+            auto n0 = glm::cross(b, c), n1 = glm::cross(c, a), n2 = glm::cross(a, b);
+            float det = glm::dot(a, n0);
+            float inverseDet = det != 0.0f ? 1.0f / det : 0.0f;
+            out[8] = glm::vec4(n0 * inverseDet, 0.0f);
+            out[9] = glm::vec4(n1 * inverseDet, 0.0f);
+            out[10] = glm::vec4(n2 * inverseDet, 0.0f);
+#endif
+        }
+
+        // LSD radix sort of the keys, 8 bits per pass, carrying the packet indices along.
+        // Digits that are the same for every key are skipped, which is most of them in a typical frame
+        void Sort()
+        {
+            const size_t count = keys.size();
+            order.resize(count);
+            for(size_t i = 0; i < count; i++)
+                order[i] = i;
+            tmpKeys.resize(count);
+            tmpOrder.resize(count);
+
+            for(int shift = 0; shift < 64; shift += 8)
+            {
+                std::array<uint32_t, 256> histogram{};
+                for(auto key : keys)
+                    histogram[(key >> shift) & 0xFF]++;
+                if(count == 0 || histogram[(keys[0] >> shift) & 0xFF] == count)
+                    continue;
+
+                uint32_t offset = 0;
+                for(auto& bucket : histogram)
+                {
+                    auto size = bucket;
+                    bucket = offset;
+                    offset += size;
+                }
+
+                for(size_t i = 0; i < count; i++)
+                {
+                    auto dst = histogram[(keys[i] >> shift) & 0xFF]++;
+                    tmpKeys[dst] = keys[i];
+                    tmpOrder[dst] = order[i];
+                }
+                keys.swap(tmpKeys);
+                order.swap(tmpOrder);
+            }
+        }
+
+        // program the packet is drawn with in the depth prepass, 0 if it doesn't join it
+        unsigned int DepthProgram(const DrawPacket& packet) const
+        {
+            if(packet.blend)
+                return 0;
+            auto it = depthPrograms.find(packet.program);
+            if(it == depthPrograms.end() || it->second.cost < PREPASS_MIN_COST)
+                return 0;
+            return it->second.program;
+        }
+
+        // records both passes of every batch on jobs, then sums up their stats
+        void RecordBatches()
+        {
+            batches.resize((order.size() + RECORD_BATCH - 1) / RECORD_BATCH);
+            ParallelFor(0, batches.size() * 2, [&](int job)
+            {
+                auto& batch = batches[job / 2];
+                size_t begin = job / 2 * RECORD_BATCH;
+                size_t end = std::min(begin + RECORD_BATCH, order.size());
+                if(job % 2 == 0)
+                {
+                    batch.depth.Clear();
+                    batch.prepassed = prepass ? Record(batch.depth, begin, end, true, batch) : 0;
+                }
+                else
+                {
+                    batch.shading.Clear();
+                    Record(batch.shading, begin, end, false, batch);
+                }
+            });
+
+            stats.prepassed = 0;
+            stats.programBinds = 0;
+            stats.textureBinds = 0;
+            stats.vaoBinds = 0;
+            stats.commands = 0;
+            for(auto& batch : batches)
+            {
+                stats.prepassed += batch.prepassed;
+                for(auto& counts : batch.counts)
+                {
+                    stats.programBinds += counts.programBinds;
+                    stats.textureBinds += counts.textureBinds;
+                    stats.vaoBinds += counts.vaoBinds;
+                }
+                stats.commands += batch.depth.Commands() + batch.shading.Commands();
+            }
+        }
+
+        // Records the sorted packets from begin to end. The depth only pass draws the prepass packets with their depth
+        // program and returns how many there were, the shading pass then draws the prepassed packets with GL_EQUAL and no
+        // depth writes. Both expect culling on, no blending, depth writes on and GL_LESS, and leave it that way
+        size_t Record(CommandBuffer& commands, size_t begin, size_t end, bool depthOnly, Batch& batch) const
+        {
+            unsigned int program = 0;
+            unsigned int vao = 0;
+            std::array<unsigned int, Material::MAX_TEXTURES> textures{};
+            bool cull = true;
+            bool blend = false;
+            bool equal = false;
+            size_t drawn = 0;
+            auto& counts = batch.counts[depthOnly ? 0 : 1];
+            counts = {};
+
+            for(size_t i = begin; i < end; i++)
+            {
+                auto index = order[i];
+                auto& packet = packets[index];
+                auto depthProgram = prepass ? DepthProgram(packet) : 0;
+                if(depthOnly && !depthProgram)
+                    continue;
+
+                auto packetProgram = depthOnly ? depthProgram : packet.program;
+                if(packetProgram != program)
+                {
+                    program = packetProgram;
+                    commands.UseProgram(program);
+                    counts.programBinds++;
+                }
+
+                auto& material = materials[packet.material];
+                for(int unit = 0; unit < Material::MAX_TEXTURES; unit++)
+                {
+                    auto texture = material.textures[unit];
+                    if(texture && texture != textures[unit])
+                    {
+                        textures[unit] = texture;
+                        commands.BindTexture(unit, GL_TEXTURE_2D, texture);
+                        counts.textureBinds++;
+                    }
+                }
+
+                if(packet.vao != vao)
+                {
+                    vao = packet.vao;
+                    commands.BindVertexArray(vao);
+                    counts.vaoBinds++;
+                }
+
+                if(packet.cull != cull)
+                {
+                    cull = packet.cull;
+                    cull ? commands.Enable(GL_CULL_FACE) : commands.Disable(GL_CULL_FACE);
+                }
+
+                bool packetEqual = !depthOnly && depthProgram;
+                if(packet.blend != blend || packetEqual != equal)
+                {
+                    if(packet.blend != blend)
+                    {
+                        if(packet.blend)
+                        {
+                            commands.Enable(GL_BLEND);
+                            commands.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                        }
+                        else
+                            commands.Disable(GL_BLEND);
+                    }
+                    if(packetEqual != equal)
+                        commands.DepthFunc(packetEqual ? GL_EQUAL : GL_LESS);
+                    blend = packet.blend;
+                    equal = packetEqual;
+                    commands.DepthMask(!blend && !equal);
+                }
+
+                Draw(commands, packet, index);
+                drawn++;
+            }
+
+            // back to where the next batch starts
+            if(!cull)
+                commands.Enable(GL_CULL_FACE);
+            if(blend)
+                commands.Disable(GL_BLEND);
+            if(equal)
+                commands.DepthFunc(GL_LESS);
+            if(blend || equal)
+                commands.DepthMask(true);
+            return drawn;
+        }
+
+        // replays the batches of a pass. GL state is left with culling on, no blending, depth writes on and GL_LESS
+        void Replay(bool depthOnly)
+        {
+            glEnable(GL_CULL_FACE);
+            glDisable(GL_BLEND);
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            if(depthOnly)
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            for(auto& batch : batches)
+                (depthOnly ? batch.depth : batch.shading).Replay();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+
+        struct DepthProgramInfo
+        {
+            unsigned int program = 0;
+            float cost = 0.0f;
+        };
+
+        glm::mat4 viewProjection{1.0f};
+        glm::vec3 viewPos{0.0f};
+        float farPlane = 100.0f;
+        bool prepass = false;
+        FragmentCounter* prepassCounter = nullptr;
+        FragmentCounter* shadingCounter = nullptr;
+        std::unordered_map<unsigned int, DepthProgramInfo> depthPrograms;
+
+        std::vector<Material> materials;
+        std::vector<DrawPacket> packets;
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> tmpKeys;
+        std::vector<uint32_t> tmpOrder;
+
+        bool baseInstance = false;
+        unsigned int objectBuffer = 0;
+        StreamBuffer* stream = nullptr;
+        unsigned int objectSource = 0;  // objectBuffer or the stream buffer
+        unsigned int objectBase = 0;    // first instance of this frame's objects in it
+        std::unordered_set<unsigned int> objectVaos;
+        std::vector<glm::vec4> objects;
+        std::vector<Batch> batches;
+
+        Stats stats;
+    };
+}
+#endif
@@ -0,0 +1,123 @@
+
+
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace LearnOpenGL
+{
+    // Draws frames on its own thread, one behind the simulation. The simulation fills the frame Next returns and hands it
+    // over with Publish, then fills the other one while the render thread draws the first. Publish waits until the render
+    // thread took the frame, so the simulation is at most a frame ahead and never writes the frame being drawn.
+    //
+    // Everything render touches belongs to the render thread between start and stop, the GL context first: release it
+    // before creating this, make it current in start, and release it again in stop
+    template<typename Frame>
+    class RenderThread
+    {
+    public:
+        struct Stats
+        {
+            float renderMs = 0.0f;  // last frame on the render thread
+            float waitMs = 0.0f;    // last Publish waiting for it
+        };
+
+        explicit RenderThread(std::function<void(const Frame&)> render, std::function<void()> start = {}, std::function<void()> stop = {})
+            : render(std::move(render)), start(std::move(start)), stop(std::move(stop))
+        {
+            thread = std::thread([this]() { Loop(); });
+        }
+
+        ~RenderThread()
+        {
+            Stop();
+        }
+
+        RenderThread(const RenderThread&) = delete;
+        RenderThread& operator=(const RenderThread&) = delete;
+
+        // the frame to fill, the same one until Publish
+        Frame& Next()
+        {
+            return frames[write];
+        }
+
+        void Publish()
+        {
+            auto begin = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(mutex);
+            ready = true;
+            changed.notify_all();
+            changed.wait(lock, [this]() { return !ready || stopping; });
+            write ^= 1;
+            stats.waitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        // draws the frame published last and joins, from the thread that publishes
+        void Stop()
+        {
+            if(!thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            thread.join();
+        }
+
+        Stats GetStats()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        void Loop()
+        {
+            if(start)
+                start();
+            while(true)
+            {
+                int read;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [this]() { return ready || stopping; });
+                    if(!ready)
+                        break;
+                    // write only flips once ready is down, so it's still the published frame
+                    read = write;
+                    ready = false;
+                }
+                changed.notify_all();
+
+                auto begin = std::chrono::steady_clock::now();
+                render(frames[read]);
+                float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.renderMs = ms;
+            }
+            if(stop)
+                stop();
+        }
+
+        std::function<void(const Frame&)> render;
+        std::function<void()> start;
+        std::function<void()> stop;
+
+        Frame frames[2];
+        int write = 0;
+        bool ready = false;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable changed;
+        Stats stats;
+        std::thread thread;
+    };
+}
+#endif
@@ -0,0 +1,292 @@
+
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <Culling.h>
+#include <LightClusters.h>
+#include <Parallel.h>
+#include <RenderQueue.h>
+#include <TriangleBvh.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Entities as a structure of arrays. An entity is an index into the component columns, and systems are plain loops
+    // down a column, so the data they touch is contiguous and nothing is called per entity through a pointer.
+    //
+    // Transforms, draws and bounds have a slot for every entity. Lights are rare, so they get their own columns along with
+    // the entity each one follows. Entities are only ever added, a scene that changes wholesale is cleared and filled again
+    class Scene
+    {
+    public:
+        using Entity = uint32_t;
+
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+        static constexpr size_t CHUNK = 16384;
+
+        enum Flags : uint8_t
+        {
+            HIDDEN = 1,             // neither drawn nor lighting
+            UNLIT = 2,              // drawn with the unlit program
+            STATIC_CASTER = 4,      // in the cached shadows
+            DYNAMIC_CASTER = 8,     // in the shadows redrawn every frame
+        };
+
+        // what entities draw, shared by handle
+        struct Geometry
+        {
+            unsigned int vao = 0;
+            int count = 0;
+            bool cull = true;
+            glm::vec3 min{0.0f};    // bounds in mesh space
+            glm::vec3 max{0.0f};
+            const TriangleBvh* triangles = nullptr;   // for ray casts, optional
+        };
+
+        struct Transforms
+        {
+            std::vector<glm::vec3> position;
+            std::vector<glm::quat> rotation;
+            std::vector<glm::vec3> scale;
+            std::vector<glm::mat4> model;   // written by UpdateTransforms
+        };
+
+        struct Draws
+        {
+            std::vector<uint32_t> geometry;     // NONE for entities that aren't drawn, like lights alone
+            std::vector<uint32_t> material;     // RenderQueue material index
+            std::vector<uint8_t> flags;
+        };
+
+        struct Lights
+        {
+            std::vector<Entity> entity;
+            std::vector<glm::vec3> diffuse;
+            std::vector<glm::vec3> specular;
+            std::vector<glm::vec3> attenuation;     // constant, linear, quadratic
+            std::vector<float> radius;
+            std::vector<int> shadowId;
+        };
+
+        struct Stats
+        {
+            float transformMs = 0.0f;
+            float boundsMs = 0.0f;
+        };
+
+        Transforms transforms;
+        Draws draws;
+        Lights lights;
+        BoxBounds bounds;   // world space, written by UpdateBounds
+
+        uint32_t AddGeometry(const Geometry& geometry)
+        {
+            geometries.push_back(geometry);
+            return geometries.size() - 1;
+        }
+
+        Entity Create(uint32_t geometry, uint32_t material, glm::vec3 position, glm::vec3 scale = glm::vec3(1.0f), uint8_t flags = 0)
+        {
+            transforms.position.push_back(position);
+            transforms.rotation.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+            transforms.scale.push_back(scale);
+            transforms.model.push_back(Model(position, transforms.rotation.back(), scale));
+            draws.geometry.push_back(geometry);
+            draws.material.push_back(material);
+            draws.flags.push_back(flags);
+            return transforms.position.size() - 1;
+        }
+
+        // the light follows the entity, its own position is ignored
+        void AddLight(Entity entity, const PointLight& light)
+        {
+            lights.entity.push_back(entity);
+            lights.diffuse.push_back(light.diffuse);
+            lights.specular.push_back(light.specular);
+            lights.attenuation.push_back({light.constant, light.linear, light.quadratic});
+            lights.radius.push_back(light.radius);
+            lights.shadowId.push_back(light.shadowId);
+        }
+
+        void Clear()
+        {
+            transforms = {};
+            draws = {};
+            lights = {};
+            bounds.Clear();
+        }
+
+        size_t Size() const
+        {
+            return transforms.position.size();
+        }
+
+        void SetHidden(Entity entity, bool hidden)
+        {
+            draws.flags[entity] = hidden ? draws.flags[entity] | HIDDEN : draws.flags[entity] & ~HIDDEN;
+        }
+
+        bool IsHidden(Entity entity) const
+        {
+            return draws.flags[entity] & HIDDEN;
+        }
+
+        // model matrices from position, rotation and scale
+        void UpdateTransforms(unsigned int threads = std::thread::hardware_concurrency())
+        {
+            auto start = std::chrono::steady_clock::now();
+            transforms.model.resize(Size());
+            ForChunks([&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                    transforms.model[i] = Model(transforms.position[i], transforms.rotation[i], transforms.scale[i]);
+            }, threads);
+            stats.transformMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // world boxes around the geometry bounds moved by the models, entities without geometry get a point
+        void UpdateBounds(unsigned int threads = std::thread::hardware_concurrency())
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(auto array : {&bounds.centerX, &bounds.centerY, &bounds.centerZ, &bounds.extentX, &bounds.extentY, &bounds.extentZ})
+                array->resize(Size());
+            ForChunks([&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    auto& model = transforms.model[i];
+                    glm::vec3 center = model[3];
+                    glm::vec3 extent{0.0f};
+                    if(draws.geometry[i] != NONE)
+                    {
+                        // Arvo: the box of a moved box is its moved center, extended by the absolute matrix times the extent
+                        auto& geometry = geometries[draws.geometry[i]];
+                        auto localCenter = (geometry.min + geometry.max) * 0.5f;
+                        auto localExtent = (geometry.max - geometry.min) * 0.5f;
+                        center = glm::vec3(model * glm::vec4(localCenter, 1.0f));
+                        extent = glm::abs(glm::vec3(model[0])) * localExtent.x + glm::abs(glm::vec3(model[1])) * localExtent.y
+                            + glm::abs(glm::vec3(model[2])) * localExtent.z;
+                    }
+                    bounds.centerX[i] = center.x;
+                    bounds.centerY[i] = center.y;
+                    bounds.centerZ[i] = center.z;
+                    bounds.extentX[i] = extent.x;
+                    bounds.extentY[i] = extent.y;
+                    bounds.extentZ[i] = extent.z;
+                }
+            }, threads);
+            stats.boundsMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // appends every shown entity with a geometry to packets, and the casters to their lists when given. Packets hold
+        // everything to draw, so they can go to the queue on another thread
+        void Draw(std::vector<DrawPacket>& packets, unsigned int litProgram, unsigned int unlitProgram, std::vector<DrawPacket>* staticCasters = nullptr,
+            std::vector<DrawPacket>* dynamicCasters = nullptr) const
+        {
+            for(Entity i = 0; i < Size(); i++)
+            {
+                if(draws.flags[i] & HIDDEN || draws.geometry[i] == NONE)
+                    continue;
+                auto packet = Packet(i, litProgram, unlitProgram);
+                packets.push_back(packet);
+                if(staticCasters && draws.flags[i] & STATIC_CASTER)
+                    staticCasters->push_back(packet);
+                if(dynamicCasters && draws.flags[i] & DYNAMIC_CASTER)
+                    dynamicCasters->push_back(packet);
+            }
+        }
+
+        // appends the shown ones of visible, as culled against bounds
+        void Draw(std::vector<DrawPacket>& packets, unsigned int litProgram, unsigned int unlitProgram, const std::vector<uint32_t>& visible) const
+        {
+            for(auto i : visible)
+            {
+                if(!(draws.flags[i] & HIDDEN) && draws.geometry[i] != NONE)
+                    packets.push_back(Packet(i, litProgram, unlitProgram));
+            }
+        }
+
+        // appends the lights of the shown entities
+        void GatherLights(std::vector<PointLight>& out) const
+        {
+            for(size_t i = 0; i < lights.entity.size(); i++)
+            {
+                auto entity = lights.entity[i];
+                if(draws.flags[entity] & HIDDEN)
+                    continue;
+                PointLight light;
+                light.pos = transforms.position[entity];
+                light.diffuse = lights.diffuse[i];
+                light.specular = lights.specular[i];
+                light.constant = lights.attenuation[i].x;
+                light.linear = lights.attenuation[i].y;
+                light.quadratic = lights.attenuation[i].z;
+                light.radius = lights.radius[i];
+                light.shadowId = lights.shadowId[i];
+                out.push_back(light);
+            }
+        }
+
+        // distance along a world space ray to the geometry triangles of an entity, infinity on a miss or without triangles.
+        // The ray goes to mesh space unnormalized, so the distance is the same in both
+        float Raycast(Entity entity, glm::vec3 origin, glm::vec3 dir, float maxDistance = std::numeric_limits<float>::infinity()) const
+        {
+            if(draws.geometry[entity] == NONE || !geometries[draws.geometry[entity]].triangles)
+                return std::numeric_limits<float>::infinity();
+            auto inverse = glm::inverse(transforms.model[entity]);
+            auto localOrigin = glm::vec3(inverse * glm::vec4(origin, 1.0f));
+            auto localDir = glm::vec3(inverse * glm::vec4(dir, 0.0f));
+            return geometries[draws.geometry[entity]].triangles->Raycast(localOrigin, localDir, maxDistance).distance;
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        static glm::mat4 Model(glm::vec3 position, const glm::quat& rotation, glm::vec3 scale)
+        {
+            auto basis = glm::mat3_cast(rotation);
+            return glm::mat4(glm::vec4(basis[0] * scale.x, 0.0f), glm::vec4(basis[1] * scale.y, 0.0f), glm::vec4(basis[2] * scale.z, 0.0f),
+                glm::vec4(position, 1.0f));
+        }
+
+        DrawPacket Packet(Entity entity, unsigned int litProgram, unsigned int unlitProgram) const
+        {
+            auto& geometry = geometries[draws.geometry[entity]];
+            DrawPacket packet;
+            packet.program = draws.flags[entity] & UNLIT ? unlitProgram : litProgram;
+            packet.material = draws.material[entity];
+            packet.vao = geometry.vao;
+            packet.count = geometry.count;
+            packet.cull = geometry.cull;
+            packet.model = transforms.model[entity];
+            return packet;
+        }
+
+        // runs function over CHUNK sized ranges of the entities, on threads when there are enough of them
+        template<typename Function>
+        void ForChunks(Function function, unsigned int threads) const
+        {
+            size_t chunks = (Size() + CHUNK - 1) / CHUNK;
+            ParallelFor(0, chunks, [&](int chunk)
+            {
+                function(chunk * CHUNK, std::min((chunk + 1) * CHUNK, Size()));
+            }, threads);
+        }
+
+        std::vector<Geometry> geometries;
+        Stats stats;
+    };
+}
+#endif
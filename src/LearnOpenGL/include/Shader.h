@@ -6,6 +6,7 @@
 #include <glad/glad.h>
 
 #include <string>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -53,6 +54,11 @@ namespace LearnOpenGL
                 fragmentCode = fShaderStream.str();
                 if(geometryPath)
                     geometryCode = gShaderStream.str();
+                // shared code
+                vertexCode = ResolveIncludes(vertexCode, std::filesystem::path{vertexPath}.parent_path());
+                fragmentCode = ResolveIncludes(fragmentCode, std::filesystem::path{fragmentPath}.parent_path());
+                if(geometryPath)
+                    geometryCode = ResolveIncludes(geometryCode, std::filesystem::path{geometryPath}.parent_path());
             }
             catch (std::ifstream::failure& e)
             {
@@ -118,22 +124,55 @@ namespace LearnOpenGL
             glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
         }
 
-        void setMatrix(const std::string &name, float* matrix) const
+        void setMatrix(const std::string &name, const float* matrix) const
         {
             glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, matrix);
         }
 
-        void setVec3(const std::string &name, float* vec3) const
+        void setVec3(const std::string &name, const float* vec3) const
         {
             glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, vec3);
         }
 
-        void setVec2(const std::string &name, float* vec2) const
+        void setVec2(const std::string &name, const float* vec2) const
         {
             glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, vec2);
         }
 
     private:
+        // replaces every #include "file" line with the file contents, relative to dir. Included files can include too
+        static std::string ResolveIncludes(const std::string& code, const std::filesystem::path& dir, int depth = 0)
+        {
+            if(depth > 16)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_TOO_DEEP" << std::endl;
+                return code;
+            }
+
+            std::stringstream in{code};
+            std::stringstream out;
+            std::string line;
+            while(std::getline(in, line))
+            {
+                auto start = line.find("#include \"");
+                auto end = line.rfind('"');
+                if(start == std::string::npos || end <= start + 9)
+                {
+                    out << line << '\n';
+                    continue;
+                }
+
+                auto path = dir / line.substr(start + 10, end - start - 10);
+                std::ifstream file{path};
+                if(!file)
+                    std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << path.string() << std::endl;
+                std::stringstream included;
+                included << file.rdbuf();
+                out << ResolveIncludes(included.str(), path.parent_path(), depth + 1) << '\n';
+            }
+            return out.str();
+        }
+
         // utility function for checking shader compilation/linking errors.
         // ------------------------------------------------------------------------
         void checkCompileErrors(unsigned int shader, std::string type)
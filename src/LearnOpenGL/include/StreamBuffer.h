@@ -0,0 +1,183 @@
+
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Per frame data written straight into GL memory. One buffer is mapped for good, persistent and coherent, and split
+    // into FRAMES regions. Allocate hands out ranges of the frame's region with a bump pointer, EndFrame fences it and moves
+    // to the next region, waiting for its fence first. The GPU reads a region up to FRAMES - 1 frames after it was written,
+    // and the CPU never writes one the GPU may still read, so uploads never stall on an implicit sync.
+    //
+    // When a frame asks for more than its region, the buffer is replaced by a larger one. Allocations from the old buffer
+    // stay valid until EndFrame, but later ones come from another buffer name. Needs glBufferStorage, core since 4.4
+    class StreamBuffer
+    {
+    public:
+        static constexpr int FRAMES = 3;
+
+        struct Allocation
+        {
+            void* data = nullptr;
+            unsigned int buffer = 0;
+            size_t offset = 0;      // from the start of buffer
+            size_t size = 0;
+        };
+
+        struct Stats
+        {
+            size_t regionBytes = 0;
+            size_t usedBytes = 0;   // by the last frame
+            unsigned int allocations = 0;
+            unsigned int waits = 0; // regions whose fence wasn't signaled yet
+            unsigned int grows = 0;
+            float waitMs = 0.0f;
+        };
+
+        static bool Supported()
+        {
+            return glBufferStorage != nullptr;
+        }
+
+        explicit StreamBuffer(size_t regionBytes)
+        {
+            Create(regionBytes);
+        }
+
+        // deleting a buffer unmaps it
+        ~StreamBuffer()
+        {
+            DeleteFences();
+            glDeleteBuffers(1, &buffer);
+            for(auto old : retired)
+                glDeleteBuffers(1, &old);
+        }
+
+        StreamBuffer(const StreamBuffer&) = delete;
+        StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+        // bytes of the current frame region, at a multiple of alignment from the buffer start, which needn't be a power of two
+        Allocation Allocate(size_t bytes, size_t alignment = 16)
+        {
+            size_t offset = (head + alignment - 1) / alignment * alignment;
+            if(offset + bytes > RegionEnd())
+            {
+                Grow(std::max(regionBytes * 2, bytes + alignment + used));
+                offset = (head + alignment - 1) / alignment * alignment;
+            }
+
+            Allocation allocation;
+            allocation.data = mapped + offset;
+            allocation.buffer = buffer;
+            allocation.offset = offset;
+            allocation.size = bytes;
+            used += offset + bytes - head;
+            head = offset + bytes;
+            frameAllocations++;
+            return allocation;
+        }
+
+        // Call once the frame's GL commands reading from it were issued. Fences the region and makes the next one current,
+        // waiting until the GPU is done reading it
+        void EndFrame()
+        {
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            for(auto old : retired)
+                glDeleteBuffers(1, &old);
+            retired.clear();
+
+            stats.regionBytes = regionBytes;
+            stats.usedBytes = used;
+            stats.allocations = frameAllocations;
+            stats.waitMs = 0.0f;
+            used = 0;
+            frameAllocations = 0;
+
+            region = (region + 1) % FRAMES;
+            head = region * regionBytes;
+            if(!fences[region])
+                return;
+            if(glClientWaitSync(fences[region], 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                auto start = std::chrono::steady_clock::now();
+                while(glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                {
+                }
+                stats.waits++;
+                stats.waitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+
+        unsigned int GetBuffer() const
+        {
+            return buffer;
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        size_t RegionEnd() const
+        {
+            return (region + 1) * regionBytes;
+        }
+
+        void Create(size_t bytes)
+        {
+            regionBytes = bytes;
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferStorage(GL_COPY_WRITE_BUFFER, regionBytes * FRAMES, nullptr, flags);
+            mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionBytes * FRAMES, flags);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            region = 0;
+            head = 0;
+        }
+
+        void DeleteFences()
+        {
+            for(auto& fence : fences)
+            {
+                if(fence)
+                    glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+
+        // A new buffer with larger regions, the current one kept mapped until the frame ends. The fences go with the old
+        // buffer, as nothing reads the new one yet
+        void Grow(size_t bytes)
+        {
+            DeleteFences();
+            retired.push_back(buffer);
+            Create(bytes);
+            stats.grows++;
+        }
+
+        size_t regionBytes = 0;
+        unsigned int buffer = 0;
+        uint8_t* mapped = nullptr;
+        int region = 0;
+        size_t head = 0;
+        size_t used = 0;
+        unsigned int frameAllocations = 0;
+        std::array<GLsync, FRAMES> fences{};
+        std::vector<unsigned int> retired;
+        Stats stats;
+    };
+}
+#endif
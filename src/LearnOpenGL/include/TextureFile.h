@@ -0,0 +1,186 @@
+
+
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <stb/stb_image.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // 8 bit per channel image, as decoded from disk
+    struct Image
+    {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<unsigned char> pixels;
+
+        unsigned char* At(int x, int y)
+        {
+            return &pixels[(y * width + x) * channels];
+        }
+
+        const unsigned char* At(int x, int y) const
+        {
+            return &pixels[(y * width + x) * channels];
+        }
+    };
+
+    inline bool LoadImage(const std::filesystem::path& path, Image& image, int desiredChannels = 0)
+    {
+        int channels;
+        auto data = stbi_load(path.string().c_str(), &image.width, &image.height, &channels, desiredChannels);
+        if(!data)
+        {
+            std::cout << "Error:" << stbi_failure_reason() << " while loading image at " << path.string() << '\n';
+            return false;
+        }
+
+        image.channels = desiredChannels ? desiredChannels : channels;
+        image.pixels.assign(data, data + image.width * image.height * image.channels);
+        stbi_image_free(data);
+        return true;
+    }
+
+    // Baked texture, ready to be uploaded as is. The file is a small header followed by every level of every face
+    struct TextureFile
+    {
+        enum class Format : uint32_t
+        {
+            RGBA8 = 0,
+            BC1_SRGB = 1,
+            RG16F = 2,
+            RGBA32F = 3,
+        };
+
+        Format format = Format::RGBA8;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t faces = 1;
+        uint32_t levels = 1;
+        // face major, then level
+        std::vector<std::vector<unsigned char>> data;
+
+        static constexpr char MAGIC[4] = {'L', 'T', 'E', 'X'};
+        // 2: the alpha of packed normal/depth textures holds the cone ratio
+        static constexpr uint32_t VERSION = 2;
+
+        std::vector<unsigned char>& Level(uint32_t face, uint32_t level)
+        {
+            return data[face * levels + level];
+        }
+
+        const std::vector<unsigned char>& Level(uint32_t face, uint32_t level) const
+        {
+            return data[face * levels + level];
+        }
+
+        uint32_t LevelWidth(uint32_t level) const
+        {
+            return std::max(width >> level, 1u);
+        }
+
+        uint32_t LevelHeight(uint32_t level) const
+        {
+            return std::max(height >> level, 1u);
+        }
+
+        bool Save(const std::filesystem::path& path) const
+        {
+            std::filesystem::create_directories(path.parent_path());
+            std::ofstream file{path, std::ios::binary};
+            if(!file)
+            {
+                std::cout << "Error: could not write texture at " << path.string() << '\n';
+                return false;
+            }
+
+            uint32_t header[] = {VERSION, (uint32_t)format, width, height, faces, levels};
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write((const char*)header, sizeof(header));
+            for(auto& level : data)
+            {
+                uint32_t size = level.size();
+                file.write((const char*)&size, sizeof(size));
+                file.write((const char*)level.data(), size);
+            }
+            return (bool)file;
+        }
+
+        // false when path is missing or was baked by another version
+        static bool IsCurrent(const std::filesystem::path& path)
+        {
+            std::ifstream file{path, std::ios::binary};
+            char magic[4];
+            uint32_t version;
+            file.read(magic, sizeof(magic));
+            file.read((char*)&version, sizeof(version));
+            return file && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 && version == VERSION;
+        }
+
+        bool Load(const std::filesystem::path& path)
+        {
+            std::ifstream file{path, std::ios::binary};
+            if(!file)
+                return false;
+
+            char magic[4];
+            uint32_t header[6];
+            file.read(magic, sizeof(magic));
+            file.read((char*)header, sizeof(header));
+            if(!file || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || header[0] != VERSION)
+            {
+                std::cout << "Error: " << path.string() << " is not a baked texture or was baked by an older version\n";
+                return false;
+            }
+
+            format = (Format)header[1];
+            width = header[2];
+            height = header[3];
+            faces = header[4];
+            levels = header[5];
+            data.resize(faces * levels);
+            for(auto& level : data)
+            {
+                uint32_t size;
+                file.read((char*)&size, sizeof(size));
+                level.resize(size);
+                file.read((char*)level.data(), size);
+            }
+            return (bool)file;
+        }
+    };
+
+    // true when target doesn't exist or any of the sources has been modified after it was baked
+    inline bool NeedsBake(const std::filesystem::path& target, const std::vector<std::filesystem::path>& sources)
+    {
+        std::error_code error;
+        auto bakedTime = std::filesystem::last_write_time(target, error);
+        if(error)
+            return true;
+
+        for(auto& source : sources)
+        {
+            auto sourceTime = std::filesystem::last_write_time(source, error);
+            if(!error && sourceTime > bakedTime)
+                return true;
+        }
+        return false;
+    }
+
+    // NeedsBake for a baked texture, which is also stale when an older version wrote it
+    inline bool NeedsTextureBake(const std::filesystem::path& target, const std::vector<std::filesystem::path>& sources)
+    {
+        return NeedsBake(target, sources) || !TextureFile::IsCurrent(target);
+    }
+}
+#endif
@@ -0,0 +1,395 @@
+
+
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <UploadThread.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Keeps the memory used by every 2D texture under a byte budget.
+    // Textures that haven't been used recently are demoted by dropping their top mip levels,
+    // and they're promoted back to full resolution (reloaded) as soon as they're used again.
+    class TextureResidency
+    {
+    public:
+        struct Counters
+        {
+            size_t budgetBytes = 0;
+            size_t residentBytes = 0;   // what is currently on the GPU
+            size_t fullBytes = 0;       // what would be on the GPU if every texture was at full resolution
+            unsigned int textures = 0;
+            unsigned int demoted = 0;   // textures currently missing top mips
+            unsigned int evictions = 0; // mip levels dropped so far
+            unsigned int reloads = 0;   // textures brought back to full resolution so far
+            unsigned int uploading = 0; // promotions waiting on the upload thread
+        };
+
+        // re-uploads the texture at full resolution into the currently bound GL_TEXTURE_2D
+        using Reloader = std::function<bool()>;
+
+        static TextureResidency& Get()
+        {
+            static TextureResidency residency;
+            return residency;
+        }
+
+        void SetBudget(size_t bytes)
+        {
+            counters.budgetBytes = bytes;
+        }
+
+        // maximum number of textures brought back to full resolution per frame, so promotions don't stall a single frame
+        void SetMaxReloadsPerFrame(unsigned int reloads)
+        {
+            maxReloadsPerFrame = reloads;
+        }
+
+        // Promotions then reload on thread, into a staging texture copied over once its Poll hands it back, instead of
+        // stalling Update. Needs glCopyImageSubData, core since 4.3, without which they stay in Update
+        void SetUploadThread(UploadThread* thread)
+        {
+            // uploads in flight are forgotten, their staging textures deleted if they're ever handed back
+            for(auto& pair : entries)
+            {
+                if(pair.second.uploading)
+                    Unreserve(pair.second);
+            }
+            uploads = glCopyImageSubData ? thread : nullptr;
+        }
+
+        // Starts tracking a texture whose level 0 has already been uploaded with a full mip chain. Demoting rebuilds the
+        // mips by averaging, so textures whose texels mustn't be averaged, like cone ratios, are counted but never demoted
+        void Register(unsigned int id, int width, int height, GLenum format, Reloader reloader, bool demotable = true)
+        {
+            Entry entry;
+            entry.width = width;
+            entry.height = height;
+            entry.format = format;
+            entry.levels = MipCount(width, height);
+            entry.lastUsed = frame;
+            entry.reloader = std::move(reloader);
+            entry.demotable = demotable;
+
+            Unregister(id);
+            counters.fullBytes += SizeOf(entry, 0);
+            counters.residentBytes += SizeOf(entry, 0);
+            counters.textures++;
+            entries[id] = std::move(entry);
+        }
+
+        void Unregister(unsigned int id)
+        {
+            auto it = entries.find(id);
+            if(it == entries.end())
+                return;
+
+            auto& entry = it->second;
+            counters.fullBytes -= SizeOf(entry, 0);
+            counters.residentBytes -= SizeOf(entry, entry.skip);
+            counters.textures--;
+            if(entry.skip > 0)
+                counters.demoted--;
+            // its staging texture is thrown away when the upload is done
+            if(entry.uploading)
+                Unreserve(entry);
+            entries.erase(it);
+        }
+
+        // marks a texture as used this frame. Demoted textures get queued for promotion
+        void Touch(unsigned int id)
+        {
+            auto it = entries.find(id);
+            if(it == entries.end())
+                return;
+
+            it->second.lastUsed = frame;
+        }
+
+        // call once per frame, after drawing. Promotes used textures and demotes the least recently used ones until we're within budget
+        void Update()
+        {
+            // promotion of textures that were used this frame, while there's room for them
+            unsigned int reloads = 0;
+            for(auto id : SortedByUse(true))
+            {
+                if(reloads >= maxReloadsPerFrame)
+                    break;
+
+                auto& entry = entries[id];
+                if(entry.skip == 0 || entry.lastUsed != frame || entry.uploading)
+                    continue;
+
+                // room is made for uploads still in flight too, their bytes land a few frames later
+                auto extra = SizeOf(entry, 0) - SizeOf(entry, entry.skip);
+                auto needed = counters.residentBytes + reservedBytes + extra;
+                if(needed > counters.budgetBytes && !MakeRoom(needed - counters.budgetBytes, id, false))
+                    continue;
+
+                if(uploads)
+                {
+                    Upload(id, entry, extra);
+                    reloads++;
+                }
+                else if(Promote(id, entry))
+                    reloads++;
+            }
+
+            // demotion, least recently used first. Textures used this frame are only demoted when there's no other way to meet the budget
+            if(counters.residentBytes > counters.budgetBytes)
+                MakeRoom(counters.residentBytes - counters.budgetBytes, 0, true);
+
+            frame++;
+        }
+
+        const Counters& GetCounters() const
+        {
+            return counters;
+        }
+
+    private:
+        struct Entry
+        {
+            int width;
+            int height;
+            GLenum format;
+            int levels;
+            int skip = 0;               // top mip levels currently dropped
+            unsigned long lastUsed = 0;
+            Reloader reloader;
+            bool demotable = true;
+            bool uploading = false;
+            size_t reserved = 0;        // bytes the upload will add
+        };
+
+        TextureResidency() = default;
+
+        static int MipCount(int width, int height)
+        {
+            int levels = 1;
+            while(width > 1 || height > 1)
+            {
+                width = std::max(width / 2, 1);
+                height = std::max(height / 2, 1);
+                levels++;
+            }
+            return levels;
+        }
+
+        static size_t Channels(GLenum format)
+        {
+            switch(format)
+            {
+                case GL_RED:
+                    return 1;
+                case GL_RG:
+                    return 2;
+                case GL_RGB:
+                    return 3;
+                default:
+                    return 4;
+            }
+        }
+
+        static size_t BytesPerPixel(GLenum format)
+        {
+            // three channel formats are padded to four by pretty much every driver
+            switch(format)
+            {
+                case GL_RED:
+                    return 1;
+                case GL_RG:
+                    return 2;
+                default:
+                    return 4;
+            }
+        }
+
+        // size of the mip chain starting at level skip
+        static size_t SizeOf(const Entry& entry, int skip)
+        {
+            size_t size = 0;
+            for(int level = skip; level < entry.levels; level++)
+            {
+                size_t w = std::max(entry.width >> level, 1);
+                size_t h = std::max(entry.height >> level, 1);
+                size += w * h * BytesPerPixel(entry.format);
+            }
+            return size;
+        }
+
+        // ids ordered by the frame they were last used in
+        std::vector<unsigned int> SortedByUse(bool mostRecentFirst) const
+        {
+            std::vector<unsigned int> ids;
+            ids.reserve(entries.size());
+            for(auto& pair : entries)
+                ids.push_back(pair.first);
+
+            std::sort(ids.begin(), ids.end(), [this, mostRecentFirst](unsigned int a, unsigned int b)
+            {
+                auto usedA = entries.at(a).lastUsed;
+                auto usedB = entries.at(b).lastUsed;
+                return mostRecentFirst ? usedA > usedB : usedA < usedB;
+            });
+            return ids;
+        }
+
+        // drops top mips from the least recently used textures until bytes have been freed. Never touches keep
+        bool MakeRoom(size_t bytes, unsigned int keep, bool demoteUsed)
+        {
+            size_t freed = 0;
+            for(auto id : SortedByUse(false))
+            {
+                auto& entry = entries[id];
+                if(id == keep || !entry.demotable || entry.uploading || (entry.lastUsed == frame && !demoteUsed))
+                    continue;
+
+                while(freed < bytes && entry.skip < entry.levels - 1)
+                {
+                    auto before = SizeOf(entry, entry.skip);
+                    Demote(id, entry);
+                    freed += before - SizeOf(entry, entry.skip);
+                }
+
+                if(freed >= bytes)
+                    return true;
+            }
+            return false;
+        }
+
+        // replaces the texture storage with its next mip level, which we read back from the GPU so no disk access is needed
+        void Demote(unsigned int id, Entry& entry)
+        {
+            int width = std::max(entry.width >> (entry.skip + 1), 1);
+            int height = std::max(entry.height >> (entry.skip + 1), 1);
+
+            GLint internalFormat;
+            glBindTexture(GL_TEXTURE_2D, id);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+
+            std::vector<unsigned char> pixels(width * height * Channels(entry.format));
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glGetTexImage(GL_TEXTURE_2D, 1, entry.format, GL_UNSIGNED_BYTE, pixels.data());
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, entry.format, GL_UNSIGNED_BYTE, pixels.data());
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+            if(entry.skip == 0)
+                counters.demoted++;
+            counters.residentBytes -= SizeOf(entry, entry.skip) - SizeOf(entry, entry.skip + 1);
+            counters.evictions++;
+            entry.skip++;
+        }
+
+        bool Promote(unsigned int id, Entry& entry)
+        {
+            glBindTexture(GL_TEXTURE_2D, id);
+            if(!entry.reloader || !entry.reloader())
+            {
+                std::cout << "Error: could not reload texture " << id << '\n';
+                return false;
+            }
+
+            counters.residentBytes += SizeOf(entry, 0) - SizeOf(entry, entry.skip);
+            counters.demoted--;
+            counters.reloads++;
+            entry.skip = 0;
+            return true;
+        }
+
+        // The reloader runs on the upload thread, into a texture of its own so the one being drawn with is never written
+        // from another context. Names come from the share group, so the staging one can be generated here
+        void Upload(unsigned int id, Entry& entry, size_t extra)
+        {
+            unsigned int staging;
+            glGenTextures(1, &staging);
+            entry.uploading = true;
+            entry.reserved = extra;
+            reservedBytes += extra;
+            counters.uploading++;
+
+            auto reloader = entry.reloader;
+            uploads->Upload([staging, reloader]()
+            {
+                glBindTexture(GL_TEXTURE_2D, staging);
+                bool uploaded = reloader && reloader();
+                glBindTexture(GL_TEXTURE_2D, 0);
+                return uploaded;
+            },
+            [this, id, staging](bool uploaded)
+            {
+                Finish(id, staging, uploaded);
+            });
+        }
+
+        // Back on the GL thread once the upload's fence is signaled. The texture gets full size storage again and every
+        // level is copied over on the GPU, the same name keeps being drawn with
+        void Finish(unsigned int id, unsigned int staging, bool uploaded)
+        {
+            auto it = entries.find(id);
+            if(it != entries.end() && it->second.uploading)
+            {
+                auto& entry = it->second;
+                Unreserve(entry);
+                if(uploaded)
+                {
+                    GLint internalFormat;
+                    glBindTexture(GL_TEXTURE_2D, staging);
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+                    // copies need a complete texture, so every level is sized before the first one. Until then the
+                    // lower levels still have their demoted sizes
+                    glBindTexture(GL_TEXTURE_2D, id);
+                    for(int level = 0; level < entry.levels; level++)
+                    {
+                        int width = std::max(entry.width >> level, 1);
+                        int height = std::max(entry.height >> level, 1);
+                        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, entry.format, GL_UNSIGNED_BYTE, nullptr);
+                    }
+                    for(int level = 0; level < entry.levels; level++)
+                    {
+                        int width = std::max(entry.width >> level, 1);
+                        int height = std::max(entry.height >> level, 1);
+                        glCopyImageSubData(staging, GL_TEXTURE_2D, level, 0, 0, 0, id, GL_TEXTURE_2D, level, 0, 0, 0, width, height, 1);
+                    }
+
+                    counters.residentBytes += SizeOf(entry, 0) - SizeOf(entry, entry.skip);
+                    if(entry.skip > 0)
+                        counters.demoted--;
+                    counters.reloads++;
+                    entry.skip = 0;
+                }
+                else
+                    std::cout << "Error: could not reload texture " << id << '\n';
+            }
+            glDeleteTextures(1, &staging);
+        }
+
+        void Unreserve(Entry& entry)
+        {
+            reservedBytes -= entry.reserved;
+            counters.uploading--;
+            entry.uploading = false;
+            entry.reserved = 0;
+        }
+
+        std::unordered_map<unsigned int, Entry> entries;
+        Counters counters;
+        UploadThread* uploads = nullptr;
+        size_t reservedBytes = 0;
+        unsigned long frame = 1;
+        unsigned int maxReloadsPerFrame = 2;
+    };
+}
+#endif
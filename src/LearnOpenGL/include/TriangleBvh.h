@@ -0,0 +1,522 @@
+
+
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRIANGLE_BVH_SSE
+#endif
+
+namespace LearnOpenGL
+{
+    // Ray casting against the triangles of a mesh. A 4 wide BVH: every node holds the boxes of its 4 children side by side,
+    // so a ray is tested against all of them at once with SSE. Nodes and triangles are flat arrays, the triangles sorted
+    // in leaf order with their first vertex and edges precomputed.
+    //
+    // Built with a binned surface area heuristic, the subtrees under the root on their own threads. Everything the queries
+    // need is in the two arrays, so Save and Load just write them out and read them back
+    class TriangleBvh
+    {
+    public:
+        static constexpr uint32_t LEAF_SIZE = 4;
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        struct Hit
+        {
+            uint32_t triangle = NONE;   // index of the triangle in the mesh indices, divided by 3
+            float distance = std::numeric_limits<float>::infinity();
+            glm::vec2 barycentric{0.0f};  // of the second and third vertex
+        };
+
+        // indices is a triangle list into positions
+        void Build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, unsigned int threads = std::thread::hardware_concurrency())
+        {
+            uint32_t count = indices.size() / 3;
+            nodes.clear();
+            triangles.clear();
+            if(!count)
+                return;
+
+            boxes.resize(count);
+            centroids.resize(count);
+            order.resize(count);
+            for(uint32_t i = 0; i < count; i++)
+            {
+                auto& a = positions[indices[i * 3]];
+                auto& b = positions[indices[i * 3 + 1]];
+                auto& c = positions[indices[i * 3 + 2]];
+                boxes[i] = {glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c))};
+                centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+                order[i] = i;
+            }
+
+            // the root children are split here, their subtrees built in parallel and appended after the root
+            Range ranges[4];
+            int rangeCount = Partition({0, count}, 0, ranges);
+            std::vector<Node> subtrees[4];
+            ParallelFor(0, rangeCount, [&](int i)
+            {
+                if(!IsLeaf(ranges[i]))
+                    BuildNode(ranges[i], 1, subtrees[i]);
+            }, threads);
+
+            nodes.resize(1);
+            for(int i = 0; i < 4; i++)
+            {
+                if(i >= rangeCount)
+                {
+                    SetChild(nodes[0], i, EmptyBox(), LEAF);
+                    continue;
+                }
+                uint32_t child = LEAF | ranges[i].first << 4 | ranges[i].count;
+                if(!IsLeaf(ranges[i]))
+                {
+                    uint32_t offset = nodes.size();
+                    for(auto node : subtrees[i])
+                    {
+                        for(auto& grandchild : node.children)
+                        {
+                            if(!(grandchild & LEAF))
+                                grandchild += offset;
+                        }
+                        nodes.push_back(node);
+                    }
+                    child = offset;
+                }
+                SetChild(nodes[0], i, Bounds(ranges[i]), child);
+            }
+
+            triangles.resize(count);
+            for(uint32_t i = 0; i < count; i++)
+            {
+                uint32_t triangle = order[i];
+                auto& a = positions[indices[triangle * 3]];
+                auto& b = positions[indices[triangle * 3 + 1]];
+                auto& c = positions[indices[triangle * 3 + 2]];
+                triangles[i] = {a, b - a, c - a, triangle};
+            }
+            boxes = {};
+            centroids = {};
+            order = {};
+        }
+
+        // closest triangle along the ray within maxDistance, both sides count. dir doesn't need to be normalized, the
+        // distance is in units of its length
+        Hit Raycast(glm::vec3 origin, glm::vec3 dir, float maxDistance = std::numeric_limits<float>::infinity()) const
+        {
+            Hit hit;
+            hit.distance = maxDistance;
+            Traverse<false>(origin, dir, hit);
+            if(hit.triangle == NONE)
+                hit.distance = std::numeric_limits<float>::infinity();
+            return hit;
+        }
+
+        // line of sight, stops at the first triangle between the two points
+        bool Occluded(glm::vec3 from, glm::vec3 to) const
+        {
+            Hit hit;
+            hit.distance = 1.0f;
+            return Traverse<true>(from, to - from, hit);
+        }
+
+        bool Empty() const
+        {
+            return triangles.empty();
+        }
+
+        size_t GetNodeCount() const
+        {
+            return nodes.size();
+        }
+
+        size_t GetTriangleCount() const
+        {
+            return triangles.size();
+        }
+
+        bool Save(const std::filesystem::path& path) const
+        {
+            std::filesystem::create_directories(path.parent_path());
+            std::ofstream file{path, std::ios::binary};
+            if(!file)
+            {
+                std::cout << "Error: could not write BVH at " << path.string() << '\n';
+                return false;
+            }
+
+            uint32_t header[] = {VERSION, (uint32_t)nodes.size(), (uint32_t)triangles.size()};
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write((const char*)header, sizeof(header));
+            file.write((const char*)nodes.data(), nodes.size() * sizeof(Node));
+            file.write((const char*)triangles.data(), triangles.size() * sizeof(Triangle));
+            return (bool)file;
+        }
+
+        bool Load(const std::filesystem::path& path)
+        {
+            std::ifstream file{path, std::ios::binary};
+            if(!file)
+                return false;
+
+            char magic[4];
+            uint32_t header[3];
+            file.read(magic, sizeof(magic));
+            file.read((char*)header, sizeof(header));
+            if(!file || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || header[0] != VERSION)
+            {
+                std::cout << "Error: " << path.string() << " is not a BVH or was built by an older version\n";
+                return false;
+            }
+
+            nodes.resize(header[1]);
+            triangles.resize(header[2]);
+            file.read((char*)nodes.data(), nodes.size() * sizeof(Node));
+            file.read((char*)triangles.data(), triangles.size() * sizeof(Triangle));
+            if(!file)
+            {
+                nodes.clear();
+                triangles.clear();
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        static constexpr char MAGIC[4] = {'L', 'B', 'V', 'H'};
+        static constexpr uint32_t VERSION = 1;
+        static constexpr int BINS = 16;
+        // below it only median splits, they halve the triangles so the depth stays bounded
+        static constexpr int SAH_DEPTH = 24;
+        static constexpr int STACK_SIZE = 256;
+        // a leaf child is LEAF | first triangle << 4 | count, an empty slot is a leaf of none
+        static constexpr uint32_t LEAF = 0x80000000;
+        static constexpr uint32_t MAX_LEAF = 15;
+
+        struct Box
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+
+        // the 4 children boxes as structure of arrays, one SSE register per bound
+        struct Node
+        {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            uint32_t children[4];
+        };
+
+        struct Triangle
+        {
+            glm::vec3 v0;
+            glm::vec3 edge1;
+            glm::vec3 edge2;
+            uint32_t index;
+        };
+
+        struct Range
+        {
+            uint32_t first;
+            uint32_t count;
+            bool leaf = false;      // no split pays off
+        };
+
+        static bool IsLeaf(const Range& range)
+        {
+            return range.count <= LEAF_SIZE || range.leaf;
+        }
+
+        static Box EmptyBox()
+        {
+            return {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())};
+        }
+
+        static float Area(const Box& box)
+        {
+            auto size = glm::max(box.max - box.min, glm::vec3(0.0f));
+            return size.x * size.y + size.y * size.z + size.z * size.x;
+        }
+
+        static void SetChild(Node& node, int slot, const Box& box, uint32_t child)
+        {
+            node.minX[slot] = box.min.x;
+            node.minY[slot] = box.min.y;
+            node.minZ[slot] = box.min.z;
+            node.maxX[slot] = box.max.x;
+            node.maxY[slot] = box.max.y;
+            node.maxZ[slot] = box.max.z;
+            node.children[slot] = child;
+        }
+
+        Box Bounds(const Range& range) const
+        {
+            auto box = EmptyBox();
+            for(uint32_t i = range.first; i < range.first + range.count; i++)
+            {
+                box.min = glm::min(box.min, boxes[order[i]].min);
+                box.max = glm::max(box.max, boxes[order[i]].max);
+            }
+            return box;
+        }
+
+        // Splits the range where the surface area heuristic is lowest, returns the count of the first half, 0 when keeping
+        // it whole is cheaper. Ranges too big for a leaf, or too deep, are split at the median of their longest axis
+        uint32_t Split(const Range& range, int depth)
+        {
+            auto begin = order.begin() + range.first;
+            auto end = begin + range.count;
+            glm::vec3 centroidMin{std::numeric_limits<float>::max()}, centroidMax{-std::numeric_limits<float>::max()};
+            for(auto it = begin; it != end; ++it)
+            {
+                centroidMin = glm::min(centroidMin, centroids[*it]);
+                centroidMax = glm::max(centroidMax, centroids[*it]);
+            }
+
+            if(depth < SAH_DEPTH)
+            {
+                int bestAxis = -1;
+                int bestBin = 0;
+                float bestCost = range.count * Area(Bounds(range));
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float extent = centroidMax[axis] - centroidMin[axis];
+                    if(extent <= 0.0f)
+                        continue;
+                    float scale = BINS / extent;
+                    Box bins[BINS];
+                    uint32_t binCounts[BINS] = {};
+                    for(auto& bin : bins)
+                        bin = EmptyBox();
+                    for(auto it = begin; it != end; ++it)
+                    {
+                        int bin = std::min((int)((centroids[*it][axis] - centroidMin[axis]) * scale), BINS - 1);
+                        binCounts[bin]++;
+                        bins[bin].min = glm::min(bins[bin].min, boxes[*it].min);
+                        bins[bin].max = glm::max(bins[bin].max, boxes[*it].max);
+                    }
+
+                    float leftArea[BINS - 1];
+                    uint32_t leftCount[BINS - 1];
+                    auto sweep = EmptyBox();
+                    uint32_t sum = 0;
+                    for(int bin = 0; bin < BINS - 1; bin++)
+                    {
+                        sweep.min = glm::min(sweep.min, bins[bin].min);
+                        sweep.max = glm::max(sweep.max, bins[bin].max);
+                        sum += binCounts[bin];
+                        leftArea[bin] = Area(sweep);
+                        leftCount[bin] = sum;
+                    }
+                    sweep = EmptyBox();
+                    sum = 0;
+                    for(int bin = BINS - 1; bin > 0; bin--)
+                    {
+                        sweep.min = glm::min(sweep.min, bins[bin].min);
+                        sweep.max = glm::max(sweep.max, bins[bin].max);
+                        sum += binCounts[bin];
+                        if(!sum || !leftCount[bin - 1])
+                            continue;
+                        float cost = leftArea[bin - 1] * leftCount[bin - 1] + Area(sweep) * sum;
+                        if(cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestBin = bin;
+                        }
+                    }
+                }
+
+                if(bestAxis >= 0)
+                {
+                    float scale = BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+                    auto middle = std::partition(begin, end, [&](uint32_t triangle)
+                    {
+                        return std::min((int)((centroids[triangle][bestAxis] - centroidMin[bestAxis]) * scale), BINS - 1) < bestBin;
+                    });
+                    return middle - begin;
+                }
+                if(range.count <= MAX_LEAF)
+                    return 0;
+            }
+
+            auto extent = centroidMax - centroidMin;
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            auto middle = begin + range.count / 2;
+            std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b)
+            {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+            return range.count / 2;
+        }
+
+        // cuts a range in up to 4, splitting the biggest part each time, returns how many
+        int Partition(const Range& range, int depth, Range* ranges)
+        {
+            int count = 1;
+            ranges[0] = range;
+            while(count < 4)
+            {
+                int biggest = -1;
+                for(int i = 0; i < count; i++)
+                {
+                    if(!IsLeaf(ranges[i]) && (biggest < 0 || ranges[i].count > ranges[biggest].count))
+                        biggest = i;
+                }
+                if(biggest < 0)
+                    break;
+
+                auto& part = ranges[biggest];
+                uint32_t left = Split(part, depth);
+                if(!left)
+                {
+                    part.leaf = true;
+                    continue;
+                }
+                ranges[count++] = {part.first + left, part.count - left};
+                part.count = left;
+            }
+            return count;
+        }
+
+        // appends the node of the range and its subtree to out, returns its index there
+        uint32_t BuildNode(const Range& range, int depth, std::vector<Node>& out)
+        {
+            Range ranges[4];
+            int count = Partition(range, depth, ranges);
+            uint32_t index = out.size();
+            out.emplace_back();
+
+            uint32_t children[4];
+            for(int i = 0; i < count; i++)
+                children[i] = IsLeaf(ranges[i]) ? LEAF | ranges[i].first << 4 | ranges[i].count : BuildNode(ranges[i], depth + 1, out);
+            for(int i = 0; i < 4; i++)
+                SetChild(out[index], i, i < count ? Bounds(ranges[i]) : EmptyBox(), i < count ? children[i] : LEAF);
+            return index;
+        }
+
+        // Moller Trumbore, two sided. One branch at the end: rays are incoherent, the early outs would mostly be mispredicted
+        static bool Intersect(const Triangle& triangle, glm::vec3 origin, glm::vec3 dir, Hit& hit)
+        {
+            auto p = glm::cross(dir, triangle.edge2);
+            float inverseDet = 1.0f / glm::dot(triangle.edge1, p);
+            auto t = origin - triangle.v0;
+            auto q = glm::cross(t, triangle.edge1);
+            float u = glm::dot(t, p) * inverseDet;
+            float v = glm::dot(dir, q) * inverseDet;
+            float distance = glm::dot(triangle.edge2, q) * inverseDet;
+            // a parallel ray divides by 0 and fails every test, inf or nan
+            if(!((u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (distance > 0.0f) & (distance < hit.distance)))
+                return false;
+            hit = {triangle.index, distance, {u, v}};
+            return true;
+        }
+
+        // nearest child first, ANY returns on the first hit
+        template<bool ANY>
+        bool Traverse(glm::vec3 origin, glm::vec3 dir, Hit& hit) const
+        {
+            if(nodes.empty())
+                return false;
+
+            auto inverseDir = 1.0f / dir;
+#ifdef TRIANGLE_BVH_SSE
+            __m128 originX = _mm_set1_ps(origin.x), originY = _mm_set1_ps(origin.y), originZ = _mm_set1_ps(origin.z);
+            __m128 inverseX = _mm_set1_ps(inverseDir.x), inverseY = _mm_set1_ps(inverseDir.y), inverseZ = _mm_set1_ps(inverseDir.z);
+#endif
+            // nodes with the distance the ray enters them, left uninitialized, a std::pair array would be cleared every ray
+            uint32_t stack[STACK_SIZE];
+            float stackEnters[STACK_SIZE];
+            int size = 0;
+            stack[size] = 0;
+            stackEnters[size++] = 0.0f;
+            while(size)
+            {
+                size--;
+                if(stackEnters[size] >= hit.distance)
+                    continue;
+                auto& node = nodes[stack[size]];
+
+                // entry distance of the ray in the 4 children boxes
+                alignas(16) float enters[4];
+                int mask = 0;
+#ifdef TRIANGLE_BVH_SSE
+                __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), originX), inverseX);
+                __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), originX), inverseX);
+                __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), originY), inverseY);
+                __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), originY), inverseY);
+                __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), originZ), inverseZ);
+                __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), originZ), inverseZ);
+                __m128 near = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), _mm_setzero_ps()));
+                __m128 far = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(hit.distance)));
+                mask = _mm_movemask_ps(_mm_cmple_ps(near, far));
+                _mm_store_ps(enters, near);
+#else
+                for(int i = 0; i < 4; i++)
+                {
+                    auto t0 = (glm::vec3(node.minX[i], node.minY[i], node.minZ[i]) - origin) * inverseDir;
+                    auto t1 = (glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]) - origin) * inverseDir;
+                    auto near = glm::min(t0, t1);
+                    auto far = glm::max(t0, t1);
+                    enters[i] = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+                    if(enters[i] <= std::min(std::min(far.x, far.y), std::min(far.z, hit.distance)))
+                        mask |= 1 << i;
+                }
+#endif
+                // leaves now, inner children sorted far to near on the stack
+                int inner[4];
+                int innerCount = 0;
+                for(int i = 0; mask; i++, mask >>= 1)
+                {
+                    if(!(mask & 1))
+                        continue;
+                    uint32_t child = node.children[i];
+                    if(child & LEAF)
+                    {
+                        uint32_t first = (child & ~LEAF) >> 4;
+                        for(uint32_t t = first; t < first + (child & 15); t++)
+                        {
+                            if(Intersect(triangles[t], origin, dir, hit) && ANY)
+                                return true;
+                        }
+                        continue;
+                    }
+                    int slot = innerCount++;
+                    for(; slot > 0 && enters[inner[slot - 1]] < enters[i]; slot--)
+                        inner[slot] = inner[slot - 1];
+                    inner[slot] = i;
+                }
+                for(int i = 0; i < innerCount; i++)
+                {
+                    stack[size] = node.children[inner[i]];
+                    stackEnters[size++] = enters[inner[i]];
+                }
+            }
+            return hit.triangle != NONE;
+        }
+
+        std::vector<Node> nodes;
+        std::vector<Triangle> triangles;
+
+        // build only
+        std::vector<Box> boxes;
+        std::vector<glm::vec3> centroids;
+        std::vector<uint32_t> order;
+    };
+}
+#endif
@@ -0,0 +1,167 @@
+
+
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LearnOpenGL
+{
+    // Fills buffers and textures on its own thread and context, so loading from disk and copying to the GPU never
+    // stall a frame. The context has to share objects with the one drawing: make it current in start, and release it
+    // in stop. Each upload is fenced once issued, and Poll hands it back on the GL thread only once the GPU is done with it.
+    //
+    // An object filled here is only safe to use on the GL thread from its done on, after binding it again. Names can be
+    // generated on either side, they belong to the share group
+    class UploadThread
+    {
+    public:
+        // runs on the upload thread, with its context current. Returns whether it uploaded anything
+        using Work = std::function<bool()>;
+        // runs on the thread calling Poll, with what work returned
+        using Done = std::function<void(bool)>;
+
+        struct Stats
+        {
+            unsigned int pending = 0;   // queued, being uploaded or waiting on their fence
+            unsigned int uploads = 0;   // handed back by Poll so far
+            float uploadMs = 0.0f;      // the last one, on the upload thread
+        };
+
+        explicit UploadThread(std::function<void()> start = {}, std::function<void()> stop = {})
+            : start(std::move(start)), stop(std::move(stop))
+        {
+            thread = std::thread([this]() { Loop(); });
+        }
+
+        ~UploadThread()
+        {
+            Stop();
+        }
+
+        UploadThread(const UploadThread&) = delete;
+        UploadThread& operator=(const UploadThread&) = delete;
+
+        void Upload(Work work, Done done)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back({std::move(work), std::move(done)});
+            }
+            changed.notify_one();
+        }
+
+        // GL thread, once per frame. Calls done for every upload the GPU has finished, in the order they were queued
+        void Poll()
+        {
+            std::vector<Finished> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                size_t count = 0;
+                while(count < finished.size() && glClientWaitSync(finished[count].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+                    count++;
+                ready.assign(std::make_move_iterator(finished.begin()), std::make_move_iterator(finished.begin() + count));
+                finished.erase(finished.begin(), finished.begin() + count);
+
+                stats.pending = (unsigned int)(queue.size() + finished.size()) + (busy ? 1 : 0);
+                stats.uploads += (unsigned int)count;
+            }
+
+            for(auto& upload : ready)
+            {
+                glDeleteSync(upload.fence);
+                if(upload.done)
+                    upload.done(upload.result);
+            }
+        }
+
+        // Joins once the current upload is issued. Queued ones are dropped, as are finished ones never polled, the
+        // objects they filled staying with the share group
+        void Stop()
+        {
+            if(!thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            thread.join();
+        }
+
+        Stats GetStats()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        struct Queued
+        {
+            Work work;
+            Done done;
+        };
+
+        struct Finished
+        {
+            GLsync fence;
+            bool result;
+            Done done;
+        };
+
+        void Loop()
+        {
+            if(start)
+                start();
+            while(true)
+            {
+                Queued upload;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [this]() { return !queue.empty() || stopping; });
+                    if(stopping)
+                        break;
+                    upload = std::move(queue.front());
+                    queue.pop_front();
+                    busy = true;
+                }
+
+                auto begin = std::chrono::steady_clock::now();
+                bool result = upload.work();
+                // the flush makes sure the fence gets signaled without anything else being issued on this context
+                GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();
+                float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back({fence, result, std::move(upload.done)});
+                busy = false;
+                stats.uploadMs = ms;
+            }
+            if(stop)
+                stop();
+        }
+
+        std::function<void()> start;
+        std::function<void()> stop;
+
+        std::deque<Queued> queue;
+        std::deque<Finished> finished;
+        bool busy = false;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable changed;
+        Stats stats;
+        std::thread thread;
+    };
+}
+#endif
@@ -3,6 +3,7 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -12,9 +13,54 @@
 #include <vector>
 #include <cmath>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 
 #include <Shader.h>
 #include <Camera.h>
+#include <TextureResidency.h>
+#include <TextureFile.h>
+#include <NormalDepthMap.h>
+#include <Cubemap.h>
+#include <ImageBasedLighting.h>
+#include <RenderQueue.h>
+#include <StreamBuffer.h>
+#include <UploadThread.h>
+#include <LightClusters.h>
+#include <Bvh.h>
+#include <JobSystem.h>
+#include <RenderThread.h>
+#include <Scene.h>
+#include <TriangleBvh.h>
+#include <Culling.h>
+#include <Frustum.h>
+#include <OcclusionCuller.h>
+#include <GBuffer.h>
+#include <FragmentCounter.h>
+#include <PointShadows.h>
+#include <CascadedShadows.h>
+
+// uploads the image at path into the currently bound GL_TEXTURE_2D, with a full mip chain
+bool UploadTexture(std::filesystem::path path, int format, int glFormat, int* width = nullptr, int* height = nullptr)
+{
+    int w, h, nrChannels;
+    auto data = stbi_load(path.string().c_str(), &w, &h, &nrChannels, 0);
+    if(!data)
+    {
+        std::cout << "Error:" << stbi_failure_reason() <<" while loading texture at " << path.string().c_str() << '\n';
+        return false;
+    }
+
+    glTexImage2D(GL_TEXTURE_2D, 0, glFormat, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    stbi_image_free(data);
+
+    if(width)
+        *width = w;
+    if(height)
+        *height = h;
+    return true;
+}
 
 unsigned int GenTexture(std::filesystem::path path, int textureUnit = GL_TEXTURE0, int format = GL_RGB, int glFormat = GL_RGB)
 {
@@ -23,24 +69,61 @@ unsigned int GenTexture(std::filesystem::path path, int textureUnit = GL_TEXTURE
     glActiveTexture(textureUnit);
     glBindTexture(GL_TEXTURE_2D, texture);
 
-    int width, height, nrChannels;
-    auto data = stbi_load(path.string().c_str(), &width, &height, &nrChannels, 0);
-    if(data)
+    int width, height;
+    if(UploadTexture(path, format, glFormat, &width, &height))
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, glFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
     else
+        return -1;
+
+    // Track its memory. Reloading goes back to disk, as the top mips are gone from the GPU by then
+    LearnOpenGL::TextureResidency::Get().Register(texture, width, height, format, [path, format, glFormat]()
     {
-        std::cout << "Error:" << stbi_failure_reason() <<" while loading texture at " << path.string().c_str() << '\n';
+        return UploadTexture(path, format, glFormat);
+    });
+
+    return texture;
+}
+
+// uploads a baked texture into the currently bound GL_TEXTURE_2D, generating the levels it doesn't have
+bool UploadTexture(const LearnOpenGL::TextureFile& file, int glFormat)
+{
+    for(uint32_t level = 0; level < file.levels; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, glFormat, file.LevelWidth(level), file.LevelHeight(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, file.Level(0, level).data());
+
+    if(file.levels == 1)
+        glGenerateMipmap(GL_TEXTURE_2D);
+    return true;
+}
+
+unsigned int GenBakedTexture(std::filesystem::path path, int textureUnit = GL_TEXTURE0, int glFormat = GL_RGBA8, bool demotable = true)
+{
+    LearnOpenGL::TextureFile file;
+    if(!file.Load(path))
+    {
+        std::cout << "Error: could not load baked texture at " << path.string() << '\n';
         return -1;
     }
-    stbi_image_free(data);
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glActiveTexture(textureUnit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    UploadTexture(file, glFormat);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    LearnOpenGL::TextureResidency::Get().Register(texture, file.width, file.height, GL_RGBA, [path, glFormat]()
+    {
+        LearnOpenGL::TextureFile file;
+        return file.Load(path) && UploadTexture(file, glFormat);
+    }, demotable);
 
     return texture;
 }
@@ -48,6 +131,34 @@ unsigned int GenTexture(std::filesystem::path path, int textureUnit = GL_TEXTURE
 int WINDOW_WIDTH = 800;
 int WINDOW_HEIGHT = 600;
 
+// Texture memory budget
+size_t TEXTURE_BUDGET = 64 * 1024 * 1024;
+
+// Per frame data streamed to GL, by frame in flight. Grows when a frame needs more
+size_t STREAM_BUFFER_BYTES = 4 * 1024 * 1024;
+
+// Texture reloads on a second context and thread, when one can be created
+bool BACKGROUND_UPLOADS = true;
+
+// Draws pushed per frame when the render queue stress test is on
+int STRESS_PACKETS = 100000;
+
+// Lights in the swarm over the wall, toggled with M
+int LIGHT_SWARM = 1024;
+
+// Scale of the ambient light from the skybox
+float ENVIRONMENT_STRENGTH = 0.25f;
+
+// Point lights end where their brightest channel falls under this
+float LIGHT_THRESHOLD = 0.02f;
+
+// Sun shadows end this far from the camera
+float SUN_SHADOW_DISTANCE = 30.0f;
+
+// Fragment cost of the scene shaders relative to the depth prepass shader
+float FORWARD_SHADER_COST = 4.0f;
+float G_BUFFER_SHADER_COST = 1.5f;
+
 bool isKeyPressed(GLFWwindow* window, int key)
 {
     return glfwGetKey(window, key) == GLFW_PRESS;
@@ -85,67 +196,93 @@ enum ObjIndex
     QUAD
 };
 
-void DrawScene(glm::vec3* cubePos, unsigned int* VAO, LearnOpenGL::Shader& shader, unsigned int texture, 
-    unsigned int specularMap, unsigned int wood, unsigned int wallTexture = 0, unsigned int wallNormalTexture = 0, unsigned int wallDepthTexture = 0)
+// Where stress draw i goes, count of them spread behind the wall. The light cubes bob up and down
+glm::vec3 StressPosition(int i, float time)
 {
-    // Draw Cubes
-    for(unsigned int i = 0; i < 0; i++)
+    const int side = 64;
+    auto pos = glm::vec3{(i % side) - side / 2, ((i / side) % side) - side / 2, -10.0f - i / (side * side)} * 0.5f;
+    if(i % 3 == 0)
+        pos.y += 0.2f * sin(time + i);
+    return pos;
+}
+
+// Fills scene with count small draws behind the wall, alternating geometries and materials, to measure the queue under load
+void BuildStress(LearnOpenGL::Scene& scene, uint32_t plane, uint32_t light, const unsigned int* materials, int materialCount, int count)
+{
+    scene.Clear();
+    for(int i = 0; i < count; i++)
     {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, cubePos[i]);
-        model = glm::scale(model, glm::vec3(0.5f));
-        shader.use();
-        shader.setMatrix("model", glm::value_ptr(model));
-
-        // Draw
-        // Note: This triggers a segfault if the VerterAttribPointer of a in var is not defined
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, specularMap);
-        glBindVertexArray(VAO[CUBE]);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        if(i % 3)
+            scene.Create(plane, materials[i % materialCount], StressPosition(i, 0.0f), glm::vec3(0.1f));
+        else
+            scene.Create(light, materials[i % materialCount], StressPosition(i, 0.0f), glm::vec3(0.1f), LearnOpenGL::Scene::UNLIT);
     }
+}
 
-    // Draw Floor
-    glDisable(GL_CULL_FACE);
-    glm::mat4 floor{1.0f};
-    floor = glm::scale(floor, glm::vec3{5.0f});
-    shader.use();
-    shader.setMatrix("model", glm::value_ptr(floor));
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, wood);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, wood);
-    glBindVertexArray(VAO[PLANE]);
-    //glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    // Draw wall
-    glm::mat4 wall{1.0f};
-    wall = glm::translate(wall, glm::vec3(0.0f, 0.0f, -3.0f));
-    //wall = glm::rotate(wall, glm::radians(45.0f), glm::vec3{1.0f, 0.0f, 0.0f});
-    //wall = glm::rotate(wall, (float)glfwGetTime(), glm::normalize(glm::vec3(1.0, 0.0, 0.0)));
-    //wall = glm::scale(wall, glm::vec3{2.f / 25.f});
-    
-    shader.use();
-    shader.setMatrix("model", glm::value_ptr(wall));
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, wallTexture);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, wallTexture);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, wallNormalTexture);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, wallDepthTexture);
-    glBindVertexArray(VAO[PLANE]);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glEnable(GL_CULL_FACE);
+// Moves the stress light cubes
+void UpdateStress(LearnOpenGL::Scene& scene, float time)
+{
+    for(size_t i = 0; i < scene.Size(); i += 3)
+        scene.transforms.position[i] = StressPosition(i, time);
 }
 
+// Fills scene with count small colored lights over the wall, without geometry
+void BuildLightSwarm(LearnOpenGL::Scene& scene, int count)
+{
+    scene.Clear();
+    for(int i = 0; i < count; i++)
+    {
+        LearnOpenGL::PointLight light;
+        light.diffuse = (0.5f + 0.5f * glm::cos(i * 2.399963f + glm::vec3(0.0f, 2.1f, 4.2f))) * 0.5f;
+        light.specular = light.diffuse;
+        light.quadratic = 200.0f;
+        light.radius = 0.15f;
+        scene.AddLight(scene.Create(LearnOpenGL::Scene::NONE, 0, glm::vec3(0.0f)), light);
+    }
+}
+
+// Drifts the swarm lights, spread on a sunflower pattern
+void UpdateLightSwarm(LearnOpenGL::Scene& scene, float time)
+{
+    int count = scene.Size();
+    for(int i = 0; i < count; i++)
+    {
+        float angle = i * 2.399963f + time * 0.3f;
+        float dist = std::sqrt((i + 0.5f) / count);
+        scene.transforms.position[i] = glm::vec3(dist * std::cos(angle), dist * std::sin(angle), -2.85f + 0.05f * std::sin(time + i));
+    }
+}
+
+// What the simulation hands the render thread every frame: camera, lights and the draws with their transforms
+struct Frame
+{
+    int width = 0;
+    int height = 0;
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    LearnOpenGL::Frustum frustum;
+    glm::vec3 viewPos{0.0f};
+    glm::vec3 viewDir{0.0f, 0.0f, -1.0f};
+    float fov = 0.0f;   // vertical, radians
+    bool sun = false;
+    bool flashlight = false;
+    bool blinn = true;
+    bool deferred = false;
+    bool prepass = true;
+    bool stats = false; // the render thread writes its stats for the title
+    std::vector<LearnOpenGL::PointLight> pointLights;
+    std::vector<LearnOpenGL::DrawPacket> packets;
+    std::vector<LearnOpenGL::DrawPacket> staticCasters;
+    std::vector<LearnOpenGL::DrawPacket> dynamicCasters;
+};
+
 int main()
 {
     std::cout << "Hello world!\n";
 
+    // Job system, started first so this is its main thread. The render thread takes that over along with the context
+    auto& jobs = LearnOpenGL::JobSystem::Get();
+
     // GLFG setup
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -159,9 +296,9 @@ int main()
         glfwMakeContextCurrent(window);
         glfwSetFramebufferSizeCallback(window, [](GLFWwindow* window, int width, int height)
         {
+            // the render thread sets the viewport from the frame
             WINDOW_WIDTH = width;
             WINDOW_HEIGHT = height;
-            glViewport(0, 0, width, height);
         }); 
 
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); 
@@ -221,6 +358,7 @@ int main()
                 -1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
                 -1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left        
             };         
+            // Where the scene entities start
             glm::vec3 cubePos[] = {
                 glm::vec3(4.0f, -3.5f, 0.0),
                 glm::vec3(2.0f, 3.0f, 1.0),
@@ -249,6 +387,20 @@ int main()
             glm::vec3 p2{-1.0f, 1.0f, 0.0f};
             glm::vec3 p3{1.0f, 1.0f, 0.0f};
             glm::vec3 p4{1.0f, -1.0f, 0.0f};
+            // the plane positions again for the CPU occlusion culler
+            std::vector<glm::vec3> planeTriangles{p1, p2, p3, p1, p3, p4};
+
+            // and both meshes for picking
+            std::vector<glm::vec3> cubePositions;
+            for(size_t i = 0; i < sizeof(vertices) / sizeof(float); i += 8)
+                cubePositions.push_back({vertices[i], vertices[i + 1], vertices[i + 2]});
+            std::vector<unsigned int> cubeIndices(cubePositions.size());
+            for(unsigned int i = 0; i < cubeIndices.size(); i++)
+                cubeIndices[i] = i;
+            LearnOpenGL::TriangleBvh cubeBvh;
+            cubeBvh.Build(cubePositions, cubeIndices);
+            LearnOpenGL::TriangleBvh planeBvh;
+            planeBvh.Build(planeTriangles, {0, 1, 2, 3, 4, 5});
 
             glm::vec2 uv1{0.0f, 0.0f};
             glm::vec2 uv2{0.0f, 1.0f};
@@ -291,11 +443,24 @@ int main()
             std::filesystem::path lightFragPath = shaderFolder / "lightFrag.glsl";
             std::filesystem::path quadVertexPath = shaderFolder / "quadVertex.glsl";
             std::filesystem::path quadFragPath = shaderFolder / "quadFrag.glsl";
+            std::filesystem::path skyboxVertexPath = shaderFolder / "skyboxVertex.glsl";
+            std::filesystem::path skyboxFragPath = shaderFolder / "skyboxFrag.glsl";
+            std::filesystem::path gBufferFragPath = shaderFolder / "gBufferFrag.glsl";
+            std::filesystem::path deferredFragPath = shaderFolder / "deferredFrag.glsl";
+            std::filesystem::path depthFragPath = shaderFolder / "depthFrag.glsl";
             LearnOpenGL::Shader cubeShader{vertexPath.generic_string().c_str(), cubeFragPath.generic_string().c_str() };
             LearnOpenGL::Shader lightShader{vertexPath.generic_string().c_str(), lightFragPath.generic_string().c_str() };
             LearnOpenGL::Shader quadShader{quadVertexPath.generic_string().c_str(), quadFragPath.generic_string().c_str() };
+            LearnOpenGL::Shader skyboxShader{skyboxVertexPath.generic_string().c_str(), skyboxFragPath.generic_string().c_str() };
+            LearnOpenGL::Shader gBufferShader{vertexPath.generic_string().c_str(), gBufferFragPath.generic_string().c_str() };
+            LearnOpenGL::Shader deferredShader{quadVertexPath.generic_string().c_str(), deferredFragPath.generic_string().c_str() };
+            LearnOpenGL::Shader depthShader{vertexPath.generic_string().c_str(), depthFragPath.generic_string().c_str() };
             cubeShader.use();
 
+            // Shaders sampling the material, and shaders doing the lighting. Forward does both
+            LearnOpenGL::Shader* materialShaders[] = {&cubeShader, &gBufferShader, &depthShader};
+            LearnOpenGL::Shader* litShaders[] = {&cubeShader, &deferredShader};
+
             // Arrays and Buffers
             unsigned int VAO[4];
             glGenVertexArrays(4, VAO);
@@ -367,100 +532,418 @@ int main()
             std::filesystem::path wallPath = texturesDir / "bricks2.jpg";
             auto wall = GenTexture(wallPath, GL_TEXTURE0, GL_RGB, GL_SRGB);
 
+            // Normal and depth maps are packed together, baked on first launch
+            std::filesystem::path cacheDir{CACHE_DIR};
             std::filesystem::path wallNormalPath = texturesDir / "bricks2_normal.jpg";
-            auto wallNormal = GenTexture(wallNormalPath, GL_TEXTURE3, GL_RGB, GL_SRGB);
-
             std::filesystem::path wallDepthPath = texturesDir / "bricks2_disp.jpg";
-            auto wallDepth = GenTexture(wallDepthPath, GL_TEXTURE4, GL_RGB, GL_SRGB);
+            std::filesystem::path wallNormalDepthPath = cacheDir / "bricks2_normal_depth.tex";
+            if(LearnOpenGL::NeedsTextureBake(wallNormalDepthPath, {wallNormalPath, wallDepthPath}))
+                LearnOpenGL::BakeNormalDepth(wallNormalPath, wallDepthPath, wallNormalDepthPath);
+            // kept whole, averaged cone ratios would let the parallax march step through the surface
+            auto wallNormalDepth = GenBakedTexture(wallNormalDepthPath, GL_TEXTURE3, GL_RGBA8, false);
+
+            // Flat and without depth, for the materials that have no normal map
+            unsigned int flatNormalDepth;
+            const unsigned char flat[4] = {128, 128, 0, 0};
+            glGenTextures(1, &flatNormalDepth);
+            glBindTexture(GL_TEXTURE_2D, flatNormalDepth);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, flat);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            // Skybox, compressed into a single file on first launch
+            auto skyboxFaces = LearnOpenGL::Cubemap::FacesAt(texturesDir);
+            std::filesystem::path skyboxPath = cacheDir / "skybox.tex";
+            if(LearnOpenGL::NeedsTextureBake(skyboxPath, {skyboxFaces.begin(), skyboxFaces.end()}))
+                LearnOpenGL::Cubemap::Bake(skyboxFaces, skyboxPath);
+            auto skybox = LearnOpenGL::Cubemap::FromFile(skyboxPath);
+            if(!skybox)
+                skybox = LearnOpenGL::Cubemap::FromFaces(skyboxFaces);
+
+            skyboxShader.use();
+            skyboxShader.setInt("skybox", 0);
+
+            // Ambient light from the skybox, baked along with it
+            if(LearnOpenGL::ImageBasedLighting::NeedsBake(skyboxPath, cacheDir))
+                LearnOpenGL::ImageBasedLighting::Bake(skyboxPath, cacheDir);
+            LearnOpenGL::ImageBasedLighting environment;
+            environment.Load(cacheDir);
+            for(auto shader : litShaders)
+                environment.SetUniforms(*shader, 5, 6, ENVIRONMENT_STRENGTH);
+            environment.Bind(5, 6);
+
+            LearnOpenGL::TextureResidency::Get().SetBudget(TEXTURE_BUDGET);
+
+            // Texture promotions reload on a hidden window's context, sharing objects with this one, so they don't stall frames
+            GLFWwindow* uploadWindow = nullptr;
+            std::unique_ptr<LearnOpenGL::UploadThread> uploads;
+            if(BACKGROUND_UPLOADS)
+            {
+                glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+                uploadWindow = glfwCreateWindow(1, 1, "Uploads", NULL, window);
+                glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+            }
+            if(uploadWindow)
+            {
+                uploads = std::make_unique<LearnOpenGL::UploadThread>([uploadWindow]() { glfwMakeContextCurrent(uploadWindow); }, []() { glfwMakeContextCurrent(nullptr); });
+                LearnOpenGL::TextureResidency::Get().SetUploadThread(uploads.get());
+            }
 
             // Set material properties
-            cubeShader.use();
-            cubeShader.setInt("material.diffuse", 0);
-            cubeShader.setInt("material.specular", 1);
-            cubeShader.setInt("material.normal", 3);
-            cubeShader.setInt("material.depth", 4);
-            cubeShader.setFloat("material.shininess", 8.0f);
+            for(auto shader : materialShaders)
+            {
+                shader->use();
+                shader->setInt("material.diffuse", 0);
+                shader->setInt("material.specular", 1);
+                shader->setInt("material.normalDepth", 3);
+                shader->setFloat("material.shininess", 8.0f);
+            }
 
             // Light colors
             glm::vec3 lightColor{ 1.0f, 1.0f, 1.0f };
-            glm::vec3 lightAmbient = lightColor * glm::vec3{ 0.05f };
             glm::vec3 lightDiffuse = lightColor * glm::vec3{ 0.5f };
             glm::vec3 lightSpecular{ 1.0f };
 
             // Direcitonal Light
             glm::vec3 lightDir{-0.2f, -1.0f, -0.3f};
-            glm::vec3 dirLightAmbient = lightColor * glm::vec3{ 0.05f };
             glm::vec3 dirLightDiffuse = lightColor * glm::vec3{ 0.4f };
             glm::vec3 dirLightSpecular = lightColor * glm::vec3{ 0.5f };
-            cubeShader.setVec3("dirLight.dir", glm::value_ptr(lightDir));
-            cubeShader.setVec3("dirLight.light.ambient", glm::value_ptr(dirLightAmbient));
-            cubeShader.setVec3("dirLight.light.diffuse", glm::value_ptr(dirLightDiffuse));
-            cubeShader.setVec3("dirLight.light.specular", glm::value_ptr(dirLightSpecular));
+            for(auto shader : litShaders)
+            {
+                shader->use();
+                shader->setVec3("dirLight.dir", glm::value_ptr(lightDir));
+                shader->setVec3("dirLight.light.diffuse", glm::value_ptr(dirLightDiffuse));
+                shader->setVec3("dirLight.light.specular", glm::value_ptr(dirLightSpecular));
+            }
 
             // PointLights
-            glm::vec3 pointLightAmbient = lightColor * glm::vec3{ 0.05f };
             glm::vec3 pointLightDiffuse = lightColor * glm::vec3{ 0.8f };
             glm::vec3 pointLightSpecular = lightColor * glm::vec3{ 1.f };
             float constant = 1.0f;
             float linear = 0.09;
             float quadratic = 0.032;
 
+            // Per frame uploads, written straight into a mapped buffer when the driver allows
+            std::unique_ptr<LearnOpenGL::StreamBuffer> stream;
+            if(LearnOpenGL::StreamBuffer::Supported())
+                stream = std::make_unique<LearnOpenGL::StreamBuffer>(STREAM_BUFFER_BYTES);
+
+            // Every point light is shaded through the clusters
+            LearnOpenGL::LightClusters clusters;
+            clusters.Bind(7, 8, 9);
+            clusters.SetStreamBuffer(stream.get());
+            // the frame lights once culled, on the render thread
+            std::vector<LearnOpenGL::PointLight> pointLights;
+
+            // Shadows of the main point lights in one atlas, static casters cached
+            LearnOpenGL::PointShadows pointShadows{shaderFolder};
+            for(auto shader : litShaders)
+                pointShadows.SetUniforms(*shader, 13, 15);
+            pointShadows.Bind(13, 15);
+
+            // Sun shadows, only drawn while the sun is on
+            LearnOpenGL::CascadedShadows sunShadows{shaderFolder};
+            sunShadows.Bind(14);
+            for(auto shader : litShaders)
+                sunShadows.SetUniforms(*shader, 14);
+
             // Flashlight
-            glm::vec3 spotLightAmbient = lightColor * glm::vec3{ 0.0f };
             glm::vec3 spotLightDiffuse = lightColor * glm::vec3{ 1.f };
             glm::vec3 spotLightSpecular = lightColor * glm::vec3{ 1.f };
             float slConstant = 1.0f;
             float slLinear = 0.09;
             float slQuadratic = 0.032;
-            cubeShader.setVec3("spotLight.light.ambient", glm::value_ptr(spotLightAmbient));
-            cubeShader.setVec3("spotLight.light.diffuse", glm::value_ptr(spotLightDiffuse));
-            cubeShader.setVec3("spotLight.light.specular", glm::value_ptr(spotLightSpecular));
-            cubeShader.setFloat("spotLight.attenuation.constant", slConstant);
-            cubeShader.setFloat("spotLight.attenuation.linear", slLinear);
-            cubeShader.setFloat("spotLight.attenuation.quadratic", slQuadratic);
-            cubeShader.setFloat("spotLight.iCutOff", glm::cos(glm::radians(6.5f)));
-            cubeShader.setFloat("spotLight.oCutOff", glm::cos(glm::radians(12.0f)));
+            for(auto shader : litShaders)
+            {
+                shader->use();
+                shader->setVec3("spotLight.light.diffuse", glm::value_ptr(spotLightDiffuse));
+                shader->setVec3("spotLight.light.specular", glm::value_ptr(spotLightSpecular));
+                shader->setFloat("spotLight.attenuation.constant", slConstant);
+                shader->setFloat("spotLight.attenuation.linear", slLinear);
+                shader->setFloat("spotLight.attenuation.quadratic", slQuadratic);
+                shader->setFloat("spotLight.iCutOff", glm::cos(glm::radians(6.5f)));
+                shader->setFloat("spotLight.oCutOff", glm::cos(glm::radians(12.0f)));
+            }
+
+            // Deferred path, switched with F
+            LearnOpenGL::GBuffer gBuffer{WINDOW_WIDTH, WINDOW_HEIGHT};
+            deferredShader.use();
+            deferredShader.setInt("gBuffer.albedo", 10);
+            deferredShader.setInt("gBuffer.normal", 11);
+            deferredShader.setInt("gBuffer.depth", 12);
+            bool deferred = false;
+            std::vector<LearnOpenGL::DrawPacket> unlit;
+
+            // Render queue materials, textures by unit
+            LearnOpenGL::RenderQueue queue;
+            auto noMaterial = queue.AddMaterial({});
+            auto containerMaterial = queue.AddMaterial({{texture, specularMap, 0, flatNormalDepth}});
+            auto woodMaterial = queue.AddMaterial({{wood, wood, 0, flatNormalDepth}});
+            auto wallMaterial = queue.AddMaterial({{wall, wall, 0, wallNormalDepth}});
+
+            // Depth prepass, switched with Z. Costs are fragment times against the depth shader, which marches the parallax ray too.
+            // Lighting makes the forward shader worth it, the G-buffer one barely costs more than its prepass would
+            queue.SetDepthProgram(cubeShader.ID, depthShader.ID, FORWARD_SHADER_COST);
+            queue.SetDepthProgram(gBufferShader.ID, depthShader.ID, G_BUFFER_SHADER_COST);
+            queue.SetDepthPrepass(true);
+            LearnOpenGL::FragmentCounter prepassFragments;
+            LearnOpenGL::FragmentCounter shadedFragments;
+            queue.SetCounters(&prepassFragments, &shadedFragments);
+            queue.SetStreamBuffer(stream.get());
+            unsigned int stressMaterials[] = {containerMaterial, woodMaterial, wallMaterial};
+
+            // Scene entities, the boxes and the floor stay hidden
+            LearnOpenGL::Scene scene;
+            LearnOpenGL::Scene::Geometry cubeGeometry{VAO[CUBE], 36, true, glm::vec3(-1.0f), glm::vec3(1.0f), &cubeBvh};
+            LearnOpenGL::Scene::Geometry lightGeometry{VAO[LIGHT], 36, true, glm::vec3(-1.0f), glm::vec3(1.0f), &cubeBvh};
+            LearnOpenGL::Scene::Geometry planeGeometry{VAO[PLANE], 6, false, p1, p3, &planeBvh};
+            auto sceneCube = scene.AddGeometry(cubeGeometry);
+            auto sceneLight = scene.AddGeometry(lightGeometry);
+            auto scenePlane = scene.AddGeometry(planeGeometry);
+            for(auto& pos : cubePos)
+                scene.Create(sceneCube, containerMaterial, pos, glm::vec3(0.5f), LearnOpenGL::Scene::HIDDEN);
+            scene.Create(scenePlane, woodMaterial, glm::vec3(0.0f), glm::vec3(5.0f), LearnOpenGL::Scene::HIDDEN);
+            auto wallEntity = scene.Create(scenePlane, wallMaterial, glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(1.0f), LearnOpenGL::Scene::STATIC_CASTER);
+            // spinning, casting a moving shadow on the wall
+            auto panelEntity = scene.Create(scenePlane, woodMaterial, glm::vec3(0.35f, 0.25f, -1.8f), glm::vec3(0.15f), LearnOpenGL::Scene::DYNAMIC_CASTER);
+            // the point lights, only the first one is on
+            LearnOpenGL::Scene::Entity lightEntities[4];
+            for(int i = 0; i < 4; i++)
+            {
+                lightEntities[i] = scene.Create(sceneLight, noMaterial, pointLightPositions[i], glm::vec3(0.2f), LearnOpenGL::Scene::UNLIT | (i ? LearnOpenGL::Scene::HIDDEN : 0));
+                LearnOpenGL::PointLight light;
+                light.diffuse = pointLightDiffuse;
+                light.specular = pointLightSpecular;
+                light.constant = constant;
+                light.linear = linear;
+                light.quadratic = quadratic;
+                light.radius = LearnOpenGL::LightRange(light, LIGHT_THRESHOLD);
+                light.shadowId = i;
+                scene.AddLight(lightEntities[i], light);
+            }
+
+            LearnOpenGL::Scene stressScene;
+            BuildStress(stressScene, stressScene.AddGeometry(planeGeometry), stressScene.AddGeometry(lightGeometry), stressMaterials, 3, STRESS_PACKETS);
+            LearnOpenGL::Scene swarmScene;
+            BuildLightSwarm(swarmScene, LIGHT_SWARM);
 
             // Set camera pos
             camera.Position = glm::vec3{0, 0, -0.5f};
-            
+
             // Light flags
-            bool lightsOn[] = {true, false, false, false};
             bool sun = false;
             bool flashlight = false;
             bool blinn = true;
+            bool stress = false;
+            bool prepass = true;
+            LearnOpenGL::Bvh stressTree;
+            std::vector<uint32_t> stressVisible;
+            // the wall hides most of the stress draws
+            LearnOpenGL::OcclusionCuller occlusion;
+            std::vector<glm::mat4> occluders;
+            bool swarm = false;
+            // what the crosshair was on when last clicked
+            std::string picked = "nothing";
+
+            // Rendering runs on its own thread from here, one frame behind this one. It owns the context until it stops
+            std::mutex renderStatsMutex;
+            std::string renderStats;
+            glfwMakeContextCurrent(nullptr);
+            LearnOpenGL::RenderThread<Frame> renderer{[&](const Frame& frame)
+            {
+                float aspect = (float)frame.width / (float)frame.height;
+                glViewport(0, 0, frame.width, frame.height);
 
-            // Game loop
+                // Clear
+                glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                auto inverseViewProjection = glm::inverse(frame.projection * frame.view);
+                for(auto shader : materialShaders)
+                {
+                    shader->use();
+                    // the lighting needs it for the sun cascades, the vertex matrices come from the render queue
+                    shader->setMatrix("view", glm::value_ptr(frame.view));
+                    // the vertex shader needs it for the parallax
+                    shader->setVec3("viewPos", glm::value_ptr(frame.viewPos));
+                }
+                deferredShader.use();
+                deferredShader.setMatrix("view", glm::value_ptr(frame.view));
+                deferredShader.setMatrix("inverseViewProjection", glm::value_ptr(inverseViewProjection));
+
+                queue.SetDepthPrepass(frame.prepass);
+                queue.Begin(frame.projection * frame.view, frame.viewPos, 100.f);
+
+                for(auto shader : litShaders)
+                {
+                    shader->use();
+                    shader->setVec3("viewPos", glm::value_ptr(frame.viewPos));
+                    shader->setVec3("spotLight.pos", glm::value_ptr(frame.viewPos));
+                    shader->setVec3("spotLight.dir", glm::value_ptr(frame.viewDir));
+                    shader->setBool("sunOn", frame.sun);
+                    shader->setBool("flashlightOn", frame.flashlight);
+                    shader->setBool("blinn", frame.blinn);
+                }
+
+                // Point lights
+                pointLights = frame.pointLights;
+                clusters.Cull(pointLights, frame.frustum);
+                pointShadows.Allocate(pointLights, frame.viewPos, frame.fov, frame.height);
+
+                clusters.SetProjection(frame.fov, aspect, 0.1f, 100.f);
+                clusters.Update(pointLights, frame.view);
+                for(auto shader : litShaders)
+                    clusters.SetUniforms(*shader, 7, 8, 9, frame.width, frame.height);
+
+                glCullFace(GL_BACK);
+                for(auto& packet : frame.packets)
+                    queue.Push(packet);
+                pointShadows.Update(pointLights, frame.staticCasters, frame.dynamicCasters);
+                if(frame.sun)
+                {
+                    sunShadows.SetProjection(frame.fov, aspect, 0.1f, SUN_SHADOW_DISTANCE);
+                    sunShadows.Update(frame.view, lightDir, {&frame.staticCasters, &frame.dynamicCasters});
+                    for(auto shader : litShaders)
+                        sunShadows.SetUniforms(*shader, 14);
+                }
+                glViewport(0, 0, frame.width, frame.height);
+                if(frame.deferred)
+                {
+                    // Geometry pass. The light markers are unlit so they stay in the forward queue
+                    unlit.clear();
+                    queue.Extract(lightShader.ID, unlit);
+                    gBuffer.Resize(frame.width, frame.height);
+                    gBuffer.Bind();
+                    queue.Submit();
+                    gBuffer.Unbind();
+                    glViewport(0, 0, frame.width, frame.height);
+
+                    // Lighting pass, once per covered pixel. It writes the G-buffer depth so forward draws still sort against the scene
+                    gBuffer.BindTextures(10, 11, 12);
+                    deferredShader.use();
+                    glDepthFunc(GL_ALWAYS);
+                    glBindVertexArray(VAO[QUAD]);
+                    shadedFragments.Begin();
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                    shadedFragments.End();
+                    glDepthFunc(GL_LESS);
+
+                    queue.Begin(frame.projection * frame.view, frame.viewPos, 100.f);
+                    for(auto& packet : unlit)
+                        queue.Push(packet);
+                }
+                queue.Submit();
+                prepassFragments.EndFrame();
+                shadedFragments.EndFrame();
+
+                // Skybox, last so it's only shaded where nothing else was drawn. We're inside the cube so its front faces go
+                skyboxShader.use();
+                skyboxShader.setMatrix("view", glm::value_ptr(frame.view));
+                skyboxShader.setMatrix("projection", glm::value_ptr(frame.projection));
+                glDepthFunc(GL_LEQUAL);
+                glCullFace(GL_FRONT);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, skybox);
+                glBindVertexArray(VAO[LIGHT]);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                glCullFace(GL_BACK);
+                glDepthFunc(GL_LESS);
+                // Draw Scene - END
+
+                quadShader.use();
+                quadShader.setInt("iTexture", 0);
+
+                glActiveTexture(GL_TEXTURE0);
+                glBindVertexArray(VAO[QUAD]);
+                //glDrawArrays(GL_TRIANGLES, 0, 6);
+
+                // Texture streaming, taking the reloads the upload thread is done with first
+                if(uploads)
+                    uploads->Poll();
+                auto& residency = LearnOpenGL::TextureResidency::Get();
+                residency.Update();
+
+                // GL work queued by jobs
+                jobs.RunMainJobs();
+
+                // Done with this frame's uploads
+                if(stream)
+                    stream->EndFrame();
+
+                // Stats, for the title the main thread sets
+                if(frame.stats)
+                {
+                    auto& counters = residency.GetCounters();
+                    std::string title = std::string("Window - ") + (frame.deferred ? "Deferred (" + std::to_string(gBuffer.Bytes() / 1024) + " KB G-buffer)" : "Forward")
+                        + " - Textures: " + std::to_string(counters.residentBytes / 1024) + "/" + std::to_string(counters.budgetBytes / 1024) + " KB"
+                        + " (" + std::to_string(counters.demoted) + " demoted, " + std::to_string(counters.evictions) + " evictions, " + std::to_string(counters.reloads) + " reloads)";
+                    auto& queueStats = queue.GetStats();
+                    title += " - Fragments: " + std::to_string(shadedFragments.GetCount() / 1000) + "K shaded, " + std::to_string(prepassFragments.GetCount() / 1000) + "K prepass"
+                        + (shadedFragments.CountsInvocations() ? "" : " (samples passed)")
+                        + " - Draws: " + std::to_string(queueStats.packets) + " (" + std::to_string(queueStats.prepassed) + " prepassed, " + std::to_string(queueStats.programBinds) + " programs, "
+                        + std::to_string(queueStats.textureBinds) + " textures, " + std::to_string(queueStats.vaoBinds) + " VAOs)"
+                        + " objects " + std::to_string(queueStats.objectsMs) + " ms, sort " + std::to_string(queueStats.sortMs) + " ms, record " + std::to_string(queueStats.recordMs)
+                        + " ms (" + std::to_string(queueStats.commands) + " commands), submit " + std::to_string(queueStats.submitMs) + " ms";
+                    auto& shadowStats = pointShadows.GetStats();
+                    title += std::string(" - Shadows") + (shadowStats.instanced ? " (instanced): " : " (per face): ")
+                        + std::to_string(shadowStats.shadowed) + " lights, " + std::to_string(shadowStats.dropped) + " dropped, " + std::to_string(shadowStats.repacks) + " repacks, "
+                        + std::to_string((int)(shadowStats.atlasUsage * 100.0f)) + "% atlas, " + std::to_string(shadowStats.triangles) + "/"
+                        + std::to_string(shadowStats.unculledTriangles) + " triangles (";
+                    for(int face = 0; face < 6; face++)
+                        title += std::to_string(shadowStats.faceTriangles[face]) + (face < 5 ? " " : " by face), ");
+                    title += std::to_string(shadowStats.staticRenders) + " static, " + std::to_string(shadowStats.dynamicRenders) + " dynamic renders, "
+                        + std::to_string(shadowStats.updateMs) + " ms";
+                    if(frame.sun)
+                    {
+                        auto& sunStats = sunShadows.GetStats();
+                        title += " - Sun: " + std::to_string(sunStats.cascadesDrawn) + " cascades drawn, " + std::to_string(sunStats.triangles) + " triangles, "
+                            + std::to_string(sunStats.updateMs) + " ms";
+                    }
+                    auto& clusterStats = clusters.GetStats();
+                    title += " - Lights: " + std::to_string(clusterStats.lights) + " (" + std::to_string(clusterStats.culled) + " culled, " + std::to_string(clusterStats.indices) + " cluster entries, "
+                        + std::to_string(clusterStats.maxPerCluster) + " max) assign " + std::to_string(clusterStats.assignMs) + " ms";
+                    if(stream)
+                    {
+                        auto& streamStats = stream->GetStats();
+                        title += " - Stream: " + std::to_string(streamStats.usedBytes / 1024) + "/" + std::to_string(streamStats.regionBytes / 1024) + " KB ("
+                            + std::to_string(streamStats.allocations) + " allocations, " + std::to_string(streamStats.waits) + " waits, " + std::to_string(streamStats.grows) + " grows)";
+                    }
+                    if(uploads)
+                    {
+                        auto uploadStats = uploads->GetStats();
+                        title += " - Uploads: " + std::to_string(uploadStats.pending) + " pending, " + std::to_string(uploadStats.uploads) + " done, "
+                            + std::to_string(uploadStats.uploadMs) + " ms";
+                    }
+                    std::lock_guard<std::mutex> lock(renderStatsMutex);
+                    renderStats = std::move(title);
+                }
+
+                // Swap buffers
+                glfwSwapBuffers(window);
+            },
+            [&]()
+            {
+                glfwMakeContextCurrent(window);
+                jobs.SetMainThread();
+            },
+            [&]()
+            {
+                glfwMakeContextCurrent(nullptr);
+            }};
+
+            // Game loop, filling the frames the render thread draws
             float deltaTime = 0;
+            float lastStats = 0;
             while(!glfwWindowShouldClose(window))
-            {   
+            {
                 float now = glfwGetTime();
                 // Window Input
                 if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
                     glfwSetWindowShouldClose(window, true);
 
                 // Update light pos
-                pointLightPositions[0].y = sin(glfwGetTime()) * 0.15f;
-
-                for(auto i = 0; i < 4; i++)
-                {
-                    std::string pointLight = "pointLights[" + std::to_string(i) + "]";
-                    cubeShader.use();
-                    cubeShader.setVec3(pointLight + ".pos", glm::value_ptr(pointLightPositions[i]));
-                    cubeShader.setVec3(pointLight + ".light.ambient", glm::value_ptr(pointLightAmbient));
-                    cubeShader.setVec3(pointLight + ".light.diffuse", glm::value_ptr(pointLightDiffuse));
-                    cubeShader.setVec3(pointLight + ".light.specular", glm::value_ptr(pointLightSpecular));
-                    cubeShader.setFloat(pointLight + ".attenuation.constant", constant);
-                    cubeShader.setFloat(pointLight + ".attenuation.linear", linear);
-                    cubeShader.setFloat(pointLight + ".attenuation.quadratic", quadratic);
-                }
-
-                // Draw Scene - BEGIN
-                glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-                // Clear
-                glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                scene.transforms.position[lightEntities[0]].y = sin(glfwGetTime()) * 0.15f;
+                scene.transforms.rotation[panelEntity] = glm::angleAxis(now, glm::vec3(0.0f, 1.0f, 0.0f));
 
                 // Camera movement
                 float cameraSpeed = 2.5f * deltaTime;
@@ -475,76 +958,148 @@ int main()
                     camera.ProcessKeyboard(Camera_Movement::RIGHT, deltaTime);
 
                 if(isKeyPressed(window, GLFW_KEY_G))
-                    camera.Position = pointLightPositions[0];
+                    camera.Position = scene.transforms.position[lightEntities[0]];
                 else if(isKeyPressed(window, GLFW_KEY_O))
                     camera.Position = glm::vec3(0.0f);
 
-                // Camera pos
-                cubeShader.use();
-                cubeShader.setVec3("viewPos", glm::value_ptr(camera.Position));
-                cubeShader.setVec3("spotLight.pos", glm::value_ptr(camera.Position));
-                cubeShader.setVec3("spotLight.dir", glm::value_ptr(camera.Front));
-
                 // Transformations
-                auto view = camera.GetViewMatrix();                    
-                auto projection = glm::perspective(glm::radians(camera.Zoom),  (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.f);
-                cubeShader.use();
-                cubeShader.setMatrix("projection", glm::value_ptr(projection));
-                cubeShader.setMatrix("view", glm::value_ptr(view));    
-
-                // Light
-                lightShader.use();
-                lightShader.setMatrix("view", glm::value_ptr(view));
-                lightShader.setMatrix("projection", glm::value_ptr(projection));
-
-                for(auto i = 0; i < 4; i++)
-                {
-                    auto model = glm::translate(glm::mat4{1.0f}, pointLightPositions[i]);
-                    model = glm::scale(model, glm::vec3(0.2f)); 
-                    lightShader.setMatrix("model", glm::value_ptr(model));
-
-                    glBindVertexArray(VAO[LIGHT]);
-                    if(lightsOn[i])
-                    glDrawArrays(GL_TRIANGLES, 0, 36);
-                }
+                auto& frame = renderer.Next();
+                frame.width = WINDOW_WIDTH;
+                frame.height = WINDOW_HEIGHT;
+                frame.view = camera.GetViewMatrix();
+                float aspect = (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT;
+                frame.projection = camera.GetProjectionMatrix(aspect, 0.1f, 100.f);
+                frame.frustum = camera.GetFrustum(aspect, 0.1f, 100.f);
+                frame.viewPos = camera.Position;
+                frame.viewDir = camera.Front;
+                frame.fov = glm::radians(camera.Zoom);
 
                 // Light Control
-                cubeShader.use();
                 if(isKeyPressed(window, GLFW_KEY_K))
                     sun = !sun;
-                cubeShader.setBool("sunOn", sun);
                 if(isKeyPressed(window, GLFW_KEY_L))
                     flashlight = !flashlight;
-                cubeShader.setBool("flashlightOn", flashlight);
                 if(isKeyPressed(window, GLFW_KEY_B))
                     blinn = !blinn;
-                cubeShader.setBool("blinn", blinn);
 
                 for(auto i = 0; i < 4; i++)
-                {   
+                {
                     if(isKeyPressed(window, GLFW_KEY_1 + i))
-                        lightsOn[i] = !lightsOn[i];
-                    cubeShader.setBool("lightsOn["+ std::to_string(i) + "]", lightsOn[i]);
+                        scene.SetHidden(lightEntities[i], !scene.IsHidden(lightEntities[i]));
                 }
+                if(isKeyPressed(window, GLFW_KEY_M))
+                    swarm = !swarm;
 
-                glCullFace(GL_BACK);
-                DrawScene(cubePos, VAO, cubeShader, texture, specularMap, wood, wall, wallNormal, wallDepth);
-                // Draw Scene - END
-                
-                quadShader.use();
-                quadShader.setInt("iTexture", 0);
+                // Point lights
+                frame.pointLights.clear();
+                scene.GatherLights(frame.pointLights);
+                if(swarm)
+                {
+                    UpdateLightSwarm(swarmScene, now);
+                    swarmScene.GatherLights(frame.pointLights);
+                }
 
-                glActiveTexture(GL_TEXTURE0);
-                glBindVertexArray(VAO[QUAD]);
-                //glDrawArrays(GL_TRIANGLES, 0, 6);
+                if(isKeyPressed(window, GLFW_KEY_P))
+                    stress = !stress;
+                if(isKeyPressed(window, GLFW_KEY_F))
+                    deferred = !deferred;
+                if(isKeyPressed(window, GLFW_KEY_Z))
+                    prepass = !prepass;
+                frame.sun = sun;
+                frame.flashlight = flashlight;
+                frame.blinn = blinn;
+                frame.deferred = deferred;
+                frame.prepass = prepass;
+
+                auto sceneProgram = deferred ? gBufferShader.ID : cubeShader.ID;
+                frame.packets.clear();
+                frame.staticCasters.clear();
+                frame.dynamicCasters.clear();
+                occluders.clear();
+                scene.UpdateTransforms();
+                scene.Draw(frame.packets, sceneProgram, lightShader.ID, &frame.staticCasters, &frame.dynamicCasters);
+                // the parallax discards along the edges, so the wall only hides what's behind its inner part
+                occluders.push_back(glm::scale(scene.transforms.model[wallEntity], glm::vec3(0.9f, 0.9f, 1.0f)));
+                if(stress)
+                {
+                    UpdateStress(stressScene, now);
+                    stressScene.UpdateTransforms();
+                    stressScene.UpdateBounds();
+                    stressTree.Refit(stressScene.bounds);
+                    stressTree.Query(frame.frustum, stressVisible);
+                    occlusion.Begin(frame.projection * frame.view);
+                    for(auto& model : occluders)
+                        occlusion.AddOccluder(planeTriangles, model);
+                    occlusion.BuildHierarchy();
+                    occlusion.Cull(stressScene.bounds, stressVisible);
+                    stressScene.Draw(frame.packets, sceneProgram, lightShader.ID, stressVisible);
+                }
+                if(glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+                {
+                    // the cursor is captured, so pick along the view direction
+                    float wall = scene.Raycast(wallEntity, camera.Position, camera.Front);
+                    LearnOpenGL::Bvh::Hit hit;
+                    if(stress)
+                    {
+                        hit = stressTree.Raycast(camera.Position, camera.Front, wall, [&](uint32_t i, float closest)
+                        {
+                            return stressScene.Raycast(i, camera.Position, camera.Front, closest);
+                        });
+                    }
+                    if(hit.object != LearnOpenGL::Bvh::NONE)
+                        picked = "stress draw " + std::to_string(hit.object) + " at " + std::to_string(hit.distance);
+                    else if(wall != std::numeric_limits<float>::infinity())
+                        picked = "wall at " + std::to_string(wall);
+                    else
+                        picked = "nothing";
+                }
+
+                frame.stats = now - lastStats > 1.0f;
+                if(frame.stats)
+                    lastStats = now;
+                renderer.Publish();
+
+                // Stats. The render thread writes its part while drawing the frame that asked, the title goes up once it's there
+                std::string title;
+                {
+                    std::lock_guard<std::mutex> lock(renderStatsMutex);
+                    title.swap(renderStats);
+                }
+                if(!title.empty())
+                {
+                    if(stress)
+                    {
+                        auto& treeStats = stressTree.GetStats();
+                        auto& occlusionStats = occlusion.GetStats();
+                        title += " - Stress: " + std::to_string(occlusionStats.tested) + "/" + std::to_string(STRESS_PACKETS) + " in view, " + std::to_string(occlusionStats.occluded)
+                            + " occluded, BVH " + std::to_string(treeStats.nodes) + " nodes, cost " + std::to_string((int)treeStats.cost) + "/" + std::to_string((int)treeStats.builtCost)
+                            + ", refit " + std::to_string(treeStats.refitMs) + " ms, " + std::to_string(treeStats.rebuilds) + " builds, occlusion "
+                            + std::to_string(occlusionStats.rasterMs + occlusionStats.testMs) + " ms, entities "
+                            + std::to_string(stressScene.GetStats().transformMs + stressScene.GetStats().boundsMs) + " ms";
+                    }
+                    title += " - Picked: " + picked;
+                    auto jobStats = jobs.GetStats();
+                    title += " - Jobs: " + std::to_string(jobStats.threads) + " threads, " + std::to_string(jobStats.jobs) + " run, " + std::to_string(jobStats.steals) + " stolen";
+                    auto threadStats = renderer.GetStats();
+                    title += " - Render thread: " + std::to_string(threadStats.renderMs) + " ms, waited " + std::to_string(threadStats.waitMs) + " ms";
+                    glfwSetWindowTitle(window, title.c_str());
+                }
 
                 glfwPollEvents();
-                
-                // Swap buffers
-                glfwSwapBuffers(window);
 
                 deltaTime = glfwGetTime() - now;
             }
+
+            // Back to this thread for the cleanup
+            renderer.Stop();
+            glfwMakeContextCurrent(window);
+            jobs.SetMainThread();
+            if(uploads)
+            {
+                LearnOpenGL::TextureResidency::Get().SetUploadThread(nullptr);
+                uploads.reset();
+                glfwDestroyWindow(uploadWindow);
+            }
         }
     }
     else